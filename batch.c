@@ -0,0 +1,307 @@
+#include "batch.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/msg.h>
+#include "sync.h"
+#include "messages.h"
+#include "file-properties.h"
+#include "stats.h"
+#include "trace.h"
+#include "log.h"
+
+// A job file lists one synchronization per line, source and destination separated by a tab (or by spaces when the
+// line has no tab). Empty lines and lines starting with # are ignored. All the jobs run on the processes prepared
+// once for the batch, so that each job only pays for its own listing, analysis and copy. Up to BATCH_CONCURRENT_JOBS
+// jobs are listed and analyzed at the same time: the listers share their credits between them, and the main process
+// compares and copies each job as soon as both its lists are complete, while the pool works on the others.
+
+static int jobs_count = 0;
+static uint64_t batch_entries = 0;
+static uint64_t batch_copied = 0;
+static uint64_t batch_bytes = 0;
+
+/*!
+ * @brief parse_job_line splits a job line into its source and destination
+ * @param line is the line, without its end of line (it is modified)
+ * @param source is set to the source of the job
+ * @param destination is set to the destination of the job
+ * @return 1 for a job, 0 for a line to ignore, -1 for an invalid line
+ */
+static int parse_job_line(char *line, char **source, char **destination) {
+    while (*line == ' ' || *line == '\t') {
+        ++line;
+    }
+    if (*line == '\0' || *line == '#') {
+        return 0;
+    }
+    char *separator = strchr(line, '\t');
+    if (separator == NULL) {
+        separator = strchr(line, ' ');
+    }
+    if (separator == NULL) {
+        return -1;
+    }
+    *separator++ = '\0';
+    while (*separator == ' ' || *separator == '\t') {
+        ++separator;
+    }
+    size_t length = strlen(separator);
+    while (length > 0 && (separator[length - 1] == ' ' || separator[length - 1] == '\t' || separator[length - 1] == '\r')) {
+        separator[--length] = '\0';
+    }
+    if (length == 0) {
+        return -1;
+    }
+    *source = line;
+    *destination = separator;
+    return 1;
+}
+
+/*!
+ * @brief report_throughput prints the throughput of a job or of the whole batch
+ * The entries are those of the sources, which do not depend on what the destinations already hold.
+ * @param label is the name of what is reported
+ * @param entries is the number of entries of the sources
+ * @param copied is the number of copied entries
+ * @param bytes is the number of copied bytes
+ * @param duration_ns is the duration in nanoseconds
+ */
+static void report_throughput(const char *label, uint64_t entries, uint64_t copied, uint64_t bytes, uint64_t duration_ns) {
+    double seconds = duration_ns / 1e9;
+    printf("%s: %lu entries, %lu copied (%lu bytes) in %.3f ms, %.1f entries/s, %.2f MB/s\n", label, entries, copied,
+           bytes, duration_ns / 1e6, seconds > 0 ? entries / seconds : 0, seconds > 0 ? bytes / 1e6 / seconds : 0);
+}
+
+/*!
+ * @brief report_job prints the throughput of a job and adds it to the batch
+ * @param number is the rank of the job
+ * @param source is the source of the job
+ * @param destination is the destination of the job
+ * @param entries is the number of entries of its source
+ * @param copied is the number of copied entries
+ * @param bytes is the number of copied bytes
+ * @param duration_ns is its duration in nanoseconds
+ */
+static void report_job(int number, char *source, char *destination, uint64_t entries, uint64_t copied, uint64_t bytes, uint64_t duration_ns) {
+    char label[BATCH_LINE_SIZE + 32];
+    snprintf(label, sizeof(label), "Job %d %s -> %s", number, source, destination);
+    report_throughput(label, entries, copied, bytes, duration_ns);
+    batch_entries += entries;
+    batch_copied += copied;
+    batch_bytes += bytes;
+}
+
+/*!
+ * @brief read_next_job reads the job file up to its next valid job, invalid jobs are reported and skipped
+ * @param jobs is the job file
+ * @param line is a buffer of BATCH_LINE_SIZE bytes for the line of the job
+ * @param line_number is a pointer to the number of the last line read
+ * @param the_config is a pointer to the configuration
+ * @param source is set to the source of the job (it points into line)
+ * @param destination is set to the destination of the job (it points into line)
+ * @param result is set to -1 when an invalid job is skipped
+ * @return true if a job was read, false at the end of the job file
+ */
+static bool read_next_job(FILE *jobs, char *line, int *line_number, configuration_t *the_config, char **source, char **destination, int *result) {
+    while (fgets(line, BATCH_LINE_SIZE, jobs) != NULL) {
+        ++*line_number;
+        line[strcspn(line, "\n")] = '\0';
+        int parsed = parse_job_line(line, source, destination);
+        if (parsed == 0) {
+            continue;
+        }
+        if (parsed == -1 || strlen(*source) >= sizeof(the_config->source) || strlen(*destination) >= sizeof(the_config->destination)) {
+            fprintf(stderr, "Invalid job at line %d of %s\n", *line_number, the_config->jobs_file);
+            *result = -1;
+            continue;
+        }
+        if (!directory_exists(*source) || !directory_exists(*destination) || !is_directory_writable(*destination)) {
+            fprintf(stderr, "Skipping job %s -> %s: either source or destination directory do not exist or is not writable\n", *source, *destination);
+            *result = -1;
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+/*!
+ * @brief run_jobs_in_turn runs the jobs of a job file one after another
+ * @param jobs is the job file
+ * @param the_config is a pointer to the configuration (its source and destination are set for each job)
+ * @param p_context is a pointer to the processes context
+ * @return 0 if all the jobs ran, -1 if a job was invalid
+ */
+static int run_jobs_in_turn(FILE *jobs, configuration_t *the_config, process_context_t *p_context) {
+    char line[BATCH_LINE_SIZE];
+    int result = 0, line_number = 0;
+    char *source, *destination;
+    while (read_next_job(jobs, line, &line_number, the_config, &source, &destination, &result)) {
+        strcpy(the_config->source, source);
+        strcpy(the_config->destination, destination);
+        uint64_t entries_before = process_stats.synchronized_entries;
+        uint64_t copied_before = process_stats.phase_count[PHASE_COPY];
+        uint64_t bytes_before = process_stats.phase_bytes[PHASE_COPY];
+        uint64_t job_start = stats_now();
+        synchronize(the_config, p_context);
+        report_job(++jobs_count, source, destination,
+                   process_stats.synchronized_entries - entries_before,
+                   process_stats.phase_count[PHASE_COPY] - copied_before, process_stats.phase_bytes[PHASE_COPY] - bytes_before,
+                   stats_now() - job_start);
+    }
+    return result;
+}
+
+/*!
+ * @brief start_batch_job prepares the lists of a job, its analyze dir commands are posted by post_job_commands
+ * @param job is a pointer to a free slot
+ * @param source is the source of the job
+ * @param destination is the destination of the job
+ * @param the_config is a pointer to the configuration
+ */
+static void start_batch_job(batch_job_t *job, char *source, char *destination, configuration_t *the_config) {
+    job->number = ++jobs_count;
+    strcpy(job->source, source);
+    strcpy(job->destination, destination);
+    init_compact_files_list(&job->source_entries, job->source);
+    init_compact_files_list(&job->destination_entries, job->destination);
+    init_lists_collector(&job->collector, &job->source_entries, &job->destination_entries);
+    job->unsent_commands = (1 << MSG_TYPE_TO_SOURCE_LISTER) | (1 << MSG_TYPE_TO_DESTINATION_LISTER);
+    job->start_ns = stats_now();
+    if (the_config->verbose || the_config->dry_run) {
+        printf("Synchronizing %s and %s\n", job->source, job->destination);
+    }
+}
+
+/*!
+ * @brief post_job_commands posts the analyze dir commands of a job not sent yet, without waiting for room in the queue
+ * @param job is a pointer to the job
+ * @param msg_queue is the id of the MQ
+ * @return 0 if the commands were sent or will be retried, -1 in case of error
+ */
+static int post_job_commands(batch_job_t *job, int msg_queue) {
+    for (int lister_id = MSG_TYPE_TO_SOURCE_LISTER; lister_id <= MSG_TYPE_TO_DESTINATION_LISTER; ++lister_id) {
+        if ((job->unsent_commands & (1 << lister_id)) == 0) {
+            continue;
+        }
+        char *target = lister_id == MSG_TYPE_TO_SOURCE_LISTER ? job->source : job->destination;
+        if (post_analyze_dir_command(msg_queue, lister_id, target, job->number) == 0) {
+            job->unsent_commands &= ~(1 << lister_id);
+        } else if (errno != EAGAIN) {
+            perror("Failed to send a job to the listers");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief finish_batch_job compares and copies a job whose lists are complete, then frees its slot
+ * @param job is a pointer to the job
+ * @param the_config is a pointer to the configuration (its source and destination are set to those of the job)
+ */
+static void finish_batch_job(batch_job_t *job, configuration_t *the_config) {
+    stats_add_phase(PHASE_COLLECT, job->start_ns, job->collector.received_count, 0);
+    strcpy(the_config->source, job->source);
+    strcpy(the_config->destination, job->destination);
+    uint64_t copied_before = process_stats.phase_count[PHASE_COPY];
+    uint64_t bytes_before = process_stats.phase_bytes[PHASE_COPY];
+    uint64_t entries = job->source_entries.paths.count; // The lists are freed by synchronize_lists
+    synchronize_lists(the_config, &job->source_entries, &job->destination_entries);
+    report_job(job->number, job->source, job->destination, entries,
+               process_stats.phase_count[PHASE_COPY] - copied_before, process_stats.phase_bytes[PHASE_COPY] - bytes_before,
+               stats_now() - job->start_ns);
+    job->number = 0;
+}
+
+/*!
+ * @brief run_jobs_concurrently runs the jobs of a job file on the pool, BATCH_CONCURRENT_JOBS at the same time
+ * The messages of the listers and analyzers carry the job of their list, so that the main process routes each entry to
+ * the lists of its job. Jobs end in any order, a new one is started in the slot of each ended job.
+ * @param jobs is the job file
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ * @return 0 if all the jobs ran, -1 if a job was invalid or the pool could not be reached
+ */
+static int run_jobs_concurrently(FILE *jobs, configuration_t *the_config, process_context_t *p_context) {
+    static batch_job_t running[BATCH_CONCURRENT_JOBS]; // The lists of a job point into its slot, slots never move
+    char line[BATCH_LINE_SIZE];
+    int result = 0, line_number = 0, running_count = 0;
+    bool has_jobs = true;
+    int msg_queue = p_context->message_queue_id;
+    any_message_t message;
+    while (true) {
+        for (int i = 0; i < BATCH_CONCURRENT_JOBS && has_jobs; ++i) {
+            char *source, *destination;
+            if (running[i].number != 0) {
+                continue;
+            }
+            has_jobs = read_next_job(jobs, line, &line_number, the_config, &source, &destination, &result);
+            if (has_jobs) {
+                start_batch_job(&running[i], source, destination, the_config);
+                ++running_count;
+            }
+        }
+        if (running_count == 0) {
+            break;
+        }
+        for (int i = 0; i < BATCH_CONCURRENT_JOBS; ++i) {
+            if (running[i].number != 0 && post_job_commands(&running[i], msg_queue) == -1) {
+                return -1;
+            }
+        }
+
+        uint64_t wait_start = stats_now();
+        uint64_t trace_start = trace_clock();
+        if (msgrcv(msg_queue, &message, sizeof(any_message_t) - sizeof(long), MSG_TYPE_TO_MAIN, 0) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to receive the lists of the jobs");
+            return -1;
+        }
+        stats_add_queue_wait(wait_start);
+        trace_complete(TRACE_RECEIVE, trace_start, NULL);
+        int number = message.list_entry.op_code == COMMAND_CODE_LIST_COMPLETE ? message.list_end.job : message.list_entry.job;
+        for (int i = 0; i < BATCH_CONCURRENT_JOBS; ++i) {
+            if (running[i].number == number && number != 0) {
+                if (collect_list_message(&running[i].collector, &message, the_config->direct_results)) {
+                    finish_batch_job(&running[i], the_config);
+                    --running_count;
+                }
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+/*!
+ * @brief run_batch runs the synchronizations of a job file on the prepared processes
+ * Jobs run at the same time on the pool, or one after another when they run without it (e.g. their lists are spilled to
+ * disk with --memory-budget) or when the destination list is loaded from an index. Each job is reported when it is
+ * done, and the whole batch at the end.
+ * @param the_config is a pointer to the configuration (its source and destination are set for each job)
+ * @param p_context is a pointer to the processes context
+ * @return 0 if all the jobs ran, -1 if a job was invalid or the job file could not be read
+ */
+int run_batch(configuration_t *the_config, process_context_t *p_context) {
+    FILE *jobs = fopen(the_config->jobs_file, "r");
+    if (jobs == NULL) {
+        perror("Failed to open the job file");
+        return -1;
+    }
+    uint64_t batch_start = stats_now();
+    int result;
+    if (the_config->is_parallel && the_config->dest_index[0] == '\0') {
+        result = run_jobs_concurrently(jobs, the_config, p_context);
+    } else {
+        result = run_jobs_in_turn(jobs, the_config, p_context);
+    }
+    fclose(jobs);
+    char label[64];
+    snprintf(label, sizeof(label), "Batch of %d jobs", jobs_count);
+    report_throughput(label, batch_entries, batch_copied, batch_bytes, stats_now() - batch_start);
+    return result;
+}
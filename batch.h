@@ -0,0 +1,22 @@
+#pragma once
+
+#include "configuration.h"
+#include "processes.h"
+#include "sync.h"
+
+#define BATCH_LINE_SIZE 2100 // Room for a job line with two paths of the configuration
+#define BATCH_CONCURRENT_JOBS 4 // Jobs whose lists are made at the same time on the pool
+
+// A job of a batch whose lists are being made on the pool (@see run_jobs_concurrently)
+typedef struct {
+    int number; // Rank of the job in the job file, the job of its messages, 0 for a free slot
+    char source[1024];
+    char destination[1024];
+    compact_files_list_t source_entries;
+    compact_files_list_t destination_entries;
+    lists_collector_t collector;
+    int unsent_commands; // Bits (1 << mtype) of the listers its analyze dir command was not posted to yet
+    uint64_t start_ns;
+} batch_job_t;
+
+int run_batch(configuration_t *the_config, process_context_t *p_context);
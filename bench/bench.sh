@@ -0,0 +1,76 @@
+#!/bin/sh
+# End-to-end benchmark: generates a synthetic tree once, then synchronizes a fresh copy of its destination in each
+# mode and prints one CSV line per role and phase (from --stats-json), plus a wall clock line per run.
+# Settings come from the environment, e.g. BENCH_FILES=100000 BENCH_RUNS=5 make bench
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+PRG=${PRG:-$BENCH_DIR/../prg}
+GEN_TREE=${GEN_TREE:-$BENCH_DIR/gen-tree}
+WORK_DIR=${BENCH_WORK_DIR:-${TMPDIR:-/tmp}/lp25-bench}
+FILES=${BENCH_FILES:-10000}
+DEPTH=${BENCH_DEPTH:-3}
+FANOUT=${BENCH_FANOUT:-4}
+SIZES=${BENCH_SIZES:-pareto:512:16777216}
+CHANGE=${BENCH_CHANGE:-0.1}
+SEED=${BENCH_SEED:-1}
+PROCESSES=${BENCH_PROCESSES:-4}
+RUNS=${BENCH_RUNS:-3}
+MODES=${BENCH_MODES:-"sequential parallel date-size"}
+
+mode_options() {
+    case "$1" in
+        sequential) echo "--no-parallel" ;;
+        parallel) echo "-n $PROCESSES" ;;
+        date-size) echo "-n $PROCESSES --date-size-only" ;;
+        uring) echo "-n $PROCESSES --io-uring" ;;
+        *) echo "Unknown mode $1" >&2; exit 1 ;;
+    esac
+}
+
+# Prints the CSV lines of a stats JSON file (@see write_stats_json)
+stats_to_csv() {
+    awk -v prefix="$1" '
+        /^  "[a-z]+": \{/ { split($1, parts, "\""); role = parts[2] }
+        /"count": [0-9]+, "bytes": [0-9]+, "time_ns": [0-9]+/ {
+            split($1, parts, "\""); phase = parts[2]
+            gsub(/[^0-9 ]/, " ", $0); split($0, values, " +")
+            count = values[2]; bytes = values[3]; time_ns = values[4]
+            if (count == 0 && time_ns == 0) next
+            seconds = time_ns / 1e9
+            printf "%s,%s,%s,%d,%d,%.3f,%.1f,%.2f,\n", prefix, role, phase, count, bytes, time_ns / 1e6,
+                (seconds > 0 ? count / seconds : 0), (seconds > 0 ? bytes / 1e6 / seconds : 0)
+        }
+        /"peak_rss_kb": [0-9]+/ { gsub(/[^0-9]/, "", $2); printf "%s,%s,peak_rss,,,,,,%s\n", prefix, role, $2 }
+    ' "$2"
+}
+
+if [ ! -d "$WORK_DIR/tree/src" ] || [ "$(cat "$WORK_DIR/tree.params" 2>/dev/null)" != "$FILES $DEPTH $FANOUT $SIZES $CHANGE $SEED" ]; then
+    rm -rf "$WORK_DIR"
+    mkdir -p "$WORK_DIR"
+    "$GEN_TREE" -f "$FILES" -d "$DEPTH" -b "$FANOUT" -s "$SIZES" -c "$CHANGE" -S "$SEED" "$WORK_DIR/tree" >&2
+    echo "$FILES $DEPTH $FANOUT $SIZES $CHANGE $SEED" > "$WORK_DIR/tree.params"
+fi
+SOURCE_FILES=$(find "$WORK_DIR/tree/src" | wc -l)
+SOURCE_BYTES=$(find "$WORK_DIR/tree/src" -type f -printf "%s\n" | awk '{ total += $1 } END { print total + 0 }')
+
+echo "mode,run,role,phase,files,bytes,time_ms,files_per_s,mb_per_s,peak_rss_kb"
+for mode in $MODES; do
+    run=1
+    while [ "$run" -le "$RUNS" ]; do
+        rm -rf "$WORK_DIR/dst" "$WORK_DIR/stats.json"
+        cp -a "$WORK_DIR/tree/dst" "$WORK_DIR/dst"
+        sync
+        start=$(date +%s%N)
+        # shellcheck disable=SC2046
+        "$PRG" $(mode_options "$mode") --stats-json "$WORK_DIR/stats.json" "$WORK_DIR/tree/src" "$WORK_DIR/dst" > /dev/null
+        end=$(date +%s%N)
+        awk -v prefix="$mode,$run" -v files="$SOURCE_FILES" -v bytes="$SOURCE_BYTES" -v wall_ns=$((end - start)) 'BEGIN {
+            seconds = wall_ns / 1e9
+            printf "%s,total,wall,%d,%d,%.3f,%.1f,%.2f,\n", prefix, files, bytes, wall_ns / 1e6, files / seconds, bytes / 1e6 / seconds
+        }'
+        stats_to_csv "$mode,$run" "$WORK_DIR/stats.json"
+        run=$((run + 1))
+    done
+done
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <math.h>
+
+// gen-tree builds a deterministic synthetic tree for benchmarks: <root>/src and <root>/dst are made of the same
+// directories and files, except for a ratio of files whose content (and size, one time out of two) differ in dst.
+// The same options and seed always produce the same trees, with the same mtimes.
+
+#define GEN_PATH_SIZE 4096
+#define GEN_BUFFER_SIZE (64 * 1024)
+#define GEN_MTIME 1700000000 // Fixed mtime of the generated files
+
+typedef enum {SIZE_FIXED, SIZE_UNIFORM, SIZE_PARETO} size_distribution_t;
+
+typedef struct {
+    long files_count;
+    int depth;
+    int fanout;
+    size_distribution_t distribution;
+    uint64_t min_size;
+    uint64_t max_size;
+    double change_ratio;
+    uint64_t seed;
+    char *root;
+} generator_configuration_t;
+
+/*!
+ * @brief next_random returns the next value of a xorshift64* generator
+ * @param state is a pointer to the state of the generator (never 0)
+ * @return a pseudo random 64 bits value
+ */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/*!
+ * @brief random_unit returns a pseudo random value in [0, 1)
+ * @param state is a pointer to the state of the generator
+ * @return the value
+ */
+static double random_unit(uint64_t *state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*!
+ * @brief pick_size draws a file size from the configured distribution
+ * Pareto sizes (alpha = 1.2) mimic real trees: mostly small files and a few large ones.
+ * @param config is a pointer to the generator configuration
+ * @param state is a pointer to the state of the generator
+ * @return the size in bytes
+ */
+static uint64_t pick_size(generator_configuration_t *config, uint64_t *state) {
+    switch (config->distribution) {
+        case SIZE_UNIFORM:
+            return config->min_size + next_random(state) % (config->max_size - config->min_size + 1);
+        case SIZE_PARETO: {
+            double size = (config->min_size > 0 ? config->min_size : 1) / pow(1.0 - random_unit(state), 1.0 / 1.2);
+            return size > (double) config->max_size ? config->max_size : (uint64_t) size;
+        }
+        default:
+            return config->min_size;
+    }
+}
+
+/*!
+ * @brief write_file writes size pseudo random bytes derived from a seed to a file and sets its mtime
+ * @param path is the path of the file
+ * @param size is the size of the file
+ * @param seed is the seed of the content
+ * @return 0 in case of success, -1 else
+ */
+static int write_file(char *path, uint64_t size, uint64_t seed) {
+    static uint64_t buffer[GEN_BUFFER_SIZE / sizeof(uint64_t)];
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror(path);
+        return -1;
+    }
+    uint64_t state = seed | 1;
+    uint64_t written = 0;
+    while (written < size) {
+        size_t chunk = size - written < GEN_BUFFER_SIZE ? size - written : GEN_BUFFER_SIZE;
+        for (size_t i = 0; i < (chunk + sizeof(uint64_t) - 1) / sizeof(uint64_t); ++i) {
+            buffer[i] = next_random(&state);
+        }
+        if (write(fd, buffer, chunk) != (ssize_t) chunk) {
+            perror(path);
+            close(fd);
+            return -1;
+        }
+        written += chunk;
+    }
+    struct timespec times[2] = {{GEN_MTIME, 0}, {GEN_MTIME, 0}};
+    futimens(fd, times);
+    return close(fd);
+}
+
+/*!
+ * @brief make_directory creates the same directory in both trees
+ * @param config is a pointer to the generator configuration
+ * @param relative_path is the path of the directory, relative to the trees roots
+ * @return 0 in case of success, -1 else
+ */
+static int make_directory(generator_configuration_t *config, char *relative_path) {
+    char path[GEN_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/src/%s", config->root, relative_path);
+    if (mkdir(path, 0755) == -1) {
+        perror(path);
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/dst/%s", config->root, relative_path);
+    if (mkdir(path, 0755) == -1) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief collect_directories creates the directories tree (depth levels of fanout subdirectories)
+ * @param config is a pointer to the generator configuration
+ * @param relative_path is the path of the current directory, relative to the trees roots
+ * @param level is the level of the current directory
+ * @param directories is the array of the created directories paths (the current one included)
+ * @param count is a pointer to the number of paths in directories
+ * @return 0 in case of success, -1 else
+ */
+static int collect_directories(generator_configuration_t *config, char *relative_path, int level, char **directories, long *count) {
+    directories[(*count)++] = strdup(relative_path);
+    if (level == config->depth) {
+        return 0;
+    }
+    for (int i = 0; i < config->fanout; ++i) {
+        char child[GEN_PATH_SIZE];
+        snprintf(child, sizeof(child), "%s%sdir_%02d", relative_path, relative_path[0] == '\0' ? "" : "/", i);
+        if (make_directory(config, child) == -1 || collect_directories(config, child, level + 1, directories, count) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief parse_sizes parses a size distribution (fixed:SIZE, uniform:MIN:MAX or pareto:MIN:MAX)
+ * @param config is a pointer to the configuration to update
+ * @param description is the distribution description
+ * @return 0 in case of success, -1 else
+ */
+static int parse_sizes(generator_configuration_t *config, char *description) {
+    unsigned long long min_size, max_size;
+    if (sscanf(description, "fixed:%llu", &min_size) == 1) {
+        config->distribution = SIZE_FIXED;
+        max_size = min_size;
+    } else if (sscanf(description, "uniform:%llu:%llu", &min_size, &max_size) == 2) {
+        config->distribution = SIZE_UNIFORM;
+    } else if (sscanf(description, "pareto:%llu:%llu", &min_size, &max_size) == 2) {
+        config->distribution = SIZE_PARETO;
+    } else {
+        return -1;
+    }
+    if (max_size < min_size) {
+        return -1;
+    }
+    config->min_size = min_size;
+    config->max_size = max_size;
+    return 0;
+}
+
+/*!
+ * @brief display_usage displays the options of the generator
+ * @param my_name is the name of the binary file
+ */
+static void display_usage(char *my_name) {
+    printf("%s [options] root\n", my_name);
+    printf("Options: \t-f <count> number of files (default 10000)\n");
+    printf("         \t-d <depth> depth of the directories tree (default 3)\n");
+    printf("         \t-b <fanout> subdirectories per directory (default 4)\n");
+    printf("         \t-s <fixed:SIZE|uniform:MIN:MAX|pareto:MIN:MAX> files size distribution (default pareto:512:16777216)\n");
+    printf("         \t-c <ratio> ratio of files that differ between src and dst (default 0.1)\n");
+    printf("         \t-S <seed> seed of the generator (default 1)\n");
+}
+
+/*!
+ * @brief main generates <root>/src and <root>/dst
+ * @param argc its number of arguments, including its own name
+ * @param argv the array of arguments
+ * @return 0 in case of success, -1 else
+ */
+int main(int argc, char *argv[]) {
+    generator_configuration_t config = {10000, 3, 4, SIZE_PARETO, 512, 16 * 1024 * 1024, 0.1, 1, NULL};
+    int opt;
+    while ((opt = getopt(argc, argv, "f:d:b:s:c:S:h")) != -1) {
+        switch (opt) {
+            case 'f':
+                config.files_count = atol(optarg);
+                break;
+            case 'd':
+                config.depth = atoi(optarg);
+                break;
+            case 'b':
+                config.fanout = atoi(optarg);
+                break;
+            case 's':
+                if (parse_sizes(&config, optarg) == -1) {
+                    fprintf(stderr, "Invalid size distribution %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'c':
+                config.change_ratio = atof(optarg);
+                break;
+            case 'S':
+                config.seed = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                display_usage(argv[0]);
+                return -1;
+        }
+    }
+    if (optind >= argc || config.files_count < 0 || config.depth < 0 || config.fanout < 0) {
+        display_usage(argv[0]);
+        return -1;
+    }
+    config.root = argv[optind];
+
+    char path[GEN_PATH_SIZE];
+    mkdir(config.root, 0755);
+    if (make_directory(&config, "") == -1) {
+        return -1;
+    }
+    long directories_capacity = 1;
+    for (int level = 0, width = 1; level < config.depth; ++level) {
+        width *= config.fanout;
+        directories_capacity += width;
+    }
+    char **directories = malloc(directories_capacity * sizeof(char *));
+    long directories_count = 0;
+    if (directories == NULL || collect_directories(&config, "", 0, directories, &directories_count) == -1) {
+        return -1;
+    }
+
+    uint64_t state = config.seed * 0x9E3779B97F4A7C15ULL + 1;
+    uint64_t total_bytes = 0;
+    long changed_count = 0;
+    for (long i = 0; i < config.files_count; ++i) {
+        char *directory = directories[i % directories_count];
+        uint64_t size = pick_size(&config, &state);
+        uint64_t content_seed = next_random(&state);
+        bool changed = random_unit(&state) < config.change_ratio;
+        snprintf(path, sizeof(path), "%s/src/%s%sfile_%07ld", config.root, directory, directory[0] == '\0' ? "" : "/", i);
+        if (write_file(path, size, content_seed) == -1) {
+            return -1;
+        }
+        snprintf(path, sizeof(path), "%s/dst/%s%sfile_%07ld", config.root, directory, directory[0] == '\0' ? "" : "/", i);
+        uint64_t destination_size = changed && (i & 1) ? size + 1 : size;
+        if (write_file(path, destination_size, changed ? ~content_seed : content_seed) == -1) {
+            return -1;
+        }
+        total_bytes += size;
+        changed_count += changed;
+    }
+    printf("%ld directories, %ld files, %lu bytes, %ld changed\n", directories_count, config.files_count, total_bytes, changed_count);
+    for (long i = 0; i < directories_count; ++i) {
+        free(directories[i]);
+    }
+    free(directories);
+    return 0;
+}
@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "files-list.h"
+#include "file-properties.h"
+#include "sync.h"
+#include "utility.h"
+#include "stats.h"
+
+// microbench times the files list and utility primitives in isolation. Each primitive is run warmup_count times
+// untimed, then runs_count times; every run is cut into timed samples (a block of operations, or one operation
+// when it is slow enough), and the median and 99th percentile of the time per operation are reported as CSV.
+
+#define SAMPLES_PER_RUN 100
+#define QUADRATIC_LIMIT 10000 // Larger lists are not built in random order (each insertion scans the list)
+#define LOOKUPS_BUDGET 10000000 // Visited entries per run of find_entry_by_name
+
+typedef struct {
+    double *values; // Nanoseconds per operation
+    size_t count;
+    size_t capacity;
+} samples_t;
+
+typedef struct {
+    int runs_count;
+    int warmup_count;
+    size_t max_entries;
+    char *filter;
+} microbench_configuration_t;
+
+static const size_t list_sizes[] = {1000, 10000, 100000, 1000000, 10000000};
+static const size_t path_lengths[] = {16, 256, 1024, 4000};
+static const size_t file_sizes[] = {1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024};
+
+static uint64_t random_state = 88172645463325252ULL;
+
+/*!
+ * @brief next_random returns the next value of a xorshift64 generator (the sequence is the same for every run)
+ * @return a pseudo random 64 bits value
+ */
+static uint64_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+/*!
+ * @brief add_sample records the time per operation of a timed block
+ * @param samples is a pointer to the samples
+ * @param start_ns is the start time of the block (@see stats_now)
+ * @param operations is the number of operations of the block
+ */
+static void add_sample(samples_t *samples, uint64_t start_ns, size_t operations) {
+    double value = (double) (stats_now() - start_ns) / operations;
+    if (samples == NULL) {
+        return;
+    }
+    if (samples->count == samples->capacity) {
+        samples->capacity = samples->capacity == 0 ? 1024 : samples->capacity * 2;
+        samples->values = realloc(samples->values, samples->capacity * sizeof(double));
+        if (samples->values == NULL) {
+            fprintf(stderr, "Failed to allocate memory for samples\n");
+            exit(-1);
+        }
+    }
+    samples->values[samples->count++] = value;
+}
+
+/*!
+ * @brief compare_doubles compares two doubles for qsort
+ */
+static int compare_doubles(const void *lhs, const void *rhs) {
+    double l = *(const double *) lhs, r = *(const double *) rhs;
+    return (l > r) - (l < r);
+}
+
+/*!
+ * @brief report_samples prints the median and 99th percentile (nearest rank) of samples and resets them
+ * @param primitive is the name of the timed primitive
+ * @param size is the input size of the primitive
+ * @param samples is a pointer to the samples
+ */
+static void report_samples(char *primitive, size_t size, samples_t *samples) {
+    if (samples->count == 0) {
+        return;
+    }
+    qsort(samples->values, samples->count, sizeof(double), compare_doubles);
+    size_t p99_rank = (samples->count * 99 + 99) / 100;
+    printf("%s,%zu,%zu,%.1f,%.1f\n", primitive, size, samples->count, samples->values[samples->count / 2],
+           samples->values[p99_rank - 1]);
+    fflush(stdout);
+    samples->count = 0;
+}
+
+/*!
+ * @brief make_path writes the path of the i-th entry of a benchmark list (paths are sorted like i)
+ * @param path is the buffer of PATH_SIZE bytes to write to
+ * @param i is the index of the entry
+ */
+static void make_path(char *path, size_t i) {
+    snprintf(path, PATH_SIZE, "/bench/src/dir_%04zu/file_%08zu", i / 1000, i);
+}
+
+/*!
+ * @brief shuffle_indexes returns the indexes from 0 to count - 1 in a random order
+ * @param count is the number of indexes
+ * @return the array of indexes (to be freed by the caller)
+ */
+static size_t *shuffle_indexes(size_t count) {
+    size_t *indexes = malloc(count * sizeof(size_t));
+    if (indexes == NULL) {
+        fprintf(stderr, "Failed to allocate memory for indexes\n");
+        exit(-1);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        indexes[i] = i;
+    }
+    for (size_t i = count - 1; i > 0; --i) {
+        size_t j = next_random() % (i + 1);
+        size_t swap = indexes[i];
+        indexes[i] = indexes[j];
+        indexes[j] = swap;
+    }
+    return indexes;
+}
+
+/*!
+ * @brief run_add_file_entry builds a list of count entries with add_file_entry
+ * @param count is the number of entries
+ * @param order is the insertion order, NULL for the sorted order
+ * @param samples is a pointer to the samples to fill, NULL for a warmup run
+ */
+static void run_add_file_entry(size_t count, size_t *order, samples_t *samples) {
+    files_list_t list = {NULL, NULL};
+    char path[PATH_SIZE];
+    size_t block = count / SAMPLES_PER_RUN > 0 ? count / SAMPLES_PER_RUN : 1;
+    for (size_t i = 0; i < count; i += block) {
+        size_t end = i + block < count ? i + block : count;
+        uint64_t start = stats_now();
+        for (size_t j = i; j < end; ++j) {
+            make_path(path, order != NULL ? order[j] : j);
+            add_file_entry(&list, path);
+        }
+        add_sample(samples, start, end - i);
+    }
+    clear_files_list(&list);
+}
+
+/*!
+ * @brief run_add_entry_to_tail appends count allocated entries to a list
+ * @param count is the number of entries
+ * @param samples is a pointer to the samples to fill, NULL for a warmup run
+ */
+static void run_add_entry_to_tail(size_t count, samples_t *samples) {
+    files_list_t list = {NULL, NULL};
+    files_list_entry_t **entries = malloc(count * sizeof(files_list_entry_t *));
+    if (entries == NULL) {
+        fprintf(stderr, "Failed to allocate memory for entries\n");
+        exit(-1);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        entries[i] = malloc(sizeof(files_list_entry_t));
+        if (entries[i] == NULL) {
+            fprintf(stderr, "Failed to allocate memory for entries\n");
+            exit(-1);
+        }
+        make_path(entries[i]->path_and_name, i);
+    }
+    size_t block = count / SAMPLES_PER_RUN > 0 ? count / SAMPLES_PER_RUN : 1;
+    for (size_t i = 0; i < count; i += block) {
+        size_t end = i + block < count ? i + block : count;
+        uint64_t start = stats_now();
+        for (size_t j = i; j < end; ++j) {
+            add_entry_to_tail(&list, entries[j]);
+        }
+        add_sample(samples, start, end - i);
+    }
+    clear_files_list(&list);
+    free(entries);
+}
+
+/*!
+ * @brief run_find_entry_by_name looks up random existing names in a sorted list, timing each lookup
+ * @param list is a pointer to the list of count entries
+ * @param count is the number of entries
+ * @param samples is a pointer to the samples to fill, NULL for a warmup run
+ */
+static void run_find_entry_by_name(files_list_t *list, size_t count, samples_t *samples) {
+    char path[PATH_SIZE];
+    size_t lookups = LOOKUPS_BUDGET / count;
+    lookups = lookups < 10 ? 10 : (lookups > 1000 ? 1000 : lookups);
+    size_t start_of_src = strlen("/bench/src/");
+    for (size_t i = 0; i < lookups; ++i) {
+        make_path(path, next_random() % count);
+        uint64_t start = stats_now();
+        if (find_entry_by_name(list, path, start_of_src, start_of_src) == NULL) {
+            fprintf(stderr, "Entry %s not found\n", path);
+        }
+        add_sample(samples, start, 1);
+    }
+}
+
+/*!
+ * @brief bench_lists times the list primitives for each list size
+ * @param config is a pointer to the benchmark configuration
+ */
+static void bench_lists(microbench_configuration_t *config) {
+    samples_t samples = {NULL, 0, 0};
+    for (size_t s = 0; s < sizeof(list_sizes) / sizeof(list_sizes[0]); ++s) {
+        size_t count = list_sizes[s];
+        if (count > config->max_entries) {
+            fprintf(stderr, "Skipping lists of %zu entries (above -m %zu)\n", count, config->max_entries);
+            continue;
+        }
+        if (config->filter == NULL || strstr("add_file_entry", config->filter) != NULL) {
+            for (int run = -config->warmup_count; run < config->runs_count; ++run) {
+                run_add_file_entry(count, NULL, run < 0 ? NULL : &samples);
+            }
+            report_samples("add_file_entry_sorted", count, &samples);
+            if (count <= QUADRATIC_LIMIT) {
+                size_t *order = shuffle_indexes(count);
+                for (int run = -config->warmup_count; run < config->runs_count; ++run) {
+                    run_add_file_entry(count, order, run < 0 ? NULL : &samples);
+                }
+                free(order);
+                report_samples("add_file_entry_random", count, &samples);
+            }
+        }
+        if (config->filter == NULL || strstr("add_entry_to_tail", config->filter) != NULL) {
+            for (int run = -config->warmup_count; run < config->runs_count; ++run) {
+                run_add_entry_to_tail(count, run < 0 ? NULL : &samples);
+            }
+            report_samples("add_entry_to_tail", count, &samples);
+        }
+        if (config->filter == NULL || strstr("find_entry_by_name", config->filter) != NULL) {
+            files_list_t list = {NULL, NULL};
+            char path[PATH_SIZE];
+            for (size_t i = 0; i < count; ++i) {
+                make_path(path, i);
+                add_file_entry(&list, path);
+            }
+            for (int run = -config->warmup_count; run < config->runs_count; ++run) {
+                run_find_entry_by_name(&list, count, run < 0 ? NULL : &samples);
+            }
+            clear_files_list(&list);
+            report_samples("find_entry_by_name", count, &samples);
+        }
+    }
+    free(samples.values);
+}
+
+/*!
+ * @brief bench_mismatch times mismatch on equal entries and on entries that only differ by their MD5 sum
+ * @param config is a pointer to the benchmark configuration
+ */
+static void bench_mismatch(microbench_configuration_t *config) {
+    if (config->filter != NULL && strstr("mismatch", config->filter) == NULL) {
+        return;
+    }
+    samples_t samples = {NULL, 0, 0};
+    static files_list_entry_t lhd, rhd;
+    make_path(lhd.path_and_name, 1);
+    make_path(rhd.path_and_name, 1);
+    lhd.size = rhd.size = 4096;
+    lhd.mtime.tv_sec = rhd.mtime.tv_sec = 1700000000;
+    lhd.entry_type = rhd.entry_type = FICHIER;
+    lhd.mode = rhd.mode = S_IFREG | 0644;
+    char *cases[] = {"mismatch_equal_md5", "mismatch_md5_differs", "mismatch_equal_date_size"};
+    for (int c = 0; c < 3; ++c) {
+        memset(rhd.md5sum, c == 1 ? 0xff : 0, sizeof(rhd.md5sum));
+        volatile bool result;
+        for (int run = -config->warmup_count; run < config->runs_count; ++run) {
+            for (int sample = 0; sample < SAMPLES_PER_RUN; ++sample) {
+                uint64_t start = stats_now();
+                for (int i = 0; i < 1000; ++i) {
+                    result = mismatch(&lhd, &rhd, c != 2);
+                }
+                add_sample(run < 0 ? NULL : &samples, start, 1000);
+            }
+        }
+        (void) result;
+        report_samples(cases[c], 1, &samples);
+    }
+    free(samples.values);
+}
+
+/*!
+ * @brief bench_concat_path times concat_path for several lengths of the resulting path
+ * @param config is a pointer to the benchmark configuration
+ */
+static void bench_concat_path(microbench_configuration_t *config) {
+    if (config->filter != NULL && strstr("concat_path", config->filter) == NULL) {
+        return;
+    }
+    samples_t samples = {NULL, 0, 0};
+    char prefix[PATH_SIZE], suffix[PATH_SIZE], result[PATH_SIZE];
+    for (size_t l = 0; l < sizeof(path_lengths) / sizeof(path_lengths[0]); ++l) {
+        size_t length = path_lengths[l];
+        memset(prefix, 'p', length / 2);
+        prefix[length / 2] = '\0';
+        memset(suffix, 's', length - length / 2 - 1);
+        suffix[length - length / 2 - 1] = '\0';
+        for (int run = -config->warmup_count; run < config->runs_count; ++run) {
+            for (int sample = 0; sample < SAMPLES_PER_RUN; ++sample) {
+                uint64_t start = stats_now();
+                for (int i = 0; i < 1000; ++i) {
+                    concat_path(result, prefix, suffix);
+                }
+                add_sample(run < 0 ? NULL : &samples, start, 1000);
+            }
+        }
+        report_samples("concat_path", length, &samples);
+    }
+    free(samples.values);
+}
+
+/*!
+ * @brief bench_compute_file_md5 times compute_file_md5 on temporary files of several sizes (in the page cache)
+ * @param config is a pointer to the benchmark configuration
+ */
+static void bench_compute_file_md5(microbench_configuration_t *config) {
+    if (config->filter != NULL && strstr("compute_file_md5", config->filter) == NULL) {
+        return;
+    }
+    samples_t samples = {NULL, 0, 0};
+    static files_list_entry_t entry;
+    char *tmpdir = getenv("TMPDIR");
+    snprintf(entry.path_and_name, PATH_SIZE, "%s/microbench-XXXXXX", tmpdir != NULL ? tmpdir : "/tmp");
+    int fd = mkstemp(entry.path_and_name);
+    if (fd == -1) {
+        perror("Failed to create temporary file");
+        return;
+    }
+    uint64_t buffer[8192];
+    size_t written = 0;
+    for (size_t s = 0; s < sizeof(file_sizes) / sizeof(file_sizes[0]); ++s) {
+        while (written < file_sizes[s]) {
+            for (size_t i = 0; i < sizeof(buffer) / sizeof(buffer[0]); ++i) {
+                buffer[i] = next_random();
+            }
+            size_t chunk = file_sizes[s] - written < sizeof(buffer) ? file_sizes[s] - written : sizeof(buffer);
+            if (write(fd, buffer, chunk) != (ssize_t) chunk) {
+                perror("Failed to write temporary file");
+                break;
+            }
+            written += chunk;
+        }
+        int repeats = file_sizes[s] >= 16 * 1024 * 1024 ? 1 : 10;
+        for (int run = -config->warmup_count; run < config->runs_count; ++run) {
+            for (int i = 0; i < repeats; ++i) {
+                uint64_t start = stats_now();
+                compute_file_md5(&entry);
+                add_sample(run < 0 ? NULL : &samples, start, 1);
+            }
+        }
+        report_samples("compute_file_md5", file_sizes[s], &samples);
+    }
+    close(fd);
+    unlink(entry.path_and_name);
+    free(samples.values);
+}
+
+/*!
+ * @brief display_usage displays the options of the microbenchmarks
+ * @param my_name is the name of the binary file
+ */
+static void display_usage(char *my_name) {
+    printf("%s [options]\n", my_name);
+    printf("Options: \t-r <runs> timed runs per primitive and size (default 11)\n");
+    printf("         \t-w <runs> untimed warmup runs (default 2)\n");
+    printf("         \t-m <entries> largest list size to time (default 100000, about 4 KiB per entry)\n");
+    printf("         \t-p <primitive> only times primitives whose name contains <primitive>\n");
+}
+
+/*!
+ * @brief main runs the microbenchmarks and prints their results as CSV
+ * @param argc its number of arguments, including its own name
+ * @param argv the array of arguments
+ * @return 0 in case of success, -1 else
+ */
+int main(int argc, char *argv[]) {
+    microbench_configuration_t config = {11, 2, 100000, NULL};
+    int opt;
+    while ((opt = getopt(argc, argv, "r:w:m:p:h")) != -1) {
+        switch (opt) {
+            case 'r':
+                config.runs_count = atoi(optarg);
+                break;
+            case 'w':
+                config.warmup_count = atoi(optarg);
+                break;
+            case 'm':
+                config.max_entries = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                config.filter = optarg;
+                break;
+            default:
+                display_usage(argv[0]);
+                return -1;
+        }
+    }
+    if (config.runs_count <= 0 || config.warmup_count < 0) {
+        display_usage(argv[0]);
+        return -1;
+    }
+    printf("primitive,size,samples,median_ns,p99_ns\n");
+    bench_lists(&config);
+    bench_mismatch(&config);
+    bench_concat_path(&config);
+    bench_compute_file_md5(&config);
+    return 0;
+}
@@ -4,8 +4,11 @@
 #include <getopt.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include "log.h"
+#include "filters.h"
 
-typedef enum {DATE_SIZE_ONLY, NO_PARALLEL} long_opt_values;
+typedef enum {DATE_SIZE_ONLY, NO_PARALLEL, DEST_INDEX = 0x100, INDEX_VERIFY, MEMORY_BUDGET, STATS, STATS_JSON, TRACE, LOG_LEVEL, LOG_CATEGORIES, QUEUE_DEPTH, DIRECT_RESULTS, DEVICE_LIMITS, LARGEST_FIRST, HASH_WORKERS, HARDLINKS, DETECT_RENAMES, DAEMON, CONNECT, JOBS, JOURNAL, EXCLUDE, INCLUDE, FILTER_FILE, READ_LIMIT, WRITE_LIMIT, FILES_LIMIT, IO_CLASS, NICE, PLAN_OUT, APPLY, SERVE, REMOTE, COMPRESS, IO_URING} long_opt_values;
 
 /*!
  * @brief function display_help displays a brief manual for the program usage
@@ -14,10 +17,43 @@ typedef enum {DATE_SIZE_ONLY, NO_PARALLEL} long_opt_values;
  */
 void display_help(char *my_name) {
     printf("%s [options] source_dir destination_dir\n", my_name);
-    printf("Options: \t-n <processes count>\tnumber of processes for file calculations\n");
+    printf("Options: \t-n <processes count|auto>\tnumber of processes for file calculations (auto: adapted at runtime)\n");
+    printf("         \t--hash-workers <count|auto> hashes files in a separate pool (auto: one per CPU), -n sizes the stat pool\n");
     printf("         \t-h display help (this text)\n");
     printf("         \t--date_size_only disables MD5 calculation for files\n");
     printf("         \t--no-parallel disables parallel computing (cancels values of option -n)\n");
+    printf("         \t--dest-index <file> loads the destination list from <file> instead of scanning it, and saves it after sync\n");
+    printf("         \t--index-verify <none|stat|sample> checks the destination index against the disk (default: stat)\n");
+    printf("         \t--memory-budget <MiB> streams sorted runs through temporary files to bound the lists memory (no parallel)\n");
+    printf("         \t--stats prints per phase statistics at the end of the run\n");
+    printf("         \t--stats-json <file> writes per phase statistics to <file> in JSON\n");
+    printf("         \t--trace <file> records the events of all processes to <file> (Chrome trace-event JSON)\n");
+    printf("         \t--queue-depth <n> number of files sent ahead to each analyzer (default: 4)\n");
+    printf("         \t--direct-results analyzers send their results to the main process, listers only order them\n");
+    printf("         \t--device-limits <rotational>:<solid> limits the files analyzed at the same time per device\n");
+    printf("         \t--largest-first analyzes the largest files first, to balance the analyzers load\n");
+    printf("         \t--hardlinks recreates the hard links of the source in the destination instead of copying each link\n");
+    printf("         \t--detect-renames <rename|link|reflink> reuses destination files with the same content as missing ones\n");
+    printf("         \t--daemon <socket> keeps the processes and the digests between synchronizations requested on <socket>\n");
+    printf("         \t--connect <socket> has the daemon listening on <socket> synchronize source_dir and destination_dir\n");
+    printf("         \t--serve <host:port|socket> serves source_dir as the destination of remote clients (no destination_dir)\n");
+    printf("         \t--remote <host:port|socket> synchronizes source_dir to the tree of a server (no destination_dir)\n");
+    printf("         \t--compress compresses the file data sent to the server\n");
+    printf("         \t--jobs <file> runs the synchronizations listed in <file> (source<TAB>destination per line) on one pool\n");
+    printf("         \t--journal <file> journals digests and copies to <file>, so that an interrupted run is resumed\n");
+    printf("         \t--plan-out <file> writes the entries to copy to <file> instead of copying them\n");
+    printf("         \t--apply <file> copies the entries of the plan <file> that did not change since, without scanning\n");
+    printf("         \t--io-uring copies the small files by batches through io_uring (when the kernel supports it)\n");
+    printf("         \t--read-limit <MiB/s> limits the bandwidth of the reads of all the processes (hashes and copies)\n");
+    printf("         \t--write-limit <MiB/s> limits the bandwidth of the writes of the copies\n");
+    printf("         \t--files-limit <files/s> limits the files hashed or copied per second\n");
+    printf("         \t--io-class <idle|best-effort[:0-7]> sets the I/O scheduling class of all the processes\n");
+    printf("         \t--nice <1-19> lowers the CPU priority of all the processes\n");
+    printf("         \t--exclude <pattern> skips the entries matching <pattern> (*, **, ?, [...], a trailing / for directories only)\n");
+    printf("         \t--include <pattern> keeps the entries matching <pattern> even when a later --exclude matches them\n");
+    printf("         \t--filter-file <file> reads rules from <file>, one per line (+ pattern to include, - pattern to exclude)\n");
+    printf("         \t--log-level <error|warning|info|debug> sets the messages level (default: warning, info with -v or -r)\n");
+    printf("         \t--log-categories <config,list,ipc,diff,copy,hash|all> only prints messages of these categories\n");
 }
 
 /*!
@@ -31,10 +67,41 @@ void init_configuration(configuration_t *the_config) {
     the_config->source[0] = '\0';
     the_config->destination[0] = '\0'; 
     the_config->processes_count = 1;
+    the_config->adaptive_pool = false;
+    the_config->hashers_count = 0;
+    the_config->queue_depth = 4;
+    the_config->direct_results = false;
+    the_config->largest_first = false;
+    the_config->hardlinks = false;
+    the_config->read_rate = 0;
+    the_config->write_rate = 0;
+    the_config->files_rate = 0;
+    the_config->io_class = IO_CLASS_NONE;
+    the_config->io_level = 4;
+    the_config->nice_level = 0;
+    the_config->detect_renames = RENAMES_NONE;
+    the_config->rotational_limit = 0;
+    the_config->solid_limit = 0;
     the_config->is_parallel = true;
     the_config->uses_md5 = true;
     the_config->verbose = false;
     the_config->dry_run = false;
+    the_config->dest_index[0] = '\0';
+    the_config->daemon_socket[0] = '\0';
+    the_config->connect_socket[0] = '\0';
+    the_config->serve[0] = '\0';
+    the_config->remote[0] = '\0';
+    the_config->compress = false;
+    the_config->io_uring = false;
+    the_config->jobs_file[0] = '\0';
+    the_config->journal[0] = '\0';
+    the_config->plan_out[0] = '\0';
+    the_config->apply_plan[0] = '\0';
+    the_config->index_verify = INDEX_VERIFY_STAT;
+    the_config->memory_budget = 0;
+    the_config->show_stats = false;
+    the_config->stats_json[0] = '\0';
+    the_config->trace[0] = '\0';
 }
 
 /*!
@@ -45,16 +112,50 @@ void init_configuration(configuration_t *the_config) {
  * @return -1 if configuration cannot succeed, 0 when ok
  */
 int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
-    printf("Setting configuration\n");
+    LOG_DEBUG(LOG_CATEGORY_CONFIG, "Setting configuration\n");
     int opt;
     struct option long_options[] = {
         {"date-size-only", no_argument,       0, 'd'},
         {"no-parallel",    no_argument,       0, 'p'},
         {"dry-run",        no_argument,       0, 'r'},
         {"verbose",        no_argument,       0, 'v'},
+        {"dest-index",     required_argument, 0, DEST_INDEX},
+        {"index-verify",   required_argument, 0, INDEX_VERIFY},
+        {"memory-budget",  required_argument, 0, MEMORY_BUDGET},
+        {"stats",          no_argument,       0, STATS},
+        {"stats-json",     required_argument, 0, STATS_JSON},
+        {"trace",          required_argument, 0, TRACE},
+        {"log-level",      required_argument, 0, LOG_LEVEL},
+        {"log-categories", required_argument, 0, LOG_CATEGORIES},
+        {"queue-depth",    required_argument, 0, QUEUE_DEPTH},
+        {"direct-results", no_argument,       0, DIRECT_RESULTS},
+        {"device-limits",  required_argument, 0, DEVICE_LIMITS},
+        {"largest-first",  no_argument,       0, LARGEST_FIRST},
+        {"hash-workers",   required_argument, 0, HASH_WORKERS},
+        {"hardlinks",      no_argument,       0, HARDLINKS},
+        {"detect-renames", required_argument, 0, DETECT_RENAMES},
+        {"daemon",         required_argument, 0, DAEMON},
+        {"connect",        required_argument, 0, CONNECT},
+        {"serve",          required_argument, 0, SERVE},
+        {"remote",         required_argument, 0, REMOTE},
+        {"compress",       no_argument,       0, COMPRESS},
+        {"io-uring",       no_argument,       0, IO_URING},
+        {"jobs",           required_argument, 0, JOBS},
+        {"journal",        required_argument, 0, JOURNAL},
+        {"plan-out",       required_argument, 0, PLAN_OUT},
+        {"apply",          required_argument, 0, APPLY},
+        {"read-limit",     required_argument, 0, READ_LIMIT},
+        {"write-limit",    required_argument, 0, WRITE_LIMIT},
+        {"files-limit",    required_argument, 0, FILES_LIMIT},
+        {"io-class",       required_argument, 0, IO_CLASS},
+        {"nice",           required_argument, 0, NICE},
+        {"exclude",        required_argument, 0, EXCLUDE},
+        {"include",        required_argument, 0, INCLUDE},
+        {"filter-file",    required_argument, 0, FILTER_FILE},
         {0, 0, 0, 0}
     };
 
+    int requested_log_level = -1;
     while ((opt = getopt_long(argc, argv, "dpvrn:", long_options, NULL)) != -1) {
         switch (opt) {
             case 'd':
@@ -70,13 +171,248 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
                 the_config->verbose = true;
                 break;
             case 'n':
-                the_config->processes_count = atoi(optarg);
+                if (strcmp(optarg, "auto") == 0) {
+                    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                    the_config->processes_count = cpus < 1 ? 1 : (cpus > AUTO_MAX_ANALYZERS ? AUTO_MAX_ANALYZERS : cpus);
+                    the_config->adaptive_pool = true;
+                } else {
+                    the_config->processes_count = atoi(optarg);
+                    the_config->adaptive_pool = false;
+                }
+                break;
+            case DEST_INDEX:
+                strncpy(the_config->dest_index, optarg, sizeof(the_config->dest_index) - 1);
+                the_config->dest_index[sizeof(the_config->dest_index) - 1] = '\0';
+                break;
+            case INDEX_VERIFY:
+                if (strcmp(optarg, "none") == 0) {
+                    the_config->index_verify = INDEX_VERIFY_NONE;
+                } else if (strcmp(optarg, "stat") == 0) {
+                    the_config->index_verify = INDEX_VERIFY_STAT;
+                } else if (strcmp(optarg, "sample") == 0) {
+                    the_config->index_verify = INDEX_VERIFY_SAMPLE;
+                } else {
+                    fprintf(stderr, "Unknown index verification mode %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case MEMORY_BUDGET:
+                if (atol(optarg) <= 0) {
+                    fprintf(stderr, "Invalid memory budget %s\n", optarg);
+                    return -1;
+                }
+                the_config->memory_budget = (size_t) atol(optarg) * 1024 * 1024;
+                break;
+            case STATS:
+                the_config->show_stats = true;
+                break;
+            case STATS_JSON:
+                strncpy(the_config->stats_json, optarg, sizeof(the_config->stats_json) - 1);
+                the_config->stats_json[sizeof(the_config->stats_json) - 1] = '\0';
+                break;
+            case TRACE:
+                strncpy(the_config->trace, optarg, sizeof(the_config->trace) - 1);
+                the_config->trace[sizeof(the_config->trace) - 1] = '\0';
+                break;
+            case QUEUE_DEPTH:
+                the_config->queue_depth = atoi(optarg);
+                if (the_config->queue_depth <= 0) {
+                    fprintf(stderr, "Invalid queue depth %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case DIRECT_RESULTS:
+                the_config->direct_results = true;
+                break;
+            case DEVICE_LIMITS:
+                if (sscanf(optarg, "%d:%d", &the_config->rotational_limit, &the_config->solid_limit) != 2
+                    || the_config->rotational_limit <= 0 || the_config->solid_limit <= 0) {
+                    fprintf(stderr, "Invalid device limits %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case HASH_WORKERS:
+                if (strcmp(optarg, "auto") == 0) {
+                    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                    the_config->hashers_count = cpus < 1 ? 1 : (cpus > AUTO_MAX_ANALYZERS ? AUTO_MAX_ANALYZERS : cpus);
+                } else if (atoi(optarg) >= 0 && atoi(optarg) <= MAX_HASH_WORKERS) {
+                    the_config->hashers_count = atoi(optarg);
+                } else {
+                    fprintf(stderr, "Invalid hash workers count %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case HARDLINKS:
+                the_config->hardlinks = true;
+                break;
+            case DETECT_RENAMES:
+                if (strcmp(optarg, "rename") == 0) {
+                    the_config->detect_renames = RENAMES_RENAME;
+                } else if (strcmp(optarg, "link") == 0) {
+                    the_config->detect_renames = RENAMES_LINK;
+                } else if (strcmp(optarg, "reflink") == 0) {
+                    the_config->detect_renames = RENAMES_REFLINK;
+                } else {
+                    fprintf(stderr, "Unknown renames detection mode %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case DAEMON:
+            case CONNECT: {
+                char *socket_path = opt == DAEMON ? the_config->daemon_socket : the_config->connect_socket;
+                if (strlen(optarg) >= sizeof(the_config->daemon_socket)) {
+                    fprintf(stderr, "Socket path %s is too long\n", optarg);
+                    return -1;
+                }
+                strcpy(socket_path, optarg);
+                break;
+            }
+            case SERVE:
+            case REMOTE: {
+                char *address = opt == SERVE ? the_config->serve : the_config->remote;
+                if (strlen(optarg) >= sizeof(the_config->serve)) {
+                    fprintf(stderr, "Address %s is too long\n", optarg);
+                    return -1;
+                }
+                strcpy(address, optarg);
+                break;
+            }
+            case COMPRESS:
+                the_config->compress = true;
+                break;
+            case IO_URING:
+                the_config->io_uring = true;
+                break;
+            case JOBS:
+                strncpy(the_config->jobs_file, optarg, sizeof(the_config->jobs_file) - 1);
+                the_config->jobs_file[sizeof(the_config->jobs_file) - 1] = '\0';
+                break;
+            case JOURNAL:
+                strncpy(the_config->journal, optarg, sizeof(the_config->journal) - 1);
+                the_config->journal[sizeof(the_config->journal) - 1] = '\0';
+                break;
+            case PLAN_OUT:
+                strncpy(the_config->plan_out, optarg, sizeof(the_config->plan_out) - 1);
+                the_config->plan_out[sizeof(the_config->plan_out) - 1] = '\0';
+                break;
+            case APPLY:
+                strncpy(the_config->apply_plan, optarg, sizeof(the_config->apply_plan) - 1);
+                the_config->apply_plan[sizeof(the_config->apply_plan) - 1] = '\0';
+                break;
+            case READ_LIMIT:
+            case WRITE_LIMIT:
+            case FILES_LIMIT: {
+                double rate = atof(optarg);
+                if (rate <= 0) {
+                    fprintf(stderr, "Invalid rate limit %s\n", optarg);
+                    return -1;
+                }
+                if (opt == FILES_LIMIT) {
+                    the_config->files_rate = rate;
+                } else {
+                    *(opt == READ_LIMIT ? &the_config->read_rate : &the_config->write_rate) = rate * 1024 * 1024;
+                }
+                break;
+            }
+            case IO_CLASS:
+                if (strcmp(optarg, "idle") == 0) {
+                    the_config->io_class = IO_CLASS_IDLE;
+                } else if (strcmp(optarg, "best-effort") == 0) {
+                    the_config->io_class = IO_CLASS_BEST_EFFORT;
+                } else if (sscanf(optarg, "best-effort:%d", &the_config->io_level) == 1 && the_config->io_level >= 0
+                           && the_config->io_level <= 7) {
+                    the_config->io_class = IO_CLASS_BEST_EFFORT;
+                } else {
+                    fprintf(stderr, "Unknown I/O class %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case NICE:
+                the_config->nice_level = atoi(optarg);
+                if (the_config->nice_level < 1 || the_config->nice_level > 19) {
+                    fprintf(stderr, "Invalid nice level %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case EXCLUDE:
+            case INCLUDE:
+                if (add_filter_rule(optarg, opt == EXCLUDE) == -1) {
+                    fprintf(stderr, "Invalid filter pattern %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case FILTER_FILE:
+                if (load_filter_file(optarg) == -1) {
+                    return -1;
+                }
+                break;
+            case LARGEST_FIRST:
+                the_config->largest_first = true;
+                break;
+            case LOG_LEVEL:
+                requested_log_level = parse_log_level(optarg);
+                if (requested_log_level == -1) {
+                    fprintf(stderr, "Unknown log level %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case LOG_CATEGORIES:
+                if (parse_log_categories(optarg, &log_categories) == -1) {
+                    fprintf(stderr, "Unknown log category in %s\n", optarg);
+                    return -1;
+                }
                 break;
             default:
                 return -1;
         }
     }
 
+    // Verbose and dry runs print the lists and the decisions of the synchronization
+    if (requested_log_level != -1) {
+        log_level = requested_log_level;
+    } else if (the_config->verbose || the_config->dry_run) {
+        log_level = LOG_LEVEL_INFO;
+    }
+
+    // Plans are made of a whole difference list, for a single synchronization
+    if ((the_config->plan_out[0] != '\0' || the_config->apply_plan[0] != '\0')
+        && (the_config->memory_budget > 0 || the_config->daemon_socket[0] != '\0' || the_config->jobs_file[0] != '\0')) {
+        fprintf(stderr, "Plans are not available with --memory-budget, --daemon or --jobs\n");
+        return -1;
+    }
+    // The streaming merge never holds the lists: it can neither load nor save them, nor match links and contents
+    if (the_config->memory_budget > 0 && (the_config->dest_index[0] != '\0' || the_config->journal[0] != '\0'
+                                          || the_config->hardlinks || the_config->detect_renames != RENAMES_NONE)) {
+        fprintf(stderr, "--dest-index, --journal, --hardlinks and --detect-renames are not available with --memory-budget\n");
+        return -1;
+    }
+    // With a memory budget, the main process lists and analyzes both trees into sorted runs: the listers would keep the
+    // whole lists in memory, so no process is forked
+    if (the_config->memory_budget > 0 && the_config->is_parallel) {
+        if (the_config->processes_count != 1 || the_config->hashers_count > 0 || the_config->direct_results
+            || the_config->rotational_limit > 0) {
+            fprintf(stderr, "-n, --hash-workers, --direct-results and --device-limits are ignored with --memory-budget\n");
+        }
+        the_config->is_parallel = false;
+    }
+    if (the_config->plan_out[0] != '\0' && the_config->apply_plan[0] != '\0') {
+        fprintf(stderr, "--plan-out and --apply cannot be used together\n");
+        return -1;
+    }
+    // Applying a plan neither lists nor analyzes files
+    if (the_config->apply_plan[0] != '\0') {
+        the_config->is_parallel = false;
+    }
+
+    // Filters are shared by all the listers, they are compiled once before the fork
+    compile_filters();
+
+    // Contents are only known by their MD5 sum
+    if (the_config->detect_renames != RENAMES_NONE && !the_config->uses_md5) {
+        fprintf(stderr, "Renames detection needs MD5 sums, it is disabled in date and size mode\n");
+        the_config->detect_renames = RENAMES_NONE;
+    }
+
     // Copy remaining arguments to source and destination
     if (optind < argc) {
         strncpy(the_config->source, argv[optind++], sizeof(the_config->source));
@@ -84,5 +420,22 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
             strncpy(the_config->destination, argv[optind++], sizeof(the_config->destination));
         }
     }
+
+    // The destination of a client is the tree of its server, the tree of a server is its source_dir
+    if (the_config->remote[0] != '\0' || the_config->serve[0] != '\0') {
+        if (the_config->destination[0] != '\0' || (the_config->remote[0] != '\0' && the_config->serve[0] != '\0')) {
+            fprintf(stderr, "--remote and --serve only take source_dir\n");
+            return -1;
+        }
+        if (the_config->memory_budget > 0 || the_config->daemon_socket[0] != '\0' || the_config->jobs_file[0] != '\0'
+            || the_config->dest_index[0] != '\0' || the_config->journal[0] != '\0' || the_config->hardlinks
+            || the_config->detect_renames != RENAMES_NONE || the_config->plan_out[0] != '\0' || the_config->apply_plan[0] != '\0') {
+            fprintf(stderr, "--remote and --serve only run plain synchronizations\n");
+            return -1;
+        }
+        if (the_config->remote[0] != '\0') {
+            strcpy(the_config->destination, the_config->remote);
+        }
+    }
     return 0;
 }
\ No newline at end of file
@@ -2,15 +2,54 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+
+#define AUTO_MAX_ANALYZERS 16 // Analyzers per side spawned by -n auto, at most (more would not find room in the queue)
+#define MAX_HASH_WORKERS 64 // Processes of each hash pool, at most
+
+typedef enum {INDEX_VERIFY_NONE, INDEX_VERIFY_STAT, INDEX_VERIFY_SAMPLE} index_verify_t;
+typedef enum {RENAMES_NONE, RENAMES_RENAME, RENAMES_LINK, RENAMES_REFLINK} renames_mode_t;
+typedef enum {IO_CLASS_NONE, IO_CLASS_BEST_EFFORT, IO_CLASS_IDLE} io_class_t;
 
 typedef struct {
     char source[1024];
     char destination[1024];
     uint8_t processes_count;
+    bool adaptive_pool; // -n auto: as many analyzers as CPUs, of which listers keep busy as many as is useful
+    uint8_t hashers_count; // Processes of the hash pool, 0 when analyzers hash the files themselves
+    int queue_depth; // Outstanding files per analyzer
+    bool largest_first; // Listers dispatch the largest files first instead of following the list order
+    int rotational_limit; // Files analyzed at the same time per rotational device, 0 when devices are not limited
+    int solid_limit; // Files analyzed at the same time per other device, 0 when devices are not limited
+    bool direct_results; // Analyzers send their results to the main process instead of their lister
+    renames_mode_t detect_renames; // How missing files found elsewhere in the destination are reused
+    bool hardlinks; // Files linked together in the source are linked together in the destination
+    double read_rate; // Bytes read per second by all the processes together, 0 when unlimited
+    double write_rate; // Bytes written per second by the copies, 0 when unlimited
+    double files_rate; // Files hashed or copied per second, 0 when unlimited
+    io_class_t io_class; // I/O scheduling class of all the processes
+    int io_level; // Priority within the best-effort class, from 0 (highest) to 7
+    int nice_level; // Nice level of all the processes, 0 to keep the current one
+    bool io_uring; // Small files are copied by batches through io_uring, synchronously when it is not available
     bool is_parallel;
     bool uses_md5;
     bool verbose;
     bool dry_run;
+    char daemon_socket[108]; // Path of the socket the daemon listens to, empty when not a daemon (sun_path size)
+    char connect_socket[108]; // Path of the socket of the daemon to send the synchronization to, empty when disabled
+    char serve[256]; // Address (host:port or socket path) the server of a destination listens to, empty when not a server
+    char remote[256]; // Address of the server of the destination, empty when the destination is local
+    bool compress; // File data sent to the server is compressed
+    char jobs_file[1024]; // Path of the job file of a batch, empty when not a batch
+    char journal[1024]; // Path of the checkpoint journal, empty when disabled
+    char plan_out[1024]; // Path of the plan to write instead of applying the differences, empty when disabled
+    char apply_plan[1024]; // Path of the plan to apply instead of synchronizing, empty when disabled
+    char dest_index[1024]; // Path to the trusted destination index, empty when disabled
+    index_verify_t index_verify;
+    size_t memory_budget; // Bytes allowed to the lists in streaming mode, 0 when streaming is disabled
+    bool show_stats;
+    char stats_json[1024]; // Path of the JSON statistics report, empty when disabled
+    char trace[1024]; // Path of the Chrome trace-event file, empty when disabled
 } configuration_t;
 
 void init_configuration(configuration_t *the_config);
@@ -0,0 +1,103 @@
+#include "content-index.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*!
+ * @brief compare_contents orders content entries by size, then by MD5 sum
+ * @param a is a pointer to the first content_entry_t
+ * @param b is a pointer to the second content_entry_t
+ * @return a negative value, 0 or a positive value as a is before, equal to or after b
+ */
+static int compare_contents(const void *a, const void *b) {
+    const content_entry_t *first = a, *second = b;
+    if (first->size != second->size) {
+        return first->size < second->size ? -1 : 1;
+    }
+    return memcmp(first->md5sum, second->md5sum, sizeof(first->md5sum));
+}
+
+/*!
+ * @brief init_content_index initializes an empty content index
+ * @param index is a pointer to the index
+ */
+void init_content_index(content_index_t *index) {
+    index->entries = NULL;
+    index->count = 0;
+    index->capacity = 0;
+}
+
+/*!
+ * @brief add_content_entry adds a file to a content index (the index must be sorted again before lookups)
+ * @param index is a pointer to the index
+ * @param entry is a pointer to the file entry, with its MD5 sum
+ * @return 0 in case of success, -1 else (out of memory)
+ */
+int add_content_entry(content_index_t *index, files_list_entry_t *entry) {
+    if (index->count == index->capacity) {
+        size_t capacity = index->capacity == 0 ? 64 : 2 * index->capacity;
+        content_entry_t *entries = realloc(index->entries, capacity * sizeof(content_entry_t));
+        if (entries == NULL) {
+            return -1;
+        }
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+    content_entry_t *content = &index->entries[index->count];
+    content->size = entry->size;
+    memcpy(content->md5sum, entry->md5sum, sizeof(content->md5sum));
+    if ((content->path = strdup(entry->path_and_name)) == NULL) {
+        return -1;
+    }
+    content->moved = false;
+    ++index->count;
+    return 0;
+}
+
+/*!
+ * @brief sort_content_index sorts a content index for lookups
+ * @param index is a pointer to the index
+ */
+void sort_content_index(content_index_t *index) {
+    if (index->count > 1) {
+        qsort(index->entries, index->count, sizeof(content_entry_t), compare_contents);
+    }
+}
+
+/*!
+ * @brief find_content_entry finds a file with the same size and MD5 sum as an entry in a sorted content index
+ * Files that were moved away are skipped.
+ * @param index is a pointer to the index
+ * @param entry is a pointer to the entry
+ * @return a pointer to the content entry of the file, NULL if there is none
+ */
+content_entry_t *find_content_entry(content_index_t *index, files_list_entry_t *entry) {
+    content_entry_t key;
+    key.size = entry->size;
+    memcpy(key.md5sum, entry->md5sum, sizeof(key.md5sum));
+    content_entry_t *found = index->count == 0 ? NULL : bsearch(&key, index->entries, index->count, sizeof(content_entry_t), compare_contents);
+    if (found == NULL) {
+        return NULL;
+    }
+    // Go back to the first file of this content, then look for one still in place
+    while (found > index->entries && compare_contents(found - 1, &key) == 0) {
+        --found;
+    }
+    for (; found < index->entries + index->count && compare_contents(found, &key) == 0; ++found) {
+        if (!found->moved) {
+            return found;
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief free_content_index frees the memory of a content index
+ * @param index is a pointer to the index
+ */
+void free_content_index(content_index_t *index) {
+    for (size_t i = 0; i < index->count; ++i) {
+        free(index->entries[i].path);
+    }
+    free(index->entries);
+    init_content_index(index);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "files-list.h"
+
+// A destination file that has no source counterpart, known by its content
+typedef struct {
+    uint64_t size;
+    uint8_t md5sum[16];
+    char *path;
+    bool moved; // The file was moved away (renamed to a missing file), path is its former path
+} content_entry_t;
+
+// Index of destination files by (size, MD5 sum), to find the files the source moved
+typedef struct {
+    content_entry_t *entries;
+    size_t count;
+    size_t capacity;
+} content_index_t;
+
+void init_content_index(content_index_t *index);
+int add_content_entry(content_index_t *index, files_list_entry_t *entry);
+void sort_content_index(content_index_t *index);
+content_entry_t *find_content_entry(content_index_t *index, files_list_entry_t *entry);
+void free_content_index(content_index_t *index);
@@ -0,0 +1,192 @@
+#include "daemon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "sync.h"
+#include "file-properties.h"
+#include "stats.h"
+#include "log.h"
+
+// A daemon keeps its listers, analyzers and message queue between synchronizations, as well as the digests of the
+// files it analyzed (@see compute_inode_md5). Clients send it one request per connection, on a single line:
+//     SYNC\t<source>\t<destination>\n
+// and it answers with a single line:
+//     OK <copied entries> <duration in ms>\n   or   ERROR <reason>\n
+
+static volatile sig_atomic_t daemon_stopping = 0;
+
+/*!
+ * @brief stop_daemon is the handler of the signals that stop the daemon
+ * @param signal is the number of the received signal
+ */
+static void stop_daemon(int signal) {
+    (void) signal;
+    daemon_stopping = 1;
+}
+
+/*!
+ * @brief read_request reads the request line of a client
+ * @param client is the socket of the client
+ * @param request is the buffer to read to, of DAEMON_REQUEST_SIZE bytes
+ * @return 0 in case of success (the line is null terminated, without its end of line), -1 else
+ */
+static int read_request(int client, char *request) {
+    size_t length = 0;
+    while (length < DAEMON_REQUEST_SIZE - 1) {
+        ssize_t received = read(client, request + length, DAEMON_REQUEST_SIZE - 1 - length);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return -1;
+        }
+        length += received;
+        request[length] = '\0';
+        char *end_of_line = strchr(request, '\n');
+        if (end_of_line != NULL) {
+            *end_of_line = '\0';
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*!
+ * @brief serve_request runs the synchronization requested by a client and sends it the result
+ * @param client is the socket of the client
+ * @param the_config is a pointer to the configuration of the daemon
+ * @param p_context is a pointer to the processes context
+ */
+static void serve_request(int client, configuration_t *the_config, process_context_t *p_context) {
+    char request[DAEMON_REQUEST_SIZE];
+    char response[256];
+    char *source, *destination;
+    if (read_request(client, request) == -1 || strncmp(request, "SYNC\t", 5) != 0
+        || (destination = strchr(request + 5, '\t')) == NULL) {
+        dprintf(client, "ERROR invalid request\n");
+        return;
+    }
+    source = request + 5;
+    *destination++ = '\0';
+    if (strlen(source) >= sizeof(the_config->source) || strlen(destination) >= sizeof(the_config->destination)) {
+        dprintf(client, "ERROR path too long\n");
+        return;
+    }
+    if (!directory_exists(source) || !directory_exists(destination)) {
+        dprintf(client, "ERROR either source or destination directory do not exist\n");
+        return;
+    }
+    if (!is_directory_writable(destination)) {
+        dprintf(client, "ERROR destination directory is not writable\n");
+        return;
+    }
+    strcpy(the_config->source, source);
+    strcpy(the_config->destination, destination);
+    LOG_INFO(LOG_CATEGORY_CONFIG, "Synchronizing %s and %s on request\n", source, destination);
+    uint64_t copied_before = process_stats.phase_count[PHASE_COPY];
+    uint64_t start = stats_now();
+    synchronize(the_config, p_context);
+    snprintf(response, sizeof(response), "OK %lu %.3f\n", process_stats.phase_count[PHASE_COPY] - copied_before,
+             (stats_now() - start) / 1e6);
+    flush_log();
+    if (write(client, response, strlen(response)) == -1) {
+        perror("Failed to answer the client");
+    }
+}
+
+/*!
+ * @brief run_daemon serves the synchronization requests of the clients until it receives SIGTERM or SIGINT
+ * The processes must be prepared (@see prepare), and they are not cleaned.
+ * @param the_config is a pointer to the configuration of the daemon
+ * @param p_context is a pointer to the processes context
+ * @return 0 when the daemon stopped, -1 in case of error
+ */
+int run_daemon(configuration_t *the_config, process_context_t *p_context) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, the_config->daemon_socket, sizeof(address.sun_path) - 1);
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server == -1) {
+        perror("Failed to create the daemon socket");
+        return -1;
+    }
+    unlink(address.sun_path);
+    if (bind(server, (struct sockaddr *) &address, sizeof(address)) == -1 || listen(server, DAEMON_BACKLOG) == -1) {
+        perror("Failed to listen to the daemon socket");
+        close(server);
+        return -1;
+    }
+
+    // Without SA_RESTART, accept is interrupted by the stop signals
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_daemon;
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    signal(SIGPIPE, SIG_IGN); // A client that left must not kill the daemon
+
+    LOG_INFO(LOG_CATEGORY_CONFIG, "Daemon listening on %s\n", address.sun_path);
+    while (!daemon_stopping) {
+        int client = accept(server, NULL, NULL);
+        if (client == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to accept a client");
+            break;
+        }
+        serve_request(client, the_config, p_context);
+        close(client);
+    }
+    close(server);
+    unlink(address.sun_path);
+    return 0;
+}
+
+/*!
+ * @brief run_client has a daemon synchronize the source and destination of the configuration, and prints its answer
+ * Paths are made absolute, since the daemon does not run in the directory of the client.
+ * @param the_config is a pointer to the configuration, with the socket of the daemon
+ * @return 0 if the daemon synchronized the directories, -1 else
+ */
+int run_client(configuration_t *the_config) {
+    char source[PATH_MAX], destination[PATH_MAX];
+    if (realpath(the_config->source, source) == NULL || realpath(the_config->destination, destination) == NULL) {
+        printf("Either source or destination directory do not exist\nAborting\n");
+        return -1;
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, the_config->connect_socket, sizeof(address.sun_path) - 1);
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server == -1 || connect(server, (struct sockaddr *) &address, sizeof(address)) == -1) {
+        perror("Failed to connect to the daemon");
+        if (server != -1) {
+            close(server);
+        }
+        return -1;
+    }
+    if (dprintf(server, "SYNC\t%s\t%s\n", source, destination) < 0) {
+        perror("Failed to send the request");
+        close(server);
+        return -1;
+    }
+    char response[256];
+    size_t length = 0;
+    ssize_t received;
+    while (length < sizeof(response) - 1 && (received = read(server, response + length, sizeof(response) - 1 - length)) > 0) {
+        length += received;
+    }
+    response[length] = '\0';
+    close(server);
+    printf("%s", response);
+    return strncmp(response, "OK ", 3) == 0 ? 0 : -1;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "configuration.h"
+#include "processes.h"
+
+#define DAEMON_REQUEST_SIZE 2100 // Room for a request line with two paths of the configuration
+#define DAEMON_BACKLOG 16
+
+int run_daemon(configuration_t *the_config, process_context_t *p_context);
+int run_client(configuration_t *the_config);
@@ -0,0 +1,212 @@
+#include "dest-index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "defines.h"
+#include "utility.h"
+#include "files-list-io.h"
+#include "file-properties.h"
+
+// The destination index is the destination files list as it is after a successful synchronization.
+// It is made of a dest_index_header_t followed by entries_count files list records (@see files-list-io.h)
+
+/*!
+ * @brief entry_matches_stat tells if an entry still describes the file on disk
+ * @param entry is a pointer to the entry from the index
+ * @param sb is a pointer to the result of lstat on the entry path
+ * @return true if type, size and mtime are unchanged, false else
+ */
+bool entry_matches_stat(files_list_entry_t *entry, struct stat *sb) {
+    if (entry->entry_type == DOSSIER) {
+        return S_ISDIR(sb->st_mode);
+    }
+    return S_ISREG(sb->st_mode) && entry->size == (uint64_t) sb->st_size
+        && entry->mtime.tv_sec == sb->st_mtim.tv_sec && entry->mtime.tv_nsec == sb->st_mtim.tv_nsec;
+}
+
+/*!
+ * @brief verify_index_entry checks an entry of the index against the destination tree
+ * With INDEX_VERIFY_STAT, every entry is lstat'ed: vanished entries are dropped and modified ones are analyzed again.
+ * With INDEX_VERIFY_SAMPLE, one entry out of DEST_INDEX_SAMPLE_STEP (and the last one) is lstat'ed and any difference
+ * rejects the index.
+ * @param entry is a pointer to the decoded entry, refreshed when it was modified
+ * @param position is the position of the entry in the index
+ * @param is_last is true for the last entry of the index
+ * @param the_config is a pointer to the configuration
+ * @return 1 if the entry belongs to the destination list, 0 if it must be dropped, -1 if the index must be rejected
+ */
+static int verify_index_entry(files_list_entry_t *entry, uint64_t position, bool is_last, configuration_t *the_config) {
+    struct stat sb;
+    switch (the_config->index_verify) {
+        case INDEX_VERIFY_STAT:
+            if (lstat(entry->path_and_name, &sb) == -1) {
+                return 0;
+            }
+            return entry_matches_stat(entry, &sb) || get_file_stats(entry) != -1 ? 1 : 0;
+        case INDEX_VERIFY_SAMPLE:
+            if ((position % DEST_INDEX_SAMPLE_STEP == 0 || is_last)
+                && (lstat(entry->path_and_name, &sb) == -1 || !entry_matches_stat(entry, &sb))) {
+                return -1;
+            }
+            return 1;
+        default:
+            return 1;
+    }
+}
+
+/*!
+ * @brief load_destination_index loads the destination index (mmapped) in place of the destination scan
+ * Records are decoded one after another into the same entry and appended to the compact list, which is the only memory
+ * allocated for the index. They are verified as they are decoded (@see verify_index_entry).
+ * @param list is a pointer to the compact list to build, it must be empty
+ * @param the_config is a pointer to the configuration (index path, destination root, MD5 usage, verification)
+ * @return 0 in case of success, -1 if there is no usable index (the list is then left empty)
+ */
+int load_destination_index(compact_files_list_t *list, configuration_t *the_config) {
+    if (list == NULL || the_config == NULL || the_config->dest_index[0] == '\0') {
+        return -1;
+    }
+    int fd = open(the_config->dest_index, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) == -1 || (size_t) sb.st_size < sizeof(dest_index_header_t)) {
+        close(fd);
+        return -1;
+    }
+    size_t length = sb.st_size;
+    uint8_t *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Failed to map destination index");
+        return -1;
+    }
+    madvise(data, length, MADV_SEQUENTIAL);
+
+    dest_index_header_t header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, DEST_INDEX_MAGIC, sizeof(header.magic)) != 0
+        || (the_config->uses_md5 && !(header.flags & DEST_INDEX_FLAG_MD5))) {
+        munmap(data, length);
+        return -1;
+    }
+
+    static files_list_entry_t entry; // Decoded record, reused for all the records
+    size_t start_of_dest = strlen(the_config->destination) + 1;
+    size_t offset = sizeof(header);
+    int result = 0;
+    for (uint64_t i = 0; i < header.entries_count && result == 0; ++i) {
+        size_t consumed = decode_files_list_record(data + offset, length - offset, &entry, the_config->destination);
+        if (consumed == 0) {
+            fprintf(stderr, "Destination index %s is corrupted\n", the_config->dest_index);
+            result = -1;
+            break;
+        }
+        offset += consumed;
+        int verified = verify_index_entry(&entry, i, i + 1 == header.entries_count, the_config);
+        if (verified == -1) {
+            result = -1;
+        } else if (verified == 1 && add_compact_entry(list, entry.path_and_name + start_of_dest, &entry) == -1) {
+            fprintf(stderr, "Failed to allocate memory for the destination index\n");
+            result = -1;
+        }
+    }
+    munmap(data, length);
+
+    if (result == -1 || offset != length) {
+        free_compact_files_list(list);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief save_destination_index writes the destination index after a synchronization
+ * The index is the merge of the destination list and of the copied entries (the difference list), whose
+ * metadata are refreshed from the destination. Entries that could not be copied are left out.
+ * The file is written next to its final path and renamed, so that an interrupted save never leaves a partial index.
+ * @param destination is a pointer to the destination list before the synchronization
+ * @param difference is a pointer to the list of the entries that were copied (rooted at the source)
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int save_destination_index(compact_files_list_t *destination, compact_files_list_t *difference, configuration_t *the_config) {
+    if (destination == NULL || difference == NULL || the_config == NULL || the_config->dest_index[0] == '\0') {
+        return -1;
+    }
+    char temporary_path[PATH_SIZE];
+    if (snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", the_config->dest_index) >= (int) sizeof(temporary_path)) {
+        return -1;
+    }
+    FILE *index = fopen(temporary_path, "wb");
+    if (index == NULL) {
+        perror("Failed to create destination index");
+        return -1;
+    }
+
+    dest_index_header_t header;
+    memcpy(header.magic, DEST_INDEX_MAGIC, sizeof(header.magic));
+    header.flags = the_config->uses_md5 ? DEST_INDEX_FLAG_MD5 : 0;
+    header.entries_count = 0;
+    bool failed = fwrite(&header, sizeof(header), 1, index) != 1;
+
+    size_t start_of_dest = strlen(the_config->destination) + 1;
+    path_store_cursor_t dest_cursor, diff_cursor;
+    start_path_cursor(&dest_cursor, &destination->paths);
+    start_path_cursor(&diff_cursor, &difference->paths);
+    bool has_dest = next_path(&dest_cursor);
+    bool has_diff = next_path(&diff_cursor);
+    files_list_entry_t entry;
+    struct stat sb;
+    while (!failed && (has_dest || has_diff)) {
+        int cmp;
+        if (!has_dest) {
+            cmp = 1;
+        } else if (!has_diff) {
+            cmp = -1;
+        } else {
+            cmp = strcmp(dest_cursor.path, diff_cursor.path);
+        }
+
+        if (cmp < 0) {
+            fill_entry_from_compact(destination, &dest_cursor, &entry);
+            failed = write_files_list_record(index, &entry, start_of_dest) == -1;
+            ++header.entries_count;
+            has_dest = next_path(&dest_cursor);
+            continue;
+        }
+        fill_entry_from_compact(difference, &diff_cursor, &entry);
+        if (concat_path(entry.path_and_name, the_config->destination, diff_cursor.path) != NULL
+            && lstat(entry.path_and_name, &sb) == 0
+            && (entry.entry_type == DOSSIER || (uint64_t) sb.st_size == entry.size)) {
+            entry.mtime = sb.st_mtim;
+            entry.mode = sb.st_mode;
+            failed = write_files_list_record(index, &entry, start_of_dest) == -1;
+            ++header.entries_count;
+        }
+        if (cmp == 0) {
+            has_dest = next_path(&dest_cursor);
+        }
+        has_diff = next_path(&diff_cursor);
+    }
+
+    if (!failed) {
+        failed = fseek(index, 0, SEEK_SET) == -1 || fwrite(&header, sizeof(header), 1, index) != 1;
+    }
+    if (fclose(index) != 0 || failed) {
+        fprintf(stderr, "Failed to write destination index %s\n", temporary_path);
+        remove(temporary_path);
+        return -1;
+    }
+    if (rename(temporary_path, the_config->dest_index) == -1) {
+        perror("Failed to install destination index");
+        remove(temporary_path);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/stat.h>
+#include "files-list.h"
+#include "configuration.h"
+
+#define DEST_INDEX_MAGIC "LP25IDX1"
+#define DEST_INDEX_SAMPLE_STEP 64
+
+typedef struct __attribute__((packed)) {
+    char magic[8];
+    uint32_t flags; // DEST_INDEX_FLAG_* values
+    uint64_t entries_count;
+} dest_index_header_t;
+
+#define DEST_INDEX_FLAG_MD5 0x1
+
+bool entry_matches_stat(files_list_entry_t *entry, struct stat *sb);
+int load_destination_index(compact_files_list_t *list, configuration_t *the_config);
+int save_destination_index(compact_files_list_t *destination, compact_files_list_t *difference, configuration_t *the_config);
@@ -0,0 +1,125 @@
+#include "devices.h"
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+
+static devices_table_t *devices_table = NULL;
+
+/*!
+ * @brief init_devices_table enables per device limits, it must be called before the listers are forked
+ * @param rotational_limit is the limit of rotational devices (hard disks)
+ * @param solid_limit is the limit of the other devices (solid state drives, network and virtual file systems)
+ * @return true if the limits are enabled, false else
+ */
+bool init_devices_table(int rotational_limit, int solid_limit) {
+    devices_table_t *table = mmap(NULL, sizeof(devices_table_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED) {
+        perror("Failed to map devices table");
+        return false;
+    }
+    table->lock = 0;
+    table->slots_count = 0;
+    table->rotational_limit = rotational_limit;
+    table->solid_limit = solid_limit;
+    table->waiting_listers = 0;
+    devices_table = table;
+    return true;
+}
+
+/*!
+ * @brief get_device_slot returns the slot of a device, registering it on first use
+ * @param device is the device (st_dev)
+ * @return the slot of the device, -1 if limits are disabled or the table is full
+ */
+int get_device_slot(dev_t device) {
+    if (devices_table == NULL) {
+        return -1;
+    }
+    while (__atomic_test_and_set(&devices_table->lock, __ATOMIC_ACQUIRE));
+    int slot = 0;
+    while (slot < devices_table->slots_count && devices_table->slots[slot].device != device) {
+        ++slot;
+    }
+    if (slot == devices_table->slots_count) {
+        if (slot == DEVICES_MAX) {
+            slot = -1;
+        } else {
+            device_slot_t *new_slot = &devices_table->slots[slot];
+            new_slot->device = device;
+            new_slot->limit = is_rotational_device(device) ? devices_table->rotational_limit : devices_table->solid_limit;
+            new_slot->outstanding = 0;
+            ++devices_table->slots_count;
+        }
+    }
+    __atomic_clear(&devices_table->lock, __ATOMIC_RELEASE);
+    return slot;
+}
+
+/*!
+ * @brief acquire_device reserves one of the concurrent files of a device
+ * @param slot is the slot of the device (@see get_device_slot), -1 for an unlimited device
+ * @return true if the file can be analyzed, false if the device is at its limit
+ */
+bool acquire_device(int slot) {
+    if (devices_table == NULL || slot < 0) {
+        return true;
+    }
+    device_slot_t *device_slot = &devices_table->slots[slot];
+    int outstanding = __atomic_load_n(&device_slot->outstanding, __ATOMIC_SEQ_CST);
+    while (outstanding < device_slot->limit) {
+        if (__atomic_compare_exchange_n(&device_slot->outstanding, &outstanding, outstanding + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief release_device releases a file reserved with acquire_device
+ * @param slot is the slot of the device, -1 for an unlimited device
+ * @return the bits (1 << mtype) of the listers waiting for a device, to be woken up by the caller, 0 if none
+ */
+int release_device(int slot) {
+    if (devices_table == NULL || slot < 0) {
+        return 0;
+    }
+    __atomic_sub_fetch(&devices_table->slots[slot].outstanding, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&devices_table->waiting_listers, __ATOMIC_SEQ_CST) == 0) {
+        return 0;
+    }
+    return __atomic_exchange_n(&devices_table->waiting_listers, 0, __ATOMIC_SEQ_CST);
+}
+
+/*!
+ * @brief wait_for_device registers a lister that cannot dispatch any entry until a device is released
+ * The lister must try to acquire its devices once more after registering, and sleep only if it still cannot: a
+ * release between its last try and its registration would otherwise not wake it up.
+ * @param lister_id is the mtype of the lister, its wake-up message is sent to it
+ */
+void wait_for_device(int lister_id) {
+    if (devices_table != NULL) {
+        __atomic_or_fetch(&devices_table->waiting_listers, 1 << lister_id, __ATOMIC_SEQ_CST);
+    }
+}
+
+/*!
+ * @brief is_rotational_device tells if a device is a hard disk, as told by sysfs
+ * Partitions have no queue directory of their own, the queue of their disk is used.
+ * @param device is the device (st_dev)
+ * @return true if the device is rotational, false else (including devices that are not block devices)
+ */
+bool is_rotational_device(dev_t device) {
+    char path[128];
+    FILE *rotational = NULL;
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/queue/rotational", major(device), minor(device));
+    if ((rotational = fopen(path, "r")) == NULL) {
+        snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../queue/rotational", major(device), minor(device));
+        rotational = fopen(path, "r");
+    }
+    if (rotational == NULL) {
+        return false;
+    }
+    int value = fgetc(rotational);
+    fclose(rotational);
+    return value == '1';
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define DEVICES_MAX 64 // Devices with their own limit, entries of other devices are not limited
+
+// Concurrency limit of a device, shared by the listers of both sides
+typedef struct {
+    dev_t device;
+    int limit; // Files analyzed at the same time on the device, at most
+    int outstanding; // Files being analyzed on the device
+} device_slot_t;
+
+// Lives in a shared mapping created before the fork, so that a device shared by the source and the destination is
+// limited once for both
+typedef struct {
+    int lock; // Protects slots_count and the registration of slots
+    int slots_count;
+    int rotational_limit;
+    int solid_limit;
+    int waiting_listers; // Bit (1 << mtype) of each lister waiting for a device to be released (@see wait_for_device)
+    device_slot_t slots[DEVICES_MAX];
+} devices_table_t;
+
+bool init_devices_table(int rotational_limit, int solid_limit);
+int get_device_slot(dev_t device);
+bool acquire_device(int slot);
+int release_device(int slot);
+void wait_for_device(int lister_id);
+bool is_rotational_device(dev_t device);
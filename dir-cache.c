@@ -0,0 +1,249 @@
+#include "dir-cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// The copy stage creates the destination entries relative to their directory (openat, mkdirat), so the destination
+// root and the directories above an entry are resolved once per directory instead of once per entry. Directories are
+// kept open while they are used, and missing parents are created on demand while the path of an entry is walked.
+
+static char *root_path = NULL;
+static int root_fd = -1;
+static cached_directory_t directories[DIR_CACHE_SIZE];
+static int directories_count = 0;
+static uint64_t use_clock = 0;
+// Evicted directories still used by asynchronous copies (@see defer_directory_closes)
+static bool closes_deferred = false;
+static int *retired_fds = NULL;
+static int retired_count = 0;
+static int retired_capacity = 0;
+
+/*!
+ * @brief retire_directory closes an evicted directory, or keeps it open until the retired directories are closed
+ * @param fd is the descriptor of the directory
+ */
+static void retire_directory(int fd) {
+    if (!closes_deferred) {
+        close(fd);
+        return;
+    }
+    if (retired_count == retired_capacity) {
+        int capacity = retired_capacity == 0 ? DIR_CACHE_SIZE : retired_capacity * 2;
+        int *fds = realloc(retired_fds, capacity * sizeof(int));
+        if (fds == NULL) {
+            fprintf(stderr, "Failed to allocate memory for the directories cache\n");
+            exit(-1);
+        }
+        retired_fds = fds;
+        retired_capacity = capacity;
+    }
+    retired_fds[retired_count++] = fd;
+}
+
+/*!
+ * @brief open_root returns a descriptor of the destination root, the cache is emptied when the root changes
+ * @param root is the path of the destination root
+ * @return the descriptor of the root, -1 if it cannot be opened
+ */
+static int open_root(char *root) {
+    if (root_fd != -1 && strcmp(root_path, root) == 0) {
+        return root_fd;
+    }
+    close_destination_directories();
+    root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd == -1) {
+        perror("Failed to open the destination");
+        return -1;
+    }
+    root_path = strdup(root);
+    if (root_path == NULL) {
+        fprintf(stderr, "Failed to allocate memory for the directories cache\n");
+        exit(-1);
+    }
+    return root_fd;
+}
+
+/*!
+ * @brief find_directory looks for an open directory in the cache, and marks it as used
+ * @param path is the relative path of the directory, possibly followed by the rest of an entry path
+ * @param length is the length of the directory path
+ * @return the descriptor of the directory, -1 if it is not open
+ */
+static int find_directory(char *path, size_t length) {
+    for (int i = 0; i < directories_count; ++i) {
+        if (directories[i].length == length && memcmp(directories[i].path, path, length) == 0) {
+            directories[i].last_use = ++use_clock;
+            return directories[i].fd;
+        }
+    }
+    return -1;
+}
+
+/*!
+ * @brief add_directory adds an open directory to the cache, closing the least recently used one when it is full
+ * @param path is the relative path of the directory, possibly followed by the rest of an entry path
+ * @param length is the length of the directory path
+ * @param fd is the descriptor of the directory, the cache becomes its owner
+ */
+static void add_directory(char *path, size_t length, int fd) {
+    cached_directory_t *slot = &directories[0];
+    if (directories_count < DIR_CACHE_SIZE) {
+        slot = &directories[directories_count++];
+    } else {
+        for (int i = 1; i < DIR_CACHE_SIZE; ++i) {
+            if (directories[i].last_use < slot->last_use) {
+                slot = &directories[i];
+            }
+        }
+        retire_directory(slot->fd);
+        free(slot->path);
+    }
+    slot->path = strndup(path, length);
+    if (slot->path == NULL) {
+        fprintf(stderr, "Failed to allocate memory for the directories cache\n");
+        exit(-1);
+    }
+    slot->length = length;
+    slot->fd = fd;
+    slot->last_use = ++use_clock;
+}
+
+/*!
+ * @brief open_directory returns a descriptor of a destination directory, opening it from its nearest open parent
+ * Missing directories on the way are created with the default mode (their own entry sets theirs if it comes later).
+ * @param path is the relative path of the directory, possibly followed by the rest of an entry path
+ * @param length is the length of the directory path, 0 for the root
+ * @return the descriptor of the directory (owned by the cache), -1 in case of error
+ */
+static int open_directory(char *path, size_t length) {
+    if (length == 0) {
+        return root_fd;
+    }
+    int fd = find_directory(path, length);
+    if (fd != -1) {
+        return fd;
+    }
+    size_t parent_length = length;
+    while (parent_length > 0 && path[parent_length - 1] != '/') {
+        --parent_length;
+    }
+    char name[NAME_MAX + 1];
+    if (length - parent_length > NAME_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(name, path + parent_length, length - parent_length);
+    name[length - parent_length] = '\0';
+    int parent_fd = open_directory(path, parent_length > 0 ? parent_length - 1 : 0);
+    if (parent_fd == -1) {
+        return -1;
+    }
+    fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1 && errno == ENOENT && (mkdirat(parent_fd, name, 0777) == 0 || errno == EEXIST)) {
+        fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    if (fd == -1) {
+        return -1;
+    }
+    add_directory(path, length, fd);
+    return fd;
+}
+
+/*!
+ * @brief open_destination_parent returns a descriptor of the directory of a destination entry, to be used with the
+ * *at system calls. Missing directories are created.
+ * @param root is the path of the destination root
+ * @param relative_path is the path of the entry relative to the root
+ * @param name is set to the name of the entry in its directory (it points into relative_path)
+ * @return the descriptor of the directory (owned by the cache, it must not be closed), -1 in case of error
+ */
+int open_destination_parent(char *root, char *relative_path, char **name) {
+    if (open_root(root) == -1) {
+        return -1;
+    }
+    char *slash = strrchr(relative_path, '/');
+    *name = slash == NULL ? relative_path : slash + 1;
+    return open_directory(relative_path, slash == NULL ? 0 : (size_t) (slash - relative_path));
+}
+
+/*!
+ * @brief create_destination_directory creates a destination directory, and its missing parents
+ * @param root is the path of the destination root
+ * @param relative_path is the path of the directory relative to the root
+ * @param mode is the mode of the directory
+ * @return 0 if the directory exists, -1 else
+ */
+int create_destination_directory(char *root, char *relative_path, mode_t mode) {
+    char *name;
+    int parent_fd = open_destination_parent(root, relative_path, &name);
+    if (parent_fd == -1 || (mkdirat(parent_fd, name, mode) == -1 && errno != EEXIST)) {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief detach_destination_file unlinks a destination file whose inode has other links, before it is rewritten
+ * Opening it with O_TRUNC would change the content of its other links too (files linked together by --hardlinks or
+ * by the user), while the copy must only replace this name.
+ * @param fd_directory is the descriptor of the directory of the file (@see open_destination_parent), or AT_FDCWD
+ * @param name is the name of the file in its directory
+ */
+void detach_destination_file(int fd_directory, char *name) {
+    struct stat sb;
+    if (fstatat(fd_directory, name, &sb, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(sb.st_mode) && sb.st_nlink > 1
+        && unlinkat(fd_directory, name, 0) == -1) {
+        perror("Failed to unlink a linked destination file");
+    }
+}
+
+/*!
+ * @brief defer_directory_closes keeps the evicted directories open until close_retired_directories is called, while
+ * queued operations may still use their descriptors
+ * @param deferred is true to defer the closes, false to close the evicted directories at once
+ */
+void defer_directory_closes(bool deferred) {
+    closes_deferred = deferred;
+}
+
+/*!
+ * @brief count_retired_directories returns the number of evicted directories kept open
+ * @return the number of directories
+ */
+int count_retired_directories(void) {
+    return retired_count;
+}
+
+/*!
+ * @brief close_retired_directories closes the evicted directories kept open (@see defer_directory_closes)
+ */
+void close_retired_directories(void) {
+    for (int i = 0; i < retired_count; ++i) {
+        close(retired_fds[i]);
+    }
+    retired_count = 0;
+}
+
+/*!
+ * @brief close_destination_directories closes the cached directories, at the end of a synchronization (the destination
+ * may change before the next one)
+ */
+void close_destination_directories(void) {
+    for (int i = 0; i < directories_count; ++i) {
+        close(directories[i].fd);
+        free(directories[i].path);
+    }
+    directories_count = 0;
+    close_retired_directories();
+    if (root_fd != -1) {
+        close(root_fd);
+        root_fd = -1;
+    }
+    free(root_path);
+    root_path = NULL;
+}
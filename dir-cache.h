@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define DIR_CACHE_SIZE 64 // Destination directories kept open by the copy stage, at most
+
+// An open destination directory, keyed by its path relative to the destination root ("" is not cached, it is the root)
+typedef struct {
+    char *path;
+    size_t length;
+    int fd;
+    uint64_t last_use; // Value of the use clock when the directory was last used, the least recent one is evicted
+} cached_directory_t;
+
+int open_destination_parent(char *root, char *relative_path, char **name);
+int create_destination_directory(char *root, char *relative_path, mode_t mode);
+void detach_destination_file(int fd_directory, char *name);
+void defer_directory_closes(bool deferred);
+int count_retired_directories(void);
+void close_retired_directories(void);
+void close_destination_directories(void);
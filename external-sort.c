@@ -0,0 +1,469 @@
+#include "external-sort.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "defines.h"
+#include "utility.h"
+#include "files-list-io.h"
+#include "file-properties.h"
+#include "sync.h"
+#include "filters.h"
+#include "dir-cache.h"
+#include "uring-copy.h"
+#include "log.h"
+#include "stats.h"
+
+// Memory-bounded synchronization: both trees are listed into sorted runs spilled to temporary files (in the
+// compact record format of files-list-io), the runs are merged, and the two merged sequences are diffed in one pass.
+// Only the run buffers (while listing) or the merge cursors (while diffing) are kept in memory.
+
+/*!
+ * @brief create_run_file creates an anonymous temporary file to hold a run
+ * The file is unlinked right away, so that it disappears when it is closed or when the program dies.
+ * @return the stream of the file, NULL in case of error
+ */
+static FILE *create_run_file(void) {
+    char path[PATH_SIZE];
+    char *temporary_dir = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/lp25-run-XXXXXX", temporary_dir != NULL ? temporary_dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("Failed to create run file");
+        return NULL;
+    }
+    unlink(path);
+    FILE *run = fdopen(fd, "w+b");
+    if (run == NULL) {
+        close(fd);
+    }
+    return run;
+}
+
+/*!
+ * @brief compare_records compares two in-memory records by path, like strcmp (qsort callback)
+ * @param lhs is a pointer to a pointer to the first record
+ * @param rhs is a pointer to a pointer to the second record
+ * @return a negative value, zero or a positive value if lhs path is lower, equal or greater than rhs path
+ */
+static int compare_records(const void *lhs, const void *rhs) {
+    const uint8_t *left_record = *(uint8_t * const *) lhs;
+    const uint8_t *right_record = *(uint8_t * const *) rhs;
+    files_list_record_t left, right;
+    memcpy(&left, left_record, sizeof(left));
+    memcpy(&right, right_record, sizeof(right));
+    size_t common = left.path_length < right.path_length ? left.path_length : right.path_length;
+    int cmp = memcmp(left_record + sizeof(left), right_record + sizeof(right), common);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (int) left.path_length - (int) right.path_length;
+}
+
+/*!
+ * @brief init_sorted_runs initializes a sorted runs set whose run buffer fits in a memory budget
+ * @param runs is a pointer to the runs set to initialize
+ * @param root is the root of the tree the entries will belong to
+ * @param memory_budget is the number of bytes the runs set may use
+ * @return 0 in case of success, -1 else
+ */
+int init_sorted_runs(sorted_runs_t *runs, char *root, size_t memory_budget) {
+    if (runs == NULL || root == NULL) {
+        return -1;
+    }
+    memset(runs, 0, sizeof(sorted_runs_t));
+    if (memory_budget < MEMORY_BUDGET_MIN / 2) {
+        memory_budget = MEMORY_BUDGET_MIN / 2;
+    }
+    // Every record needs its bytes and a pointer in the records array
+    runs->records_capacity = memory_budget / (sizeof(files_list_record_t) + sizeof(uint8_t *));
+    runs->buffer_size = memory_budget - runs->records_capacity * sizeof(uint8_t *);
+    runs->buffer = malloc(runs->buffer_size);
+    runs->records = malloc(runs->records_capacity * sizeof(uint8_t *));
+    if (runs->buffer == NULL || runs->records == NULL) {
+        free_sorted_runs(runs);
+        return -1;
+    }
+    runs->root = root;
+    runs->start_of_name = strlen(root) + 1;
+    runs->memory_budget = memory_budget;
+    return 0;
+}
+
+/*!
+ * @brief add_entry_to_runs adds an entry to the current run, spilling the run first when it is full
+ * @param runs is a pointer to the runs set
+ * @param entry is a pointer to the entry to add (it is copied)
+ * @return 0 in case of success, -1 else
+ */
+int add_entry_to_runs(sorted_runs_t *runs, files_list_entry_t *entry) {
+    if (runs == NULL || entry == NULL || runs->buffer == NULL) {
+        return -1;
+    }
+    size_t length = 0;
+    if (runs->records_count < runs->records_capacity) {
+        length = encode_files_list_record(runs->buffer + runs->buffer_used, runs->buffer_size - runs->buffer_used, entry, runs->start_of_name);
+    }
+    if (length == 0) {
+        if (spill_sorted_run(runs) == -1) {
+            return -1;
+        }
+        length = encode_files_list_record(runs->buffer, runs->buffer_size, entry, runs->start_of_name);
+        if (length == 0) {
+            return -1;
+        }
+    }
+    runs->records[runs->records_count++] = runs->buffer + runs->buffer_used;
+    runs->buffer_used += length;
+    return 0;
+}
+
+/*!
+ * @brief spill_sorted_run sorts the current run and writes it to a new temporary file
+ * @param runs is a pointer to the runs set
+ * @return 0 in case of success (or if the current run is empty), -1 else
+ */
+int spill_sorted_run(sorted_runs_t *runs) {
+    if (runs == NULL) {
+        return -1;
+    }
+    if (runs->records_count == 0) {
+        return 0;
+    }
+    if (runs->runs_count == runs->runs_capacity) {
+        size_t capacity = runs->runs_capacity == 0 ? 16 : runs->runs_capacity * 2;
+        FILE **new_runs = realloc(runs->runs, capacity * sizeof(FILE *));
+        if (new_runs == NULL) {
+            return -1;
+        }
+        runs->runs = new_runs;
+        runs->runs_capacity = capacity;
+    }
+    qsort(runs->records, runs->records_count, sizeof(uint8_t *), compare_records);
+
+    FILE *run = create_run_file();
+    if (run == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < runs->records_count; ++i) {
+        files_list_record_t record;
+        memcpy(&record, runs->records[i], sizeof(record));
+        if (fwrite(runs->records[i], sizeof(record) + record.path_length, 1, run) != 1) {
+            perror("Failed to write run");
+            fclose(run);
+            return -1;
+        }
+    }
+    if (fflush(run) != 0) {
+        fclose(run);
+        return -1;
+    }
+    runs->runs[runs->runs_count++] = run;
+    runs->records_count = 0;
+    runs->buffer_used = 0;
+    return 0;
+}
+
+/*!
+ * @brief free_sorted_runs frees the memory and closes the files of a runs set
+ * @param runs is a pointer to the runs set
+ */
+void free_sorted_runs(sorted_runs_t *runs) {
+    if (runs == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < runs->runs_count; ++i) {
+        fclose(runs->runs[i]);
+    }
+    free(runs->runs);
+    free(runs->buffer);
+    free(runs->records);
+    runs->runs = NULL;
+    runs->buffer = NULL;
+    runs->records = NULL;
+    runs->runs_count = 0;
+    runs->records_count = 0;
+}
+
+/*!
+ * @brief cursor_is_lower compares the current entries of two cursors of a merger
+ * @param merger is a pointer to the merger
+ * @param lhs is the index of the first cursor
+ * @param rhs is the index of the second cursor
+ * @return true if the entry of lhs comes before the entry of rhs
+ */
+static bool cursor_is_lower(runs_merger_t *merger, size_t lhs, size_t rhs) {
+    return strcmp(merger->cursors[lhs].entry.path_and_name, merger->cursors[rhs].entry.path_and_name) < 0;
+}
+
+/*!
+ * @brief sift_down restores the heap property from a position of the heap to its leaves
+ * @param merger is a pointer to the merger
+ * @param position is the position to start from
+ */
+static void sift_down(runs_merger_t *merger, size_t position) {
+    while (true) {
+        size_t smallest = position;
+        size_t left = 2 * position + 1;
+        size_t right = left + 1;
+        if (left < merger->heap_size && cursor_is_lower(merger, merger->heap[left], merger->heap[smallest])) {
+            smallest = left;
+        }
+        if (right < merger->heap_size && cursor_is_lower(merger, merger->heap[right], merger->heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == position) {
+            return;
+        }
+        size_t tmp = merger->heap[position];
+        merger->heap[position] = merger->heap[smallest];
+        merger->heap[smallest] = tmp;
+        position = smallest;
+    }
+}
+
+/*!
+ * @brief start_merger starts a merge of a set of runs. The merger becomes owner of the runs files.
+ * @param merger is a pointer to the merger to start
+ * @param runs is an array of the runs files to merge
+ * @param runs_count is the number of runs
+ * @param root is the root of the tree the entries belong to
+ * @return 0 in case of success, -1 else
+ */
+static int start_merger(runs_merger_t *merger, FILE **runs, size_t runs_count, char *root) {
+    merger->cursors = malloc((runs_count > 0 ? runs_count : 1) * sizeof(merge_cursor_t));
+    merger->heap = malloc((runs_count > 0 ? runs_count : 1) * sizeof(size_t));
+    merger->heap_size = 0;
+    merger->cursors_count = 0;
+    merger->root = root;
+    if (merger->cursors == NULL || merger->heap == NULL) {
+        for (size_t i = 0; i < runs_count; ++i) {
+            fclose(runs[i]);
+        }
+        close_runs_merger(merger);
+        return -1;
+    }
+    int result = 0;
+    for (size_t i = 0; i < runs_count; ++i) {
+        merge_cursor_t *cursor = &merger->cursors[merger->cursors_count++];
+        cursor->run = runs[i];
+        rewind(cursor->run);
+        int read_result = read_files_list_record(cursor->run, &cursor->entry, root);
+        if (read_result == 1) {
+            merger->heap[merger->heap_size++] = i;
+        } else if (read_result == -1) {
+            result = -1;
+        }
+    }
+    for (size_t i = merger->heap_size / 2; i > 0; --i) {
+        sift_down(merger, i - 1);
+    }
+    return result;
+}
+
+/*!
+ * @brief open_runs_merger spills the last run of a runs set and prepares the merge of all its runs
+ * When there are more runs than the memory budget allows to merge at once, runs are merged into bigger ones first.
+ * The run buffer of the set is freed, and the merger becomes owner of the runs files.
+ * @param merger is a pointer to the merger to open
+ * @param runs is a pointer to the runs set
+ * @return 0 in case of success, -1 else
+ */
+int open_runs_merger(runs_merger_t *merger, sorted_runs_t *runs) {
+    if (merger == NULL || runs == NULL || spill_sorted_run(runs) == -1) {
+        return -1;
+    }
+    free(runs->buffer);
+    free(runs->records);
+    runs->buffer = NULL;
+    runs->records = NULL;
+
+    size_t fan_in = runs->memory_budget / (sizeof(merge_cursor_t) + BUFSIZ);
+    if (fan_in < 2) {
+        fan_in = 2;
+    } else if (fan_in > MERGE_MAX_FAN_IN) {
+        fan_in = MERGE_MAX_FAN_IN;
+    }
+    while (runs->runs_count > fan_in) {
+        FILE *merged_run = create_run_file();
+        if (merged_run == NULL) {
+            return -1;
+        }
+        runs_merger_t partial_merger;
+        int result = start_merger(&partial_merger, runs->runs, fan_in, runs->root);
+        files_list_entry_t *entry = malloc(sizeof(files_list_entry_t));
+        while (result == 0 && entry != NULL && (result = next_merged_entry(&partial_merger, entry)) == 1) {
+            result = write_files_list_record(merged_run, entry, runs->start_of_name);
+        }
+        free(entry);
+        close_runs_merger(&partial_merger);
+        memmove(runs->runs + 1, runs->runs + fan_in, (runs->runs_count - fan_in) * sizeof(FILE *));
+        runs->runs[0] = merged_run;
+        runs->runs_count -= fan_in - 1;
+        if (result != 0 || fflush(merged_run) != 0) {
+            return -1;
+        }
+    }
+    int result = start_merger(merger, runs->runs, runs->runs_count, runs->root);
+    runs->runs_count = 0;
+    return result;
+}
+
+/*!
+ * @brief next_merged_entry returns the next entry, in path order, of all the merged runs
+ * @param merger is a pointer to the merger
+ * @param entry is a pointer to the entry to fill
+ * @return 1 when an entry was returned, 0 when all runs are exhausted, -1 in case of error
+ */
+int next_merged_entry(runs_merger_t *merger, files_list_entry_t *entry) {
+    if (merger == NULL || entry == NULL) {
+        return -1;
+    }
+    if (merger->heap_size == 0) {
+        return 0;
+    }
+    merge_cursor_t *cursor = &merger->cursors[merger->heap[0]];
+    memcpy(entry, &cursor->entry, sizeof(files_list_entry_t));
+    int read_result = read_files_list_record(cursor->run, &cursor->entry, merger->root);
+    if (read_result == -1) {
+        return -1;
+    }
+    if (read_result == 0) {
+        merger->heap[0] = merger->heap[--merger->heap_size];
+    }
+    sift_down(merger, 0);
+    return 1;
+}
+
+/*!
+ * @brief close_runs_merger closes the runs files and frees the memory of a merger
+ * @param merger is a pointer to the merger
+ */
+void close_runs_merger(runs_merger_t *merger) {
+    if (merger == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < merger->cursors_count; ++i) {
+        fclose(merger->cursors[i].run);
+    }
+    free(merger->cursors);
+    free(merger->heap);
+    merger->cursors = NULL;
+    merger->heap = NULL;
+    merger->cursors_count = 0;
+    merger->heap_size = 0;
+}
+
+/*!
+ * @brief spill_tree lists and analyzes a tree (recursively) into a sorted runs set
+ * Entries that cannot be analyzed or that the filters exclude are skipped.
+ * @param runs is a pointer to the runs set
+ * @param target is the directory to list
+ * @param prefix_length is the length of the root of the tree in the paths (@see root_prefix_length)
+ * @return 0 in case of success, -1 else
+ */
+int spill_tree(sorted_runs_t *runs, char *target, size_t prefix_length) {
+    DIR *dir = open_dir(target);
+    if (dir == NULL) {
+        return 0;
+    }
+    int result = 0;
+    files_list_entry_t entry;
+    struct dirent *dir_entry;
+    while (result == 0 && (dir_entry = get_next_entry(dir)) != NULL) {
+        memset(&entry, 0, sizeof(entry));
+        if (concat_path(entry.path_and_name, target, dir_entry->d_name) == NULL
+            || is_entry_excluded(entry.path_and_name, prefix_length, dir_entry->d_name, dir_entry->d_type == DT_DIR)
+            || get_file_stats(&entry) == -1) {
+            continue;
+        }
+        result = add_entry_to_runs(runs, &entry);
+        if (result == 0 && entry.entry_type == DOSSIER) {
+            result = spill_tree(runs, entry.path_and_name, prefix_length);
+        }
+    }
+    closedir(dir);
+    return result;
+}
+
+/*!
+ * @brief synchronize_streaming synchronizes the source and the destination within the configured memory budget
+ * Half of the budget goes to each tree. Entries to copy are copied as soon as the diff finds them. Both trees are listed
+ * and analyzed by the main process (no process is forked in this mode).
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 if the runs could not be allocated, written or read
+ */
+int synchronize_streaming(configuration_t *the_config) {
+    sorted_runs_t source_runs, destination_runs;
+    runs_merger_t source_merger = {NULL, NULL, 0, 0, NULL};
+    runs_merger_t destination_merger = {NULL, NULL, 0, 0, NULL};
+    files_list_entry_t *source_entry = malloc(sizeof(files_list_entry_t));
+    files_list_entry_t *destination_entry = malloc(sizeof(files_list_entry_t));
+    memset(&source_runs, 0, sizeof(sorted_runs_t));
+    memset(&destination_runs, 0, sizeof(sorted_runs_t));
+    if (source_entry == NULL || destination_entry == NULL
+        || init_sorted_runs(&source_runs, the_config->source, the_config->memory_budget / 2) == -1
+        || init_sorted_runs(&destination_runs, the_config->destination, the_config->memory_budget / 2) == -1) {
+        fprintf(stderr, "Failed to allocate memory for streaming synchronization\n");
+        free_sorted_runs(&source_runs);
+        free_sorted_runs(&destination_runs);
+        free(source_entry);
+        free(destination_entry);
+        return -1;
+    }
+
+    if (spill_tree(&source_runs, the_config->source, root_prefix_length(the_config->source)) == -1
+        || spill_tree(&destination_runs, the_config->destination, root_prefix_length(the_config->destination)) == -1
+        || open_runs_merger(&source_merger, &source_runs) == -1 || open_runs_merger(&destination_merger, &destination_runs) == -1) {
+        fprintf(stderr, "Failed to build sorted runs\n");
+        close_runs_merger(&source_merger);
+        close_runs_merger(&destination_merger);
+        free_sorted_runs(&source_runs);
+        free_sorted_runs(&destination_runs);
+        free(source_entry);
+        free(destination_entry);
+        return -1;
+    }
+
+    size_t start_of_src = strlen(the_config->source) + 1;
+    size_t start_of_dest = strlen(the_config->destination) + 1;
+    int has_source = next_merged_entry(&source_merger, source_entry);
+    int has_destination = next_merged_entry(&destination_merger, destination_entry);
+    while (has_source == 1 && has_destination != -1) {
+        int cmp = 1;
+        if (has_destination == 1) {
+            cmp = strcmp(destination_entry->path_and_name + start_of_dest, source_entry->path_and_name + start_of_src);
+        }
+        if (cmp < 0) {
+            has_destination = next_merged_entry(&destination_merger, destination_entry);
+            continue;
+        }
+        if (cmp > 0 || mismatch(source_entry, destination_entry, the_config->uses_md5)) {
+            if (the_config->dry_run) {
+                LOG_INFO(LOG_CATEGORY_COPY, "\nWould copy %s\n", source_entry->path_and_name);
+            } else {
+                copy_entry_to_destination(source_entry, the_config);
+            }
+        }
+        if (cmp == 0) {
+            has_destination = next_merged_entry(&destination_merger, destination_entry);
+        }
+        has_source = next_merged_entry(&source_merger, source_entry);
+        ++process_stats.synchronized_entries;
+    }
+    int result = 0;
+    if (has_source == -1 || has_destination == -1) {
+        fprintf(stderr, "Failed to read sorted runs\n");
+        result = -1;
+    }
+
+    close_uring_copy();
+    close_destination_directories();
+    close_runs_merger(&source_merger);
+    close_runs_merger(&destination_merger);
+    free_sorted_runs(&source_runs);
+    free_sorted_runs(&destination_runs);
+    free(source_entry);
+    free(destination_entry);
+    return result;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "files-list.h"
+#include "configuration.h"
+
+#define MERGE_MAX_FAN_IN 64
+#define MEMORY_BUDGET_MIN (1024 * 1024)
+
+typedef struct {
+    uint8_t *buffer; // Records of the current run, in arrival order
+    size_t buffer_used;
+    size_t buffer_size;
+    uint8_t **records; // Pointers to the records of the current run, sorted when the run is spilled
+    size_t records_count;
+    size_t records_capacity;
+    FILE **runs; // Spilled runs, as unlinked temporary files
+    size_t runs_count;
+    size_t runs_capacity;
+    char *root;
+    size_t start_of_name;
+    size_t memory_budget;
+} sorted_runs_t;
+
+typedef struct {
+    FILE *run;
+    files_list_entry_t entry; // Current (smallest not yet returned) entry of the run
+} merge_cursor_t;
+
+typedef struct {
+    merge_cursor_t *cursors;
+    size_t *heap; // Indexes of the cursors which still have an entry, ordered as a min-heap on their entry path
+    size_t heap_size;
+    size_t cursors_count;
+    char *root;
+} runs_merger_t;
+
+int init_sorted_runs(sorted_runs_t *runs, char *root, size_t memory_budget);
+int add_entry_to_runs(sorted_runs_t *runs, files_list_entry_t *entry);
+int spill_sorted_run(sorted_runs_t *runs);
+void free_sorted_runs(sorted_runs_t *runs);
+int open_runs_merger(runs_merger_t *merger, sorted_runs_t *runs);
+int next_merged_entry(runs_merger_t *merger, files_list_entry_t *entry);
+void close_runs_merger(runs_merger_t *merger);
+int spill_tree(sorted_runs_t *runs, char *target, size_t prefix_length);
+int synchronize_streaming(configuration_t *the_config);
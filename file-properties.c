@@ -10,6 +10,10 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include "utility.h"
+#include "stats.h"
+#include "log.h"
+#include "inodes.h"
+#include "qos.h"
 
 /*!
  * @brief get_file_stats gets all of the required information for a file (inc. directories)
@@ -28,25 +32,43 @@
  */
 int get_file_stats(files_list_entry_t *entry) {
     // printf("Getting stats for %s\n", entry->path_and_name); debug
+    if (get_file_metadata(entry) == -1) {
+        return -1;
+    }
+    if (entry->entry_type == FICHIER && compute_inode_md5(entry) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief get_file_metadata gets the information of a file that only needs a stat (everything but its MD5 sum)
+ * The MD5 sum is zeroed, for files it is computed apart (@see compute_file_md5).
+ * @param entry is a pointer to the files list entry
+ * @return -1 in case of error (or if the entry is neither a file nor a directory), 0 else
+ */
+int get_file_metadata(files_list_entry_t *entry) {
     struct stat sb;
     char *path = entry->path_and_name;
+    uint64_t stat_start = stats_now();
     if (lstat(path, &sb) == -1) {
         return -1;
     }
+    stats_add_phase(PHASE_STAT, stat_start, 1, 0);
     
-    entry->mtime.tv_sec = sb.st_mtime;
-    entry->mtime.tv_nsec = sb.st_mtime;
+    entry->mtime = sb.st_mtim;
+    entry->ctime = sb.st_ctim;
     entry->size = sb.st_size;
     entry->mode = sb.st_mode;
+    entry->device = sb.st_dev;
+    entry->inode = sb.st_ino;
+    entry->links = sb.st_nlink;
+    memset(entry->md5sum, 0, sizeof(entry->md5sum));
 
     if (S_ISDIR(sb.st_mode)) {
         entry->entry_type = DOSSIER;
     } else if (S_ISREG(sb.st_mode)) {
         entry->entry_type = FICHIER;
-
-        if (compute_file_md5(entry) == -1) {
-            return -1;
-        }
     } else {
         return -1;
     }
@@ -54,6 +76,27 @@ int get_file_stats(files_list_entry_t *entry) {
     return 0;
 }
 
+/*!
+ * @brief compute_inode_md5 computes the MD5 sum of a file, once per inode for files with several links
+ * The other links of the inode reuse its digest (@see reserve_inode_digest). A daemon caches the digests of all the
+ * files, so that only the files that changed since the previous synchronization are hashed again.
+ * @param entry is a pointer to the files list entry, its metadata must be set (@see get_file_metadata)
+ * @return -1 in case of error, 0 else
+ */
+int compute_inode_md5(files_list_entry_t *entry) {
+    if (!is_digest_cached(entry)) {
+        return compute_file_md5(entry);
+    }
+    int slot = reserve_inode_digest(entry);
+    if (slot == INODE_DIGEST_KNOWN) {
+        LOG_DEBUG(LOG_CATEGORY_HASH, "Reusing the digest of inode %lu for %s\n", (unsigned long) entry->inode, entry->path_and_name);
+        return 0;
+    }
+    int result = compute_file_md5(entry);
+    publish_inode_digest(slot, entry, result == 0);
+    return result;
+}
+
 /*!
  * @brief compute_file_md5 computes a file's MD5 sum
  * @param the pointer to the files list entry
@@ -64,9 +107,11 @@ int compute_file_md5(files_list_entry_t *entry) {
     // printf("Computing MD5 for %s\n", entry->path_and_name); debug
     //Ouvre et vérifie si le fichier à été correctement ouvert.
     if (entry == NULL) {
-        printf("Le paramètre 'entry' est NULL.\n");
+        LOG_ERROR(LOG_CATEGORY_HASH, "Le paramètre 'entry' est NULL.\n");
         return -1;
     }
+    qos_throttle(QOS_FILES, 1);
+    uint64_t hash_start = stats_now();
     FILE *file = fopen(entry->path_and_name, "rb");
     if (!file) {
         perror("Impossible d'ouvrir le fichier");
@@ -86,9 +131,14 @@ int compute_file_md5(files_list_entry_t *entry) {
 
     unsigned char buffer[1024];
     size_t bytes;
+    uint64_t unthrottled_bytes = 0; // Read since the last throttling point
     while ((bytes = fread(buffer, 1, sizeof(buffer), file)) != 0) {
+        unthrottled_bytes += bytes;
+        if (unthrottled_bytes >= QOS_CHUNK_SIZE) {
+            qos_throttle(QOS_READ_BYTES, unthrottled_bytes);
+            unthrottled_bytes = 0;
+        }
         if (1 != EVP_DigestUpdate(mdctx, buffer, bytes)) {
-            printf("%p\n", mdctx);
             fclose(file);
             EVP_MD_CTX_free(mdctx);
             perror("Erreur dans la mise à jour de la somme MD5");
@@ -105,6 +155,9 @@ int compute_file_md5(files_list_entry_t *entry) {
 
     EVP_MD_CTX_free(mdctx);
     fclose(file);
+    qos_throttle(QOS_READ_BYTES, unthrottled_bytes);
+    stats_add_phase(PHASE_HASH, hash_start, 1, entry->size);
+    stats_add_hash_latency(hash_start);
 
     return 0;
 }
@@ -0,0 +1,159 @@
+#include "files-list-io.h"
+#include <string.h>
+#include "defines.h"
+#include "utility.h"
+
+// Functions in this file (de)serialize files list entries in a compact binary form.
+// Paths are stored relative to the root of their tree so that a record can be reloaded under another prefix.
+
+/*!
+ * @brief fill_entry_from_record copies the fixed part of a record and rebuilds the full path of the entry
+ * @param record is a pointer to the record header
+ * @param path is a pointer to the (not null terminated) relative path of the record
+ * @param entry is a pointer to the entry to fill
+ * @param root is the root of the tree the entry belongs to
+ * @return 0 in case of success, -1 else (path too long)
+ */
+static int fill_entry_from_record(files_list_record_t *record, const char *path, files_list_entry_t *entry, char *root) {
+    char relative_path[PATH_SIZE];
+    if (record->path_length >= PATH_SIZE) {
+        return -1;
+    }
+    memcpy(relative_path, path, record->path_length);
+    relative_path[record->path_length] = '\0';
+    if (concat_path(entry->path_and_name, root, relative_path) == NULL) {
+        return -1;
+    }
+    entry->mtime.tv_sec = record->mtime_sec;
+    entry->mtime.tv_nsec = record->mtime_nsec;
+    entry->size = record->size;
+    entry->mode = record->mode;
+    entry->entry_type = record->entry_type == DOSSIER ? DOSSIER : FICHIER;
+    memcpy(entry->md5sum, record->md5sum, sizeof(entry->md5sum));
+    // Records keep neither inodes nor change times: the entry is handled as a file with a single link
+    entry->ctime.tv_sec = 0;
+    entry->ctime.tv_nsec = 0;
+    entry->device = 0;
+    entry->inode = 0;
+    entry->links = 1;
+    entry->next = NULL;
+    entry->prev = NULL;
+    return 0;
+}
+
+/*!
+ * @brief fill_record_from_entry copies the fixed part of an entry into a record
+ * @param record is a pointer to the record to fill
+ * @param entry is a pointer to the entry
+ * @param start_of_name is the position of the relative path in the entry path (i.e. length of the root + 1)
+ * @return 0 in case of success, -1 if the entry path is shorter than its root
+ */
+static int fill_record_from_entry(files_list_record_t *record, files_list_entry_t *entry, size_t start_of_name) {
+    size_t path_length = strlen(entry->path_and_name);
+    if (start_of_name > path_length) {
+        return -1;
+    }
+    memset(record, 0, sizeof(files_list_record_t));
+    record->mtime_sec = entry->mtime.tv_sec;
+    record->mtime_nsec = entry->mtime.tv_nsec;
+    record->size = entry->size;
+    record->mode = entry->mode;
+    record->path_length = path_length - start_of_name;
+    record->entry_type = entry->entry_type;
+    memcpy(record->md5sum, entry->md5sum, sizeof(record->md5sum));
+    return 0;
+}
+
+/*!
+ * @brief write_files_list_record writes an entry as a record to a stream
+ * @param stream is the stream to write to
+ * @param entry is a pointer to the entry to write
+ * @param start_of_name is the position of the relative path in the entry path (i.e. length of the root + 1)
+ * @return 0 in case of success, -1 else
+ */
+int write_files_list_record(FILE *stream, files_list_entry_t *entry, size_t start_of_name) {
+    if (stream == NULL || entry == NULL) {
+        return -1;
+    }
+    files_list_record_t record;
+    if (fill_record_from_entry(&record, entry, start_of_name) == -1) {
+        return -1;
+    }
+    if (fwrite(&record, sizeof(record), 1, stream) != 1) {
+        return -1;
+    }
+    if (record.path_length > 0 && fwrite(entry->path_and_name + start_of_name, record.path_length, 1, stream) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief encode_files_list_record writes an entry as a record to a memory buffer
+ * @param buffer is a pointer to where the record must be written
+ * @param available is the number of bytes writable to buffer
+ * @param entry is a pointer to the entry to encode
+ * @param start_of_name is the position of the relative path in the entry path (i.e. length of the root + 1)
+ * @return the number of bytes written, 0 if the record doesn't fit or is invalid
+ */
+size_t encode_files_list_record(uint8_t *buffer, size_t available, files_list_entry_t *entry, size_t start_of_name) {
+    if (buffer == NULL || entry == NULL) {
+        return 0;
+    }
+    files_list_record_t record;
+    if (fill_record_from_entry(&record, entry, start_of_name) == -1 || available < sizeof(record) + record.path_length) {
+        return 0;
+    }
+    memcpy(buffer, &record, sizeof(record));
+    memcpy(buffer + sizeof(record), entry->path_and_name + start_of_name, record.path_length);
+    return sizeof(record) + record.path_length;
+}
+
+/*!
+ * @brief read_files_list_record reads the next record of a stream into an entry
+ * @param stream is the stream to read from
+ * @param entry is a pointer to the entry to fill
+ * @param root is the root of the tree, prepended to the relative path of the record
+ * @return 1 when an entry was read, 0 at the end of the stream, -1 in case of error (truncated or invalid record)
+ */
+int read_files_list_record(FILE *stream, files_list_entry_t *entry, char *root) {
+    if (stream == NULL || entry == NULL || root == NULL) {
+        return -1;
+    }
+    files_list_record_t record;
+    size_t read_count = fread(&record, 1, sizeof(record), stream);
+    if (read_count == 0 && feof(stream)) {
+        return 0;
+    }
+    if (read_count != sizeof(record) || record.path_length >= PATH_SIZE) {
+        return -1;
+    }
+    char path[PATH_SIZE];
+    if (record.path_length > 0 && fread(path, record.path_length, 1, stream) != 1) {
+        return -1;
+    }
+    return fill_entry_from_record(&record, path, entry, root) == 0 ? 1 : -1;
+}
+
+/*!
+ * @brief decode_files_list_record decodes a record from a memory buffer (e.g. a mmapped file)
+ * @param buffer is a pointer to the beginning of the record
+ * @param available is the number of bytes readable from buffer
+ * @param entry is a pointer to the entry to fill
+ * @param root is the root of the tree, prepended to the relative path of the record
+ * @return the number of bytes consumed, 0 if the record is truncated or invalid
+ */
+size_t decode_files_list_record(const uint8_t *buffer, size_t available, files_list_entry_t *entry, char *root) {
+    if (buffer == NULL || entry == NULL || root == NULL || available < sizeof(files_list_record_t)) {
+        return 0;
+    }
+    files_list_record_t record;
+    memcpy(&record, buffer, sizeof(record));
+    if (available - sizeof(record) < record.path_length) {
+        return 0;
+    }
+    if (fill_entry_from_record(&record, (const char *) buffer + sizeof(record), entry, root) == -1) {
+        return 0;
+    }
+    return sizeof(record) + record.path_length;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "files-list.h"
+
+// On-disk form of a files list entry: fixed header followed by path_length bytes of path (no '\0')
+typedef struct __attribute__((packed)) {
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+    uint32_t mode;
+    uint16_t path_length;
+    uint8_t entry_type;
+    uint8_t md5sum[16];
+} files_list_record_t;
+
+int write_files_list_record(FILE *stream, files_list_entry_t *entry, size_t start_of_name);
+int read_files_list_record(FILE *stream, files_list_entry_t *entry, char *root);
+size_t encode_files_list_record(uint8_t *buffer, size_t available, files_list_entry_t *entry, size_t start_of_name);
+size_t decode_files_list_record(const uint8_t *buffer, size_t available, files_list_entry_t *entry, char *root);
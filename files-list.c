@@ -4,6 +4,8 @@
 #include <string.h>
 
 #include <stdio.h>
+#include "utility.h"
+#include "log.h"
 
 
 /*!
@@ -26,42 +28,51 @@ void clear_files_list(files_list_t *list) {
  *  Il the file already exists, it does nothing and returns 0
  *  @param list the list to add the file entry into
  *  @param file_path the full path (from the root of the considered tree) of the file
- *  @return 0 if success, -1 else (out of memory)
+ *  @return a pointer to the added entry, NULL if it already exists or in case of error (out of memory)
  */
 files_list_entry_t *add_file_entry(files_list_t *list, char *file_path) {
     // printf("Adding file %s\n", file_path); debug
     files_list_entry_t *new_entry = malloc(sizeof(files_list_entry_t));
     if (new_entry == NULL) {
-        return -1;
+        return NULL;
     }
     strncpy(new_entry->path_and_name, file_path, sizeof(new_entry->path_and_name));
+    new_entry->next = NULL;
+    new_entry->prev = NULL;
     
     if (list->head == NULL) {
         list->head = new_entry;
+        list->tail = new_entry;
         // printf("File added\n"); debug
         return new_entry;
     }
 
-    files_list_entry_t *temp = list->head;
+    // Entries are mostly added in increasing order, so the insertion point is looked up from the tail
+    files_list_entry_t *temp = list->tail;
     while (temp != NULL) {
-        if (strcmp(temp->path_and_name, file_path) == 0) {
+        int cmp = strcmp(temp->path_and_name, file_path);
+        if (cmp == 0) {
             // printf("File already exists\n"); debug
             free(new_entry);
             return NULL;
-        } else {
-            if (temp->next == NULL || strcmp(temp->next->path_and_name, file_path) > 0) {
-                new_entry->next = temp->next;
-                new_entry->prev = temp;
-                if (temp->next != NULL) {
-                    temp->next->prev = new_entry;
-                }
-                temp->next = new_entry;
-                // debug printf("File added\n");
-                return new_entry;
+        } else if (cmp < 0) {
+            new_entry->next = temp->next;
+            new_entry->prev = temp;
+            if (temp->next != NULL) {
+                temp->next->prev = new_entry;
+            } else {
+                list->tail = new_entry;
             }
+            temp->next = new_entry;
+            // debug printf("File added\n");
+            return new_entry;
         }
-        temp = temp->next;
+        temp = temp->prev;
     }
+    new_entry->next = list->head;
+    list->head->prev = new_entry;
+    list->head = new_entry;
+    return new_entry;
 }
 
 
@@ -75,17 +86,16 @@ files_list_entry_t *add_file_entry(files_list_t *list, char *file_path) {
  */
 int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry) {
     if (list == NULL) {
-        printf("List is NULL\n");
+        LOG_ERROR(LOG_CATEGORY_LIST, "List is NULL\n");
         return -1;
     }
     if (entry == NULL) {
-        printf("Entry is NULL\n");
+        LOG_ERROR(LOG_CATEGORY_LIST, "Entry is NULL\n");
         return -1;
     }
     entry->next = NULL;
     entry->prev = list->tail;
     if (list->head == NULL) {
-        printf("Head is NULL\n");
         list->head = entry;
     } else {
         list->tail->next = entry;
@@ -109,10 +119,10 @@ files_list_entry_t *find_entry_by_name(files_list_t *list, char *file_path, size
         return NULL;
     }
     char *name = file_path + start_of_src;
-    printf("Looking for %s\n", name);
+    LOG_DEBUG(LOG_CATEGORY_LIST, "Looking for %s\n", name);
     files_list_entry_t* cursor = list->head;
     while (cursor != NULL) {
-        printf("Comparing with %s\n", cursor->path_and_name + start_of_dest);
+        LOG_DEBUG(LOG_CATEGORY_LIST, "Comparing with %s\n", cursor->path_and_name + start_of_dest);
         char *cursor_name = cursor->path_and_name + start_of_dest;
         int cmp = strcmp(cursor_name, name);
         if (cmp == 0) {
@@ -136,7 +146,7 @@ void display_files_list(files_list_t *list) {
     }
     
     for (files_list_entry_t *cursor=list->head; cursor!=NULL; cursor=cursor->next) {
-        printf("%s\n", cursor->path_and_name);
+        LOG_INFO(LOG_CATEGORY_LIST, "%s\n", cursor->path_and_name);
     }
 }
 
@@ -151,6 +161,137 @@ void display_files_list_reversed(files_list_t *list) {
     }
     
     for (files_list_entry_t *cursor=list->tail; cursor!=NULL; cursor=cursor->prev) {
-        printf("%s\n", cursor->path_and_name);
+        LOG_INFO(LOG_CATEGORY_LIST, "%s\n", cursor->path_and_name);
+    }
+}
+
+/*!
+ * @brief init_compact_files_list initializes an empty compact files list
+ * @param list is a pointer to the list to initialize
+ * @param root is the root of the tree the entries belong to
+ */
+void init_compact_files_list(compact_files_list_t *list, char *root) {
+    if (list == NULL) {
+        return;
+    }
+    init_path_store(&list->paths);
+    list->properties = NULL;
+    list->properties_capacity = 0;
+    list->root = root;
+}
+
+/*!
+ * @brief add_compact_entry appends an entry to a compact files list
+ * Entries must be appended in strcmp order of their relative paths (@see append_path)
+ * @param list is a pointer to the list
+ * @param relative_path is the path of the entry relative to the root of the list
+ * @param entry is a pointer to the entry whose properties are copied
+ * @return 0 in case of success, -1 else
+ */
+int add_compact_entry(compact_files_list_t *list, char *relative_path, files_list_entry_t *entry) {
+    if (list == NULL || relative_path == NULL || entry == NULL) {
+        return -1;
+    }
+    if (list->paths.count == list->properties_capacity) {
+        size_t capacity = list->properties_capacity == 0 ? 256 : list->properties_capacity * 2;
+        entry_properties_t *properties = realloc(list->properties, capacity * sizeof(entry_properties_t));
+        if (properties == NULL) {
+            return -1;
+        }
+        list->properties = properties;
+        list->properties_capacity = capacity;
+    }
+    entry_properties_t *properties = &list->properties[list->paths.count];
+    if (append_path(&list->paths, relative_path) == -1) {
+        return -1;
+    }
+    properties->mtime = entry->mtime;
+    properties->ctime = entry->ctime;
+    properties->size = entry->size;
+    memcpy(properties->md5sum, entry->md5sum, sizeof(properties->md5sum));
+    properties->entry_type = entry->entry_type;
+    properties->mode = entry->mode;
+    properties->device = entry->device;
+    properties->inode = entry->inode;
+    properties->links = entry->links;
+    return 0;
+}
+
+/*!
+ * @brief make_compact_files_list converts a sorted files list into a compact files list
+ * Entries of the files list are freed as they are converted, so that both forms never coexist entirely in memory.
+ * @param compact is a pointer to the compact list to build
+ * @param list is a pointer to the files list to convert, it is empty afterwards
+ * @param root is the root of the tree the entries belong to
+ * @return 0 in case of success, -1 else
+ */
+int make_compact_files_list(compact_files_list_t *compact, files_list_t *list, char *root) {
+    if (compact == NULL || list == NULL || root == NULL) {
+        return -1;
+    }
+    init_compact_files_list(compact, root);
+    size_t start_of_name = strlen(root) + 1;
+    int result = 0;
+    while (list->head != NULL) {
+        files_list_entry_t *entry = list->head;
+        list->head = entry->next;
+        if (result == 0 && strlen(entry->path_and_name) >= start_of_name) {
+            result = add_compact_entry(compact, entry->path_and_name + start_of_name, entry);
+        }
+        free(entry);
+    }
+    list->tail = NULL;
+    return result;
+}
+
+/*!
+ * @brief fill_entry_from_compact rebuilds the full entry a cursor of a compact files list is on
+ * @param list is a pointer to the compact list
+ * @param cursor is a pointer to a cursor on the paths of the list
+ * @param entry is a pointer to the entry to fill
+ */
+void fill_entry_from_compact(compact_files_list_t *list, path_store_cursor_t *cursor, files_list_entry_t *entry) {
+    entry_properties_t *properties = &list->properties[cursor->index];
+    concat_path(entry->path_and_name, list->root, cursor->path);
+    entry->mtime = properties->mtime;
+    entry->ctime = properties->ctime;
+    entry->size = properties->size;
+    memcpy(entry->md5sum, properties->md5sum, sizeof(entry->md5sum));
+    entry->entry_type = properties->entry_type;
+    entry->mode = properties->mode;
+    entry->device = properties->device;
+    entry->inode = properties->inode;
+    entry->links = properties->links;
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+/*!
+ * @brief display_compact_files_list displays a compact files list (at info level, the list is not walked below)
+ * @param list is the pointer to the list to be displayed
+ */
+void display_compact_files_list(compact_files_list_t *list) {
+    if (!list || !LOG_ENABLED(LOG_LEVEL_INFO, LOG_CATEGORY_LIST)) {
+        return;
+    }
+
+    path_store_cursor_t cursor;
+    start_path_cursor(&cursor, &list->paths);
+    while (next_path(&cursor)) {
+        LOG_INFO(LOG_CATEGORY_LIST, "%s/%s\n", list->root, cursor.path);
+    }
+}
+
+/*!
+ * @brief free_compact_files_list frees the memory of a compact files list
+ * @param list is a pointer to the list
+ */
+void free_compact_files_list(compact_files_list_t *list) {
+    if (list == NULL) {
+        return;
     }
+    free_path_store(&list->paths);
+    free(list->properties);
+    list->properties = NULL;
+    list->properties_capacity = 0;
 }
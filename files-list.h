@@ -4,18 +4,25 @@
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <stdbool.h>
+#include "path-store.h"
 
 typedef enum { FICHIER, DOSSIER } file_type_t;
 
+// The path is the last member, so that messages carrying an entry only send the used part of it
 typedef struct _files_list_entry {
-  char path_and_name[4096];
   struct timespec mtime;
+  struct timespec ctime; // Change time of the inode, set with the metadata of the entry (@see get_file_metadata)
   uint64_t size;
   uint8_t md5sum[16];
   file_type_t entry_type;
   mode_t mode;
+  dev_t device; // Device holding the entry (st_dev), used to schedule its analysis
+  ino_t inode;
+  nlink_t links; // Number of hard links of the inode
   struct _files_list_entry *next;
   struct _files_list_entry *prev;
+  char path_and_name[4096];
 } files_list_entry_t;
 
 typedef struct {
@@ -23,9 +30,36 @@ typedef struct {
   struct _files_list_entry *tail;
 } files_list_t;
 
+// Properties of an entry, without its path (@see compact_files_list_t)
+typedef struct {
+  struct timespec mtime;
+  struct timespec ctime;
+  uint64_t size;
+  uint8_t md5sum[16];
+  file_type_t entry_type;
+  mode_t mode;
+  dev_t device;
+  ino_t inode;
+  nlink_t links;
+} entry_properties_t;
+
+// Sorted files list whose paths (relative to root) are front-coded
+typedef struct {
+  path_store_t paths;
+  entry_properties_t *properties; // Properties of the entries, in the order of paths
+  size_t properties_capacity;
+  char *root;
+} compact_files_list_t;
+
 void clear_files_list(files_list_t *list);
 files_list_entry_t *add_file_entry(files_list_t *list, char *file_path);
 int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry);
 files_list_entry_t *find_entry_by_name(files_list_t *list, char *file_path, size_t start_of_src, size_t start_of_dest);
 void display_files_list(files_list_t *list);
 void display_files_list_reversed(files_list_t *list);
+void init_compact_files_list(compact_files_list_t *list, char *root);
+int add_compact_entry(compact_files_list_t *list, char *relative_path, files_list_entry_t *entry);
+int make_compact_files_list(compact_files_list_t *compact, files_list_t *list, char *root);
+void display_compact_files_list(compact_files_list_t *list);
+void fill_entry_from_compact(compact_files_list_t *list, path_store_cursor_t *cursor, files_list_entry_t *entry);
+void free_compact_files_list(compact_files_list_t *list);
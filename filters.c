@@ -0,0 +1,377 @@
+#include "filters.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+#include "log.h"
+
+// Rules are compiled into three sets, each keeping the order of its rules:
+// - names: patterns without wildcards (node_modules, .git/), found by binary search on the entry name
+// - suffixes: a star followed by a literal (*.tmp, *~), found by binary search on the suffixes of the entry name of
+//   each length used by a rule
+// - globs: the other patterns, matched one by one in their order, until a rule that comes earlier was found
+// The first rule matching an entry, over the three sets, decides. Entries no rule matches are included.
+// Rules are compiled in the main process before the fork, so that the listers share them.
+
+static filter_rule_t *rules = NULL;
+static size_t rules_count = 0;
+static size_t rules_capacity = 0;
+static filter_rule_t *names = NULL;
+static size_t names_count = 0;
+static filter_rule_t *suffixes = NULL;
+static size_t suffixes_count = 0;
+static size_t suffix_lengths[64]; // Distinct lengths of the suffixes, ascending (rules with other lengths are globs)
+static size_t suffix_lengths_count = 0;
+static filter_rule_t *globs = NULL;
+static size_t globs_count = 0;
+
+/*!
+ * @brief has_wildcards tells if a pattern has glob wildcards
+ * @param pattern is the pattern
+ * @return true if it has *, ?, [ or \, false else
+ */
+static bool has_wildcards(char *pattern) {
+    return strpbrk(pattern, "*?[\\") != NULL;
+}
+
+/*!
+ * @brief add_filter_rule appends a rule to the filters (@see compile_filters)
+ * A pattern with a leading or inner / is matched against the path relative to the root of the tree, other patterns
+ * against the name of the entry. A pattern with a trailing / only matches directories.
+ * @param pattern is the glob
+ * @param exclude is true to exclude the matching entries, false to include them
+ * @return 0 in case of success, -1 else
+ */
+int add_filter_rule(char *pattern, bool exclude) {
+    size_t length = strlen(pattern);
+    bool directories_only = length > 1 && pattern[length - 1] == '/';
+    if (directories_only) {
+        --length;
+    }
+    bool anchored = pattern[0] == '/';
+    if (anchored) {
+        ++pattern;
+        --length;
+    }
+    if (length == 0) {
+        fprintf(stderr, "Empty filter pattern\n");
+        return -1;
+    }
+    if (rules_count == rules_capacity) {
+        size_t capacity = rules_capacity == 0 ? 16 : 2 * rules_capacity;
+        filter_rule_t *grown = realloc(rules, capacity * sizeof(filter_rule_t));
+        if (grown == NULL) {
+            return -1;
+        }
+        rules = grown;
+        rules_capacity = capacity;
+    }
+    char *copy = strndup(pattern, length);
+    if (copy == NULL) {
+        return -1;
+    }
+    anchored = anchored || strchr(copy, '/') != NULL;
+    rules[rules_count] = (filter_rule_t) {copy, length, (int) rules_count, exclude, directories_only, anchored};
+    ++rules_count;
+    return 0;
+}
+
+/*!
+ * @brief load_filter_file appends the rules of a filter file, one per line
+ * Lines are "+ pattern" to include, "- pattern" or "pattern" to exclude. Empty lines and lines starting with # are
+ * ignored.
+ * @param path is the path of the file
+ * @return 0 in case of success, -1 else
+ */
+int load_filter_file(char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("Failed to open filter file");
+        return -1;
+    }
+    char line[4096];
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        if ((line[0] == '+' || line[0] == '-') && line[1] == ' ') {
+            result = add_filter_rule(line + 2, line[0] == '-');
+        } else {
+            result = add_filter_rule(line, true);
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+/*!
+ * @brief compare_rules_by_name orders rules by pattern, then by order (for qsort)
+ */
+static int compare_rules_by_name(const void *lhs, const void *rhs) {
+    const filter_rule_t *left = lhs, *right = rhs;
+    int names_order = strcmp(left->pattern, right->pattern);
+    return names_order != 0 ? names_order : left->order - right->order;
+}
+
+/*!
+ * @brief compare_rules_by_suffix orders rules by length, then by pattern, then by order (for qsort)
+ */
+static int compare_rules_by_suffix(const void *lhs, const void *rhs) {
+    const filter_rule_t *left = lhs, *right = rhs;
+    if (left->length != right->length) {
+        return left->length < right->length ? -1 : 1;
+    }
+    return compare_rules_by_name(lhs, rhs);
+}
+
+/*!
+ * @brief compile_filters builds the matcher from the rules added so far, it must be called before the fork
+ */
+void compile_filters(void) {
+    free(names);
+    free(suffixes);
+    free(globs);
+    names = malloc((rules_count + 1) * sizeof(filter_rule_t));
+    suffixes = malloc((rules_count + 1) * sizeof(filter_rule_t));
+    globs = malloc((rules_count + 1) * sizeof(filter_rule_t));
+    if (names == NULL || suffixes == NULL || globs == NULL) {
+        fprintf(stderr, "Failed to allocate memory for filters\n");
+        exit(-1);
+    }
+    names_count = suffixes_count = globs_count = suffix_lengths_count = 0;
+    for (size_t i = 0; i < rules_count; ++i) {
+        filter_rule_t rule = rules[i];
+        if (rule.anchored) {
+            globs[globs_count++] = rule;
+        } else if (!has_wildcards(rule.pattern)) {
+            names[names_count++] = rule;
+        } else if (rule.pattern[0] == '*' && !has_wildcards(rule.pattern + 1)) {
+            size_t length = rule.length - 1;
+            size_t known = 0;
+            while (known < suffix_lengths_count && suffix_lengths[known] != length) {
+                ++known;
+            }
+            if (known == suffix_lengths_count && suffix_lengths_count == sizeof(suffix_lengths) / sizeof(suffix_lengths[0])) {
+                globs[globs_count++] = rule;
+                continue;
+            }
+            if (known == suffix_lengths_count) {
+                suffix_lengths[suffix_lengths_count++] = length;
+            }
+            rule.pattern = rule.pattern + 1;
+            rule.length = length;
+            suffixes[suffixes_count++] = rule;
+        } else {
+            globs[globs_count++] = rule;
+        }
+    }
+    qsort(names, names_count, sizeof(filter_rule_t), compare_rules_by_suffix);
+    qsort(suffixes, suffixes_count, sizeof(filter_rule_t), compare_rules_by_suffix);
+    for (size_t i = 1; i < suffix_lengths_count; ++i) {
+        for (size_t j = i; j > 0 && suffix_lengths[j - 1] > suffix_lengths[j]; --j) {
+            size_t length = suffix_lengths[j];
+            suffix_lengths[j] = suffix_lengths[j - 1];
+            suffix_lengths[j - 1] = length;
+        }
+    }
+}
+
+/*!
+ * @brief has_filters tells if filter rules were given
+ * @return true if there is at least one rule, false else
+ */
+bool has_filters(void) {
+    return rules_count > 0;
+}
+
+/*!
+ * @brief match_class matches a character against a bracket expression ([abc], [a-z], [!a-z])
+ * @param pattern points to the opening [
+ * @param c is the character to match
+ * @param matched is set to true if c is in the class
+ * @return the length of the expression, 0 if it is not closed (the [ is then a literal)
+ */
+static size_t match_class(const char *pattern, char c, bool *matched) {
+    size_t i = 1;
+    bool negated = pattern[i] == '!' || pattern[i] == '^';
+    if (negated) {
+        ++i;
+    }
+    size_t first = i;
+    bool found = false;
+    while (pattern[i] != '\0' && (pattern[i] != ']' || i == first)) {
+        char low = pattern[i], high = pattern[i];
+        if (pattern[i + 1] == '-' && pattern[i + 2] != ']' && pattern[i + 2] != '\0') {
+            high = pattern[i + 2];
+            i += 3;
+        } else {
+            ++i;
+        }
+        found = found || (c >= low && c <= high);
+    }
+    if (pattern[i] != ']') {
+        return 0;
+    }
+    *matched = found != negated && c != '/';
+    return i + 1;
+}
+
+/*!
+ * @brief match_glob matches a text against a glob
+ * * and ? do not match /, ** matches any sequence, and ** followed by / also matches no directory at all.
+ * @param pattern is the glob
+ * @param text is the text to match
+ * @return true if the whole text matches, false else
+ */
+static bool match_glob(const char *pattern, const char *text) {
+    while (*pattern != '\0') {
+        if (*pattern == '*') {
+            bool crosses_directories = pattern[1] == '*';
+            pattern += crosses_directories ? 2 : 1;
+            if (crosses_directories && *pattern == '/' && match_glob(pattern + 1, text)) {
+                return true;
+            }
+            for (;; ++text) {
+                if (match_glob(pattern, text)) {
+                    return true;
+                }
+                if (*text == '\0' || (!crosses_directories && *text == '/')) {
+                    return false;
+                }
+            }
+        }
+        if (*text == '\0') {
+            return false;
+        }
+        size_t class_length = 0;
+        bool matched = false;
+        if (*pattern == '[' && (class_length = match_class(pattern, *text, &matched)) > 0) {
+            if (!matched) {
+                return false;
+            }
+            pattern += class_length;
+            ++text;
+            continue;
+        }
+        if (*pattern == '\\' && pattern[1] != '\0') {
+            ++pattern;
+        } else if (*pattern == '?') {
+            if (*text == '/') {
+                return false;
+            }
+            ++pattern;
+            ++text;
+            continue;
+        }
+        if (*pattern != *text) {
+            return false;
+        }
+        ++pattern;
+        ++text;
+    }
+    return *text == '\0';
+}
+
+/*!
+ * @brief first_matching_rule finds the earliest rule of a sorted set whose pattern equals a key
+ * @param set is the set, sorted by length, pattern and order (@see compare_rules_by_suffix)
+ * @param count is the number of rules of the set
+ * @param key is the key, of length bytes
+ * @param length is the length of the key
+ * @param is_directory tells that the entry is a directory
+ * @return a pointer to the rule, NULL if none matches
+ */
+static filter_rule_t *first_matching_rule(filter_rule_t *set, size_t count, const char *key, size_t length, bool is_directory) {
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int order = set[middle].length != length ? (set[middle].length < length ? -1 : 1) : strcmp(set[middle].pattern, key);
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    for (; low < count && set[low].length == length && strcmp(set[low].pattern, key) == 0; ++low) {
+        if (!set[low].directories_only || is_directory) {
+            return &set[low];
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief is_path_excluded tells if an entry is excluded by the filters
+ * @param relative_path is the path of the entry relative to the root of its tree
+ * @param name is the name of the entry (the last component of relative_path)
+ * @param is_directory tells that the entry is a directory
+ * @return true if the first matching rule excludes the entry, false if it includes it or no rule matches it
+ */
+bool is_path_excluded(char *relative_path, char *name, bool is_directory) {
+    if (rules_count == 0) {
+        return false;
+    }
+    size_t name_length = strlen(name);
+    filter_rule_t *decision = first_matching_rule(names, names_count, name, name_length, is_directory);
+    for (size_t i = 0; i < suffix_lengths_count && suffix_lengths[i] <= name_length; ++i) {
+        filter_rule_t *rule = first_matching_rule(suffixes, suffixes_count, name + name_length - suffix_lengths[i], suffix_lengths[i], is_directory);
+        if (rule != NULL && (decision == NULL || rule->order < decision->order)) {
+            decision = rule;
+        }
+    }
+    for (size_t i = 0; i < globs_count && (decision == NULL || globs[i].order < decision->order); ++i) {
+        if ((!globs[i].directories_only || is_directory) && match_glob(globs[i].pattern, globs[i].anchored ? relative_path : name)) {
+            decision = &globs[i];
+        }
+    }
+    return decision != NULL && decision->exclude;
+}
+
+/*!
+ * @brief root_prefix_length gives the length of the prefix to skip in the paths of a tree to get their relative path
+ * @param root is the root of the tree
+ * @return the length of the root and of the / that follows it
+ */
+size_t root_prefix_length(char *root) {
+    size_t length = strlen(root);
+    return length > 0 && root[length - 1] == '/' ? length : length + 1;
+}
+
+/*!
+ * @brief is_entry_excluded tells if an entry met while listing a tree is excluded, and counts it in the statistics
+ * An excluded directory is not opened, so that its content is pruned from the walk.
+ * @param path is the path of the entry
+ * @param prefix_length is the length of the root of the tree in path (@see root_prefix_length)
+ * @param name is the name of the entry
+ * @param is_directory tells that the entry is a directory
+ * @return true if the entry must be skipped, false else
+ */
+bool is_entry_excluded(char *path, size_t prefix_length, char *name, bool is_directory) {
+    if (rules_count == 0 || !is_path_excluded(path + prefix_length, name, is_directory)) {
+        return false;
+    }
+    if (is_directory) {
+        ++process_stats.pruned_directories;
+    } else {
+        ++process_stats.filtered_files;
+    }
+    LOG_DEBUG(LOG_CATEGORY_LIST, "%s is excluded by the filters\n", path);
+    return true;
+}
+
+/*!
+ * @brief clear_filters frees the rules and the matcher
+ */
+void clear_filters(void) {
+    for (size_t i = 0; i < rules_count; ++i) {
+        free(rules[i].pattern);
+    }
+    free(rules);
+    free(names);
+    free(suffixes);
+    free(globs);
+    rules = names = suffixes = globs = NULL;
+    rules_count = rules_capacity = names_count = suffixes_count = globs_count = suffix_lengths_count = 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A filter rule, in the order of the command line: the first rule matching an entry decides if it is excluded
+typedef struct {
+    char *pattern; // Glob (*, **, ?, [...]), without its leading and trailing /
+    size_t length; // Length of the pattern, of the suffix for the *suffix rules
+    int order; // Index of the rule
+    bool exclude;
+    bool directories_only; // The pattern ended with /
+    bool anchored; // The pattern has a /, it is matched against the path relative to the root instead of the name
+} filter_rule_t;
+
+int add_filter_rule(char *pattern, bool exclude);
+int load_filter_file(char *path);
+void compile_filters(void);
+bool has_filters(void);
+bool is_path_excluded(char *relative_path, char *name, bool is_directory);
+size_t root_prefix_length(char *root);
+bool is_entry_excluded(char *path, size_t prefix_length, char *name, bool is_directory);
+void clear_filters(void);
@@ -0,0 +1,209 @@
+#include "inodes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static inodes_table_t *inodes_table = NULL;
+
+/*!
+ * @brief inode_hash mixes a device and an inode number into a table index
+ * @param device is the device of the inode
+ * @param inode is the inode number
+ * @param mask is the size of the table minus one
+ * @return the first slot to probe
+ */
+static size_t inode_hash(dev_t device, ino_t inode, size_t mask) {
+    uint64_t hash = ((uint64_t) inode ^ ((uint64_t) device << 32)) * 0x9E3779B97F4A7C15ULL;
+    return (hash >> 32) & mask;
+}
+
+/*!
+ * @brief init_inodes_table maps the digests table, it must be called before the analyzers are forked
+ * Pages of the mapping are only allocated when slots are used.
+ * @param size is the number of slots of the table (a power of 2)
+ * @param all_files tells to cache the digests of all the files (daemon mode), not only of the files with several links
+ * @return true if digests are shared, false else
+ */
+bool init_inodes_table(size_t size, bool all_files) {
+    size_t length = sizeof(inodes_table_t) + size * sizeof(inode_slot_t);
+    inodes_table_t *table = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (table == MAP_FAILED) {
+        perror("Failed to map inodes table");
+        return false;
+    }
+    table->all_files = all_files;
+    table->size = size;
+    inodes_table = table;
+    return true;
+}
+
+/*!
+ * @brief is_digest_cached tells if the digest of a file goes through the digests table
+ * @param entry is a pointer to the entry of the file
+ * @return true if the file has several links or all the digests are cached, false else
+ */
+bool is_digest_cached(files_list_entry_t *entry) {
+    return inodes_table != NULL && (inodes_table->all_files || entry->links > 1);
+}
+
+/*!
+ * @brief is_slot_current tells if the digest of a slot matches the current version of an entry
+ * @param slot is a pointer to the slot
+ * @param entry is a pointer to the entry
+ * @return true if the size, mtime and ctime of the slot are those of the entry
+ */
+static bool is_slot_current(inode_slot_t *slot, files_list_entry_t *entry) {
+    return slot->size == entry->size && slot->mtime.tv_sec == entry->mtime.tv_sec && slot->mtime.tv_nsec == entry->mtime.tv_nsec
+        && slot->ctime.tv_sec == entry->ctime.tv_sec && slot->ctime.tv_nsec == entry->ctime.tv_nsec;
+}
+
+/*!
+ * @brief reserve_inode_digest looks up the digest of the inode of an entry, or reserves its computation
+ * When another process is hashing the inode, it waits for its digest. The digest of an inode that changed since it
+ * was computed is computed again.
+ * @param entry is a pointer to the entry, its device, inode, size, mtime and ctime must be set
+ * @return INODE_DIGEST_KNOWN if the digest was copied to the entry, the slot to publish the digest to once computed
+ * (@see publish_inode_digest), -1 if the caller must hash the file without publishing (table disabled or full)
+ */
+int reserve_inode_digest(files_list_entry_t *entry) {
+    if (inodes_table == NULL) {
+        return -1;
+    }
+    size_t mask = inodes_table->size - 1;
+    while (true) {
+        size_t index = inode_hash(entry->device, entry->inode, mask);
+        inode_slot_t *slot = NULL;
+        int claimed = -1;
+        while (__atomic_test_and_set(&inodes_table->lock, __ATOMIC_ACQUIRE));
+        for (size_t probe = 0; probe < inodes_table->size; ++probe, index = (index + 1) & mask) {
+            inode_slot_t *candidate = &inodes_table->slots[index];
+            if (candidate->state == INODE_EMPTY || (candidate->device == entry->device && candidate->inode == entry->inode)) {
+                slot = candidate;
+                break;
+            }
+        }
+        if (slot != NULL && (slot->state == INODE_EMPTY
+                             || (slot->state != INODE_HASHING && (slot->state == INODE_FAILED || !is_slot_current(slot, entry))))) {
+            // New inode, or renewal of a stale digest
+            slot->device = entry->device;
+            slot->inode = entry->inode;
+            slot->mtime = entry->mtime;
+            slot->ctime = entry->ctime;
+            slot->size = entry->size;
+            __atomic_store_n(&slot->state, INODE_HASHING, __ATOMIC_RELEASE);
+            claimed = (int) index;
+        }
+        __atomic_clear(&inodes_table->lock, __ATOMIC_RELEASE);
+        if (slot == NULL || claimed != -1) {
+            return claimed;
+        }
+        int state;
+        while ((state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE)) == INODE_HASHING) {
+            usleep(1000);
+        }
+        if (state == INODE_HASHED && is_slot_current(slot, entry)) {
+            memcpy(entry->md5sum, slot->md5sum, sizeof(entry->md5sum));
+            return INODE_DIGEST_KNOWN;
+        }
+    }
+}
+
+/*!
+ * @brief publish_inode_digest ends the computation of a digest reserved with reserve_inode_digest
+ * @param slot is the slot returned by reserve_inode_digest
+ * @param entry is a pointer to the entry whose digest was computed
+ * @param hashed is false when the hash failed, so that waiting processes hash the file themselves
+ */
+void publish_inode_digest(int slot, files_list_entry_t *entry, bool hashed) {
+    if (inodes_table == NULL || slot < 0 || (size_t) slot >= inodes_table->size) {
+        return;
+    }
+    inode_slot_t *inode_slot = &inodes_table->slots[slot];
+    memcpy(inode_slot->md5sum, entry->md5sum, sizeof(inode_slot->md5sum));
+    __atomic_store_n(&inode_slot->state, hashed ? INODE_HASHED : INODE_FAILED, __ATOMIC_RELEASE);
+}
+
+/*!
+ * @brief init_links_map initializes an empty links map
+ * @param map is a pointer to the map
+ */
+void init_links_map(links_map_t *map) {
+    map->slots = NULL;
+    map->capacity = 0;
+    map->count = 0;
+}
+
+/*!
+ * @brief find_linked_copy looks up the destination the inode of a source entry was already copied to
+ * @param map is a pointer to the map
+ * @param entry is a pointer to the source entry
+ * @return the path of the copy, NULL if the inode was not copied yet
+ */
+char *find_linked_copy(links_map_t *map, files_list_entry_t *entry) {
+    if (map->capacity == 0) {
+        return NULL;
+    }
+    size_t mask = map->capacity - 1;
+    for (size_t index = inode_hash(entry->device, entry->inode, mask); map->slots[index].destination != NULL; index = (index + 1) & mask) {
+        if (map->slots[index].device == entry->device && map->slots[index].inode == entry->inode) {
+            return map->slots[index].destination;
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief add_linked_copy records the destination the inode of a source entry was copied to
+ * The map is kept at most half full.
+ * @param map is a pointer to the map
+ * @param entry is a pointer to the source entry (whose inode is not in the map yet)
+ * @param destination is the path of the copy
+ * @return 0 in case of success, -1 else (out of memory)
+ */
+int add_linked_copy(links_map_t *map, files_list_entry_t *entry, char *destination) {
+    if (2 * (map->count + 1) > map->capacity) {
+        size_t capacity = map->capacity == 0 ? 1024 : 2 * map->capacity;
+        linked_copy_t *slots = calloc(capacity, sizeof(linked_copy_t));
+        if (slots == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < map->capacity; ++i) {
+            if (map->slots[i].destination != NULL) {
+                size_t index = inode_hash(map->slots[i].device, map->slots[i].inode, capacity - 1);
+                while (slots[index].destination != NULL) {
+                    index = (index + 1) & (capacity - 1);
+                }
+                slots[index] = map->slots[i];
+            }
+        }
+        free(map->slots);
+        map->slots = slots;
+        map->capacity = capacity;
+    }
+    char *copy = strdup(destination);
+    if (copy == NULL) {
+        return -1;
+    }
+    size_t mask = map->capacity - 1;
+    size_t index = inode_hash(entry->device, entry->inode, mask);
+    while (map->slots[index].destination != NULL) {
+        index = (index + 1) & mask;
+    }
+    map->slots[index] = (linked_copy_t) {entry->device, entry->inode, copy};
+    ++map->count;
+    return 0;
+}
+
+/*!
+ * @brief free_links_map frees the memory of a links map
+ * @param map is a pointer to the map
+ */
+void free_links_map(links_map_t *map) {
+    for (size_t i = 0; i < map->capacity; ++i) {
+        free(map->slots[i].destination);
+    }
+    free(map->slots);
+    init_links_map(map);
+}
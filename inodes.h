@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+#include "files-list.h"
+
+#define INODES_TABLE_SIZE (1 << 16) // Slots of the digests table (a power of 2)
+#define INODES_DAEMON_TABLE_SIZE (1 << 20) // Slots of the digests table of a daemon, that caches all the files
+#define INODE_DIGEST_KNOWN -2 // @see reserve_inode_digest
+
+typedef enum {INODE_EMPTY, INODE_HASHING, INODE_HASHED, INODE_FAILED} inode_state_t;
+
+// Digest of an inode, valid as long as its size, mtime and ctime do not change (the mtime can be set back by utimes,
+// the ctime cannot)
+typedef struct {
+    int state; // inode_state_t
+    dev_t device;
+    ino_t inode;
+    struct timespec mtime;
+    struct timespec ctime;
+    uint64_t size;
+    uint8_t md5sum[16];
+} inode_slot_t;
+
+// Lives in a shared mapping created before the fork, so that each inode is hashed once by all the processes
+typedef struct {
+    int lock; // Protects the registration and the renewal of slots
+    bool all_files; // Cache the digests of all the files, not only of the files with several links
+    size_t size; // Number of slots (a power of 2)
+    inode_slot_t slots[];
+} inodes_table_t;
+
+// Destination of the first copy of each inode with several links, in the main process (@see find_linked_copy)
+typedef struct {
+    dev_t device;
+    ino_t inode;
+    char *destination; // NULL for an empty slot
+} linked_copy_t;
+
+typedef struct {
+    linked_copy_t *slots;
+    size_t capacity; // A power of 2
+    size_t count;
+} links_map_t;
+
+bool init_inodes_table(size_t size, bool all_files);
+bool is_digest_cached(files_list_entry_t *entry);
+int reserve_inode_digest(files_list_entry_t *entry);
+void publish_inode_digest(int slot, files_list_entry_t *entry, bool hashed);
+void init_links_map(links_map_t *map);
+char *find_linked_copy(links_map_t *map, files_list_entry_t *entry);
+int add_linked_copy(links_map_t *map, files_list_entry_t *entry, char *destination);
+void free_links_map(links_map_t *map);
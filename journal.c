@@ -0,0 +1,279 @@
+#include "journal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "inodes.h"
+#include "defines.h"
+#include "log.h"
+#include "stats.h"
+
+// The journal is an append-only text file written by the main process, one record per line:
+//     D <device> <inode> <size> <mtime sec> <mtime nsec> <ctime sec> <ctime nsec> <md5>   digest of a file (source,
+//                                                                                          destination or copy)
+//     S <size> <mtime sec> <mtime nsec> <destination>            copy started, with the size and mtime of its source
+//     C <destination>                                            copy done
+// A restarted run loads the digests into the digests table before forking (@see reserve_inode_digest), so that
+// only the files that changed are hashed again, and resumes the copies that were started and not done.
+// A line cut by an interruption has no end of line and is ignored.
+
+static FILE *journal = NULL;
+static char journal_path[1024];
+static bool journal_digests = false; // Digests are only journaled when MD5 sums are computed
+static int unflushed_records = 0;
+static uint64_t last_flush_ns = 0;
+static started_copy_t *started_copies = NULL;
+static size_t started_copies_count = 0;
+static size_t started_copies_capacity = 0;
+
+/*!
+ * @brief flush_journal_record counts an appended record and flushes the journal when needed
+ * Records are flushed by batches, and at least every JOURNAL_FLUSH_NS, so that slow digests of large files are kept.
+ * @param now tells to flush immediately
+ */
+static void flush_journal_record(bool now) {
+    uint64_t now_ns = stats_now();
+    if (now || ++unflushed_records >= JOURNAL_FLUSH_RECORDS || now_ns - last_flush_ns >= JOURNAL_FLUSH_NS) {
+        fflush(journal);
+        unflushed_records = 0;
+        last_flush_ns = now_ns;
+    }
+}
+
+/*!
+ * @brief forget_started_copy removes a copy from the started copies
+ * @param destination is the destination of the copy
+ */
+static void forget_started_copy(char *destination) {
+    for (size_t i = 0; i < started_copies_count; ++i) {
+        if (strcmp(started_copies[i].destination, destination) == 0) {
+            free(started_copies[i].destination);
+            started_copies[i] = started_copies[--started_copies_count];
+            return;
+        }
+    }
+}
+
+/*!
+ * @brief remember_started_copy adds a copy to the started copies (replacing a previous start of the same copy)
+ * @param destination is the destination of the copy
+ * @param size is the size of its source
+ * @param mtime is the mtime of its source
+ */
+static void remember_started_copy(char *destination, uint64_t size, struct timespec mtime) {
+    forget_started_copy(destination);
+    if (started_copies_count == started_copies_capacity) {
+        size_t capacity = started_copies_capacity == 0 ? 16 : 2 * started_copies_capacity;
+        started_copy_t *copies = realloc(started_copies, capacity * sizeof(started_copy_t));
+        if (copies == NULL) {
+            return;
+        }
+        started_copies = copies;
+        started_copies_capacity = capacity;
+    }
+    char *copy = strdup(destination);
+    if (copy != NULL) {
+        started_copies[started_copies_count++] = (started_copy_t) {copy, size, mtime};
+    }
+}
+
+/*!
+ * @brief replay_journal loads the records of the journal of an interrupted run
+ * @param stream is the journal, opened for reading
+ * @return the number of loaded records, -1 if the file is not a journal
+ */
+static int replay_journal(FILE *stream) {
+    static char line[PATH_SIZE + 128];
+    if (fgets(line, sizeof(line), stream) == NULL || strncmp(line, JOURNAL_MAGIC "\n", sizeof(JOURNAL_MAGIC)) != 0) {
+        return -1;
+    }
+    int records = 0;
+    files_list_entry_t entry;
+    while (fgets(line, sizeof(line), stream) != NULL) {
+        size_t length = strlen(line);
+        if (length == 0 || line[length - 1] != '\n') {
+            break;
+        }
+        line[length - 1] = '\0';
+        unsigned long long device, inode, size;
+        long long seconds, nanoseconds, change_seconds, change_nanoseconds;
+        char md5[33];
+        int path_start = 0;
+        if (line[0] == 'D' && sscanf(line, "D %llu %llu %llu %lld %lld %lld %lld %32s", &device, &inode, &size, &seconds, &nanoseconds,
+                                     &change_seconds, &change_nanoseconds, md5) == 8) {
+            entry.device = device;
+            entry.inode = inode;
+            entry.size = size;
+            entry.mtime.tv_sec = seconds;
+            entry.mtime.tv_nsec = nanoseconds;
+            entry.ctime.tv_sec = change_seconds;
+            entry.ctime.tv_nsec = change_nanoseconds;
+            for (int i = 0; i < 16; ++i) {
+                unsigned int byte;
+                sscanf(md5 + 2 * i, "%2x", &byte);
+                entry.md5sum[i] = byte;
+            }
+            int slot = reserve_inode_digest(&entry);
+            if (slot >= 0) {
+                publish_inode_digest(slot, &entry, true);
+            }
+        } else if (line[0] == 'S' && sscanf(line, "S %llu %lld %lld %n", &size, &seconds, &nanoseconds, &path_start) == 3 && path_start > 0) {
+            remember_started_copy(line + path_start, size, (struct timespec) {seconds, nanoseconds});
+        } else if (line[0] == 'C' && line[1] == ' ') {
+            forget_started_copy(line + 2);
+        } else {
+            continue;
+        }
+        ++records;
+    }
+    return records;
+}
+
+/*!
+ * @brief open_journal loads the journal of an interrupted run, if any, and opens the journal for appending
+ * It must be called after the digests table is initialized and before the analyzers are forked.
+ * @param the_config is a pointer to the configuration, with the path of the journal
+ * @return true if the journal is open, false else
+ */
+bool open_journal(configuration_t *the_config) {
+    strncpy(journal_path, the_config->journal, sizeof(journal_path) - 1);
+    journal_path[sizeof(journal_path) - 1] = '\0';
+    journal_digests = the_config->uses_md5;
+    bool reset = false;
+    FILE *previous = fopen(journal_path, "r");
+    if (previous != NULL) {
+        int records = replay_journal(previous);
+        fclose(previous);
+        if (records == -1) {
+            LOG_WARNING(LOG_CATEGORY_CONFIG, "%s is not a journal, it is replaced\n", journal_path);
+            reset = true;
+        } else {
+            LOG_INFO(LOG_CATEGORY_CONFIG, "Resuming from %s: %d records, %lu copies to resume\n", journal_path, records, started_copies_count);
+        }
+    }
+    if ((journal = fopen(journal_path, reset ? "w" : "a")) == NULL) {
+        perror("Failed to open the journal");
+        return false;
+    }
+    if (ftell(journal) == 0) {
+        fprintf(journal, "%s\n", JOURNAL_MAGIC);
+        flush_journal_record(true);
+    }
+    return true;
+}
+
+/*!
+ * @brief is_journal_open tells if the run is journaled
+ * @return true if the journal is open, false else
+ */
+bool is_journal_open(void) {
+    return journal != NULL;
+}
+
+/*!
+ * @brief journal_digest appends the digest of a file to the journal
+ * @param entry is a pointer to the entry of the file, as analyzed
+ */
+void journal_digest(files_list_entry_t *entry) {
+    if (journal == NULL || !journal_digests || entry->entry_type != FICHIER) {
+        return;
+    }
+    fprintf(journal, "D %llu %llu %llu %lld %lld %lld %lld ", (unsigned long long) entry->device, (unsigned long long) entry->inode,
+            (unsigned long long) entry->size, (long long) entry->mtime.tv_sec, (long long) entry->mtime.tv_nsec,
+            (long long) entry->ctime.tv_sec, (long long) entry->ctime.tv_nsec);
+    for (int i = 0; i < 16; ++i) {
+        fprintf(journal, "%02x", entry->md5sum[i]);
+    }
+    fputc('\n', journal);
+    flush_journal_record(false);
+}
+
+/*!
+ * @brief journal_copy_started appends the start of a copy to the journal, before any data is written
+ * @param source_entry is a pointer to the source entry
+ * @param destination is the path of the destination file
+ */
+void journal_copy_started(files_list_entry_t *source_entry, char *destination) {
+    if (journal == NULL) {
+        return;
+    }
+    fprintf(journal, "S %llu %lld %lld %s\n", (unsigned long long) source_entry->size, (long long) source_entry->mtime.tv_sec,
+            (long long) source_entry->mtime.tv_nsec, destination);
+    flush_journal_record(true);
+}
+
+/*!
+ * @brief journal_copy_done appends the end of a copy to the journal, with the digest of the copy
+ * @param source_entry is a pointer to the source entry
+ * @param destination is the path of the destination file
+ */
+void journal_copy_done(files_list_entry_t *source_entry, char *destination) {
+    if (journal == NULL) {
+        return;
+    }
+    fprintf(journal, "C %s\n", destination);
+    struct stat sb;
+    if (lstat(destination, &sb) == 0) {
+        files_list_entry_t *copy = malloc(sizeof(files_list_entry_t));
+        if (copy != NULL) {
+            memcpy(copy, source_entry, sizeof(files_list_entry_t));
+            copy->device = sb.st_dev;
+            copy->inode = sb.st_ino;
+            copy->size = sb.st_size;
+            copy->mtime = sb.st_mtim;
+            copy->ctime = sb.st_ctim;
+            journal_digest(copy);
+            free(copy);
+        }
+    }
+    flush_journal_record(true);
+}
+
+/*!
+ * @brief resumable_copy_offset tells where a copy interrupted by a previous run can be resumed
+ * A copy is resumed if the journal tells it started from the same version of its source, and its partial file is
+ * not larger than the source.
+ * @param source_entry is a pointer to the source entry
+ * @param destination is the path of the destination file
+ * @param partial is the path of the partial file the copy is written to
+ * @return the size of the partial file to keep, 0 to copy from the start
+ */
+off_t resumable_copy_offset(files_list_entry_t *source_entry, char *destination, char *partial) {
+    for (size_t i = 0; i < started_copies_count; ++i) {
+        started_copy_t *copy = &started_copies[i];
+        if (strcmp(copy->destination, destination) != 0) {
+            continue;
+        }
+        struct stat sb;
+        if (copy->size != source_entry->size || copy->mtime.tv_sec != source_entry->mtime.tv_sec
+            || copy->mtime.tv_nsec != source_entry->mtime.tv_nsec || lstat(partial, &sb) == -1
+            || !S_ISREG(sb.st_mode) || (uint64_t) sb.st_size > source_entry->size) {
+            return 0;
+        }
+        return sb.st_size;
+    }
+    return 0;
+}
+
+/*!
+ * @brief close_journal closes the journal, and removes it once the synchronization completed
+ * @param completed tells that the synchronization completed, so that there is nothing to resume
+ */
+void close_journal(bool completed) {
+    if (journal == NULL) {
+        return;
+    }
+    fclose(journal);
+    journal = NULL;
+    if (completed) {
+        unlink(journal_path);
+    }
+    for (size_t i = 0; i < started_copies_count; ++i) {
+        free(started_copies[i].destination);
+    }
+    free(started_copies);
+    started_copies = NULL;
+    started_copies_count = 0;
+    started_copies_capacity = 0;
+}
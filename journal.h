@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "files-list.h"
+#include "configuration.h"
+
+#define JOURNAL_MAGIC "PRGJOURNAL1"
+#define JOURNAL_FLUSH_RECORDS 256 // Records appended between two flushes of the journal, at most
+#define JOURNAL_FLUSH_NS 1000000000 // Time between two flushes of the journal, at most
+#define JOURNAL_PARTIAL_SUFFIX ".prg-partial" // Suffix of the files being copied
+
+// Copy started by an interrupted run, that may be resumed if its source did not change
+typedef struct {
+    char *destination;
+    uint64_t size; // Size of the source
+    struct timespec mtime; // Mtime of the source
+} started_copy_t;
+
+bool open_journal(configuration_t *the_config);
+bool is_journal_open(void);
+void journal_digest(files_list_entry_t *entry);
+void journal_copy_started(files_list_entry_t *source_entry, char *destination);
+void journal_copy_done(files_list_entry_t *source_entry, char *destination);
+off_t resumable_copy_offset(files_list_entry_t *source_entry, char *destination, char *partial);
+void close_journal(bool completed);
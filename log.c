@@ -0,0 +1,79 @@
+#include "log.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+int log_level = LOG_LEVEL_WARNING;
+unsigned int log_categories = LOG_CATEGORY_ALL;
+
+static const char *level_names[] = {"error", "warning", "info", "debug"};
+static const char *category_names[] = {"config", "list", "ipc", "diff", "copy", "hash"};
+
+/*!
+ * @brief init_log makes stdout fully buffered, so that messages are written by blocks instead of line by line
+ * It must be called before anything is printed to stdout.
+ */
+void init_log(void) {
+    setvbuf(stdout, NULL, _IOFBF, LOG_BUFFER_SIZE);
+}
+
+/*!
+ * @brief parse_log_level converts a level name to its value
+ * @param name is the name of the level (error, warning, info or debug)
+ * @return the level, -1 if the name is unknown
+ */
+int parse_log_level(char *name) {
+    for (int level = LOG_LEVEL_ERROR; level <= LOG_LEVEL_DEBUG; ++level) {
+        if (strcmp(name, level_names[level]) == 0) {
+            return level;
+        }
+    }
+    return -1;
+}
+
+/*!
+ * @brief parse_log_categories converts a comma separated list of category names to a categories mask
+ * @param names is the list of names (modified by the function), "all" selects every category
+ * @param categories is a pointer to the mask to set
+ * @return 0 in case of success, -1 if a name is unknown
+ */
+int parse_log_categories(char *names, unsigned int *categories) {
+    unsigned int mask = 0;
+    char *saveptr = NULL;
+    for (char *name = strtok_r(names, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr)) {
+        if (strcmp(name, "all") == 0) {
+            mask |= LOG_CATEGORY_ALL;
+            continue;
+        }
+        size_t i = 0;
+        while (i < sizeof(category_names) / sizeof(category_names[0]) && strcmp(name, category_names[i]) != 0) {
+            ++i;
+        }
+        if (i == sizeof(category_names) / sizeof(category_names[0])) {
+            return -1;
+        }
+        mask |= 1U << i;
+    }
+    *categories = mask;
+    return 0;
+}
+
+/*!
+ * @brief log_message formats a message (use the LOG macros, which filter messages before formatting them)
+ * Errors and warnings go to stderr, other messages to the buffered stdout.
+ * @param level is the level of the message
+ * @param format is the printf format of the message
+ */
+void log_message(int level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(level <= LOG_LEVEL_WARNING ? stderr : stdout, format, args);
+    va_end(args);
+}
+
+/*!
+ * @brief flush_log writes the buffered messages, it must be called before forking so they are not duplicated
+ */
+void flush_log(void) {
+    fflush(stdout);
+}
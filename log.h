@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdbool.h>
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARNING 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+// Messages above this level are removed at compile time (make LOG_LEVEL=<n>)
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_BUFFER_SIZE (64 * 1024)
+
+typedef enum {
+    LOG_CATEGORY_CONFIG = 1 << 0, // Configuration and processes setup
+    LOG_CATEGORY_LIST = 1 << 1, // Directory walks and files lists
+    LOG_CATEGORY_IPC = 1 << 2, // Messages between processes
+    LOG_CATEGORY_DIFF = 1 << 3, // Comparison of the lists
+    LOG_CATEGORY_COPY = 1 << 4, // Copies to the destination
+    LOG_CATEGORY_HASH = 1 << 5, // MD5 computations
+    LOG_CATEGORY_ALL = (1 << 6) - 1
+} log_category_t;
+
+// Runtime filter, inherited by the children when they are forked
+extern int log_level;
+extern unsigned int log_categories;
+
+// Tests the level first so that disabled messages cost (at most) an integer comparison and are never formatted
+#define LOG_ENABLED(level, category) \
+    ((level) <= LOG_COMPILED_LEVEL && (level) <= log_level && (log_categories & (category)) != 0)
+
+#define LOG(level, category, ...) \
+    do { \
+        if (LOG_ENABLED(level, category)) { \
+            log_message(level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_ERROR(category, ...) LOG(LOG_LEVEL_ERROR, category, __VA_ARGS__)
+
+#if LOG_COMPILED_LEVEL >= LOG_LEVEL_WARNING
+#define LOG_WARNING(category, ...) LOG(LOG_LEVEL_WARNING, category, __VA_ARGS__)
+#else
+#define LOG_WARNING(category, ...) do {} while (0)
+#endif
+
+#if LOG_COMPILED_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(category, ...) LOG(LOG_LEVEL_INFO, category, __VA_ARGS__)
+#else
+#define LOG_INFO(category, ...) do {} while (0)
+#endif
+
+#if LOG_COMPILED_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(category, ...) LOG(LOG_LEVEL_DEBUG, category, __VA_ARGS__)
+#else
+#define LOG_DEBUG(category, ...) do {} while (0)
+#endif
+
+void init_log(void);
+int parse_log_level(char *name);
+int parse_log_categories(char *names, unsigned int *categories);
+void log_message(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void flush_log(void);
@@ -6,6 +6,15 @@
 #include "processes.h"
 #include <unistd.h>
 #include <sys/stat.h>
+#include "stats.h"
+#include "trace.h"
+#include "log.h"
+#include "daemon.h"
+#include "batch.h"
+#include "journal.h"
+#include "plan.h"
+#include "remote.h"
+#include <signal.h>
 
 /*!
  * @brief main function, calling all the mechanics of the program
@@ -21,6 +30,7 @@ int main(int argc, char *argv[]) {
     // - source exists and can be read
     // - destination exists and can be written OR doesn't exist but can be created
     // - other options with getopt (see instructions)
+    init_log();
     if (argc < 3) {
         printf("Usage: %s source destination [option]\n", argv[0]);
         return -1;
@@ -32,26 +42,73 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    // Check directories
-    if (!directory_exists(my_config.source) || !directory_exists(my_config.destination)) {
+    // A client only sends its directories to the daemon
+    if (my_config.connect_socket[0] != '\0') {
+        return run_client(&my_config);
+    }
+    bool is_daemon = my_config.daemon_socket[0] != '\0';
+    bool is_batch = my_config.jobs_file[0] != '\0';
+    bool is_apply = my_config.apply_plan[0] != '\0';
+    bool is_server = my_config.serve[0] != '\0';
+    bool is_remote = my_config.remote[0] != '\0';
+    // A server writes to its own tree, a client to the tree of its server
+    char *written_tree = is_server ? my_config.source : my_config.destination;
+
+    // Check directories (a daemon gets them with each request, a batch with each job, an applied plan from the plan)
+    bool has_directories = !is_daemon && !is_batch && !is_apply;
+    if (has_directories && (!directory_exists(my_config.source) || (!is_remote && !directory_exists(written_tree)))) {
         printf("Either source or destination directory do not exist\nAborting\n");
         return -1;
     }
     // Is destination writable?
-    if (!is_directory_writable(my_config.destination)) {
-        printf("Destination directory %s is not writable\n", my_config.destination);
+    if (has_directories && !is_remote && !is_directory_writable(written_tree)) {
+        printf("Destination directory %s is not writable\n", written_tree);
         return -1;
     }
 
+    // Children of a daemon or a server ignore the stop signals (sent to all the processes by a service manager or a
+    // terminal): the daemon stops them with terminate commands
+    if (is_daemon || is_server) {
+        signal(SIGINT, SIG_IGN);
+        signal(SIGTERM, SIG_IGN);
+    }
+
     // Prepare (fork, MQ) if parallel
     process_context_t processes_context;
-    prepare(&my_config, &processes_context);
+    if (prepare(&my_config, &processes_context) == -1) {
+        return -1;
+    }
 
-    // Run synchronize:
-    synchronize(&my_config, &processes_context);
+    // Run synchronize (once, for each job of a batch, or for each request of the clients of a daemon):
+    int result = 0;
+    if (is_daemon) {
+        run_daemon(&my_config, &processes_context);
+    } else if (is_batch) {
+        result = run_batch(&my_config, &processes_context);
+    } else if (is_server) {
+        result = run_server(&my_config, &processes_context);
+    } else if (is_apply) {
+        result = apply_plan(&my_config);
+    } else {
+        result = synchronize(&my_config, &processes_context);
+    }
     
-    // Clean resources
+    // Clean resources (the journal is only needed to resume an interrupted run)
     clean_processes(&my_config, &processes_context);
+    close_journal(result == 0);
+
+    // Report statistics (children reported theirs while being cleaned)
+    stats_update_peak_rss();
+    merge_stats(&processes_context.roles_stats[ROLE_MAIN], &process_stats);
+    if (my_config.show_stats) {
+        display_stats(stdout, processes_context.roles_stats);
+    }
+    if (my_config.stats_json[0] != '\0') {
+        write_stats_json(my_config.stats_json, processes_context.roles_stats);
+    }
+    if (my_config.trace[0] != '\0') {
+        write_trace(my_config.trace);
+    }
 
-    return 0;
+    return result;
 }
@@ -1,37 +1,109 @@
 #include "messages.h"
 #include <sys/msg.h>
 #include <string.h>
+#include <stddef.h>
+#include "trace.h"
 
 // Functions in this file are required for inter processes communication
 
 /*!
- * @brief send_file_entry sends a file entry, with a given command code
+ * @brief send_message_with_flags sends a message and accounts it in the process statistics
+ * @param msg_queue the MQ identifier through which to send the message
+ * @param message is a pointer to the message, starting with its mtype
+ * @param message_size is the size of the message, without its mtype
+ * @param flags are the msgsnd flags (IPC_NOWAIT not to wait for room in a full queue)
+ * @return the result of msgsnd
+ */
+static int send_message_with_flags(int msg_queue, void *message, size_t message_size, int flags) {
+    uint64_t trace_start = trace_clock();
+    int result = msgsnd(msg_queue, message, message_size, flags);
+    if (result == 0) {
+        ++process_stats.messages_sent;
+        trace_complete(TRACE_SEND, trace_start, NULL);
+    }
+    return result;
+}
+
+/*!
+ * @brief send_message sends a message, waiting for room in the queue if it is full
+ * @param msg_queue the MQ identifier through which to send the message
+ * @param message is a pointer to the message, starting with its mtype
+ * @param message_size is the size of the message, without its mtype
+ * @return the result of msgsnd
+ */
+static int send_message(int msg_queue, void *message, size_t message_size) {
+    return send_message_with_flags(msg_queue, message, message_size, 0);
+}
+
+/*!
+ * @brief entry_message_size computes the size of a message whose last member is an entry, up to the end of its path
+ * Sending only the used part of the path lets the (16 KiB by default) queue hold tens of entries instead of 3.
+ * @param payload_offset is the offset of the entry in the message
+ * @param file_entry is a pointer to the entry
+ * @return the size of the message, without its mtype
+ */
+static size_t entry_message_size(size_t payload_offset, files_list_entry_t *file_entry) {
+    return payload_offset - sizeof(long) + offsetof(files_list_entry_t, path_and_name) + strlen(file_entry->path_and_name) + 1;
+}
+
+/*!
+ * @brief in_flight_message_size computes the queue space taken by an entry between its dispatch and its response
+ * One message carries the entry at a time: its analyze command, its forward to a hash pool or its response (with
+ * direct results, the response to the main process, followed by a small done message to the lister).
+ * @param file_entry is a pointer to the entry
+ * @return the size in bytes, without mtypes
+ */
+size_t in_flight_message_size(files_list_entry_t *file_entry) {
+    size_t header_size = offsetof(files_list_entry_transmit_t, payload) - sizeof(long);
+    return entry_message_size(offsetof(files_list_entry_transmit_t, payload), file_entry) + header_size;
+}
+
+/*!
+ * @brief send_sequenced_entry sends a file entry, with a given command code, job and sequence number
  * @param msg_queue the MQ identifier through which to send the entry
  * @param recipient is the id of the recipient (as specified by mtype)
  * @param file_entry is a pointer to the entry to send (must be copied)
  * @param cmd_code is the cmd code to process the entry.
+ * @param job is the job of the list of the entry
+ * @param sequence is the index of the entry in its list
  * @return the result of the msgsnd function
- * Used by the specialized functions send_analyze*
  */
-int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int cmd_code) {
+static int send_sequenced_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int cmd_code, int job, uint32_t sequence) {
     files_list_entry_transmit_t message;
     message.mtype = recipient;
     message.op_code = cmd_code;
-    memcpy(&message.payload, file_entry, sizeof(files_list_entry_t));
+    message.sequence = sequence;
     message.reply_to = msg_queue;
+    message.job = job;
+    memcpy(&message.payload, file_entry, offsetof(files_list_entry_t, path_and_name));
+    strcpy(message.payload.path_and_name, file_entry->path_and_name);
 
-    size_t message_size = sizeof(message) - sizeof(long);
-    return msgsnd(msg_queue, &message, message_size, 0);
+    return send_message(msg_queue, &message, entry_message_size(offsetof(files_list_entry_transmit_t, payload), file_entry));
 }
 
 /*!
- * @brief send_analyze_dir_command sends a command to analyze a directory
+ * @brief send_file_entry sends a file entry, with a given command code
+ * @param msg_queue the MQ identifier through which to send the entry
+ * @param recipient is the id of the recipient (as specified by mtype)
+ * @param file_entry is a pointer to the entry to send (must be copied)
+ * @param cmd_code is the cmd code to process the entry.
+ * @return the result of the msgsnd function
+ * Used by the specialized functions send_analyze*
+ */
+int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int cmd_code) {
+    return send_sequenced_entry(msg_queue, recipient, file_entry, cmd_code, 0, 0);
+}
+
+/*!
+ * @brief send_analyze_dir_message sends a command to analyze a directory
  * @param msg_queue is the id of the MQ used to send the command
  * @param recipient is the recipient of the message (mtype)
  * @param target_dir is a string containing the path to the directory to analyze
+ * @param job is the job of the list, 0 outside a batch
+ * @param flags are the msgsnd flags
  * @return the result of msgsnd
  */
-int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir) {
+static int send_analyze_dir_message(int msg_queue, int recipient, char *target_dir, int job, int flags) {
     if (msg_queue == -1) {
         return -1;
     }
@@ -44,37 +116,133 @@ int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir) {
     analyze_dir_command_t message;
     message.mtype = recipient;
     message.op_code = COMMAND_CODE_ANALYZE_DIR;
+    message.job = job;
     strncpy(message.target, target_dir, sizeof(message.target) - 1);
     message.target[sizeof(message.target) - 1] = '\0';
 
-    size_t message_size = sizeof(message) - sizeof(long);
-    return msgsnd(msg_queue, &message, message_size, 0);
+    size_t message_size = offsetof(analyze_dir_command_t, target) - sizeof(long) + strlen(message.target) + 1;
+    return send_message_with_flags(msg_queue, &message, message_size, flags);
+}
+
+/*!
+ * @brief send_analyze_dir_command sends a command to analyze a directory
+ * @param msg_queue is the id of the MQ used to send the command
+ * @param recipient is the recipient of the message (mtype)
+ * @param target_dir is a string containing the path to the directory to analyze
+ * @param job is the job of the list, 0 outside a batch
+ * @return the result of msgsnd
+ */
+int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir, int job) {
+    return send_analyze_dir_message(msg_queue, recipient, target_dir, job, 0);
+}
+
+/*!
+ * @brief post_analyze_dir_command sends a command to analyze a directory, unless the queue is full
+ * The main process posts the lists of a job while the listers send it the entries of the other jobs: it would never
+ * find room in a queue full of messages it has to receive itself.
+ * @param msg_queue is the id of the MQ used to send the command
+ * @param recipient is the recipient of the message (mtype)
+ * @param target_dir is a string containing the path to the directory to analyze
+ * @param job is the job of the list
+ * @return the result of msgsnd, -1 with errno set to EAGAIN when the queue is full
+ */
+int post_analyze_dir_command(int msg_queue, int recipient, char *target_dir, int job) {
+    return send_analyze_dir_message(msg_queue, recipient, target_dir, job, IPC_NOWAIT);
 }
 
-// The 3 following functions are one-liners
+/*!
+ * @brief send_analyze_message sends a file entry to be analyzed
+ * @param msg_queue the MQ identifier through which to send the entry
+ * @param recipient is the id of the recipient (as specified by mtype)
+ * @param file_entry is a pointer to the entry to send (must be copied)
+ * @param job is the job of the lister's list
+ * @param sequence is the index of the entry in the lister's list
+ * @param flags are the msgsnd flags
+ * @return the result of msgsnd
+ */
+static int send_analyze_message(int msg_queue, int recipient, files_list_entry_t *file_entry, int job, uint32_t sequence, int flags) {
+    analyze_file_command_t message;
+    message.mtype = recipient;
+    message.op_code = COMMAND_CODE_ANALYZE_FILE;
+    message.sequence = sequence;
+    message.job = job;
+    memcpy(&message.payload, file_entry, offsetof(files_list_entry_t, path_and_name));
+    strcpy(message.payload.path_and_name, file_entry->path_and_name);
+
+    return send_message_with_flags(msg_queue, &message, entry_message_size(offsetof(analyze_file_command_t, payload), file_entry), flags);
+}
 
 /*!
  * @brief send_analyze_file_command sends a file entry to be analyzed
  * @param msg_queue the MQ identifier through which to send the entry
  * @param recipient is the id of the recipient (as specified by mtype)
  * @param file_entry is a pointer to the entry to send (must be copied)
- * @return the result of the send_file_entry function
- * Calls send_file_entry function
+ * @param job is the job of the lister's list
+ * @param sequence is the index of the entry in the lister's list
+ * @return the result of msgsnd
  */
-int send_analyze_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry) {
-    return send_file_entry(msg_queue, recipient, file_entry, COMMAND_CODE_ANALYZE_FILE);
+int send_analyze_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry, int job, uint32_t sequence) {
+    return send_analyze_message(msg_queue, recipient, file_entry, job, sequence, 0);
 }
 
+/*!
+ * @brief forward_analyze_file_command hands a file entry over to a hash pool, unless the queue is full
+ * @param msg_queue the MQ identifier through which to send the entry
+ * @param recipient is the id of the hash pool (as specified by mtype)
+ * @param file_entry is a pointer to the entry to send (must be copied)
+ * @param job is the job received with the analyze command
+ * @param sequence is the sequence number received with the analyze command
+ * @return the result of msgsnd, -1 with errno set to EAGAIN when the queue is full
+ */
+int forward_analyze_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry, int job, uint32_t sequence) {
+    return send_analyze_message(msg_queue, recipient, file_entry, job, sequence, IPC_NOWAIT);
+}
+
+// The 2 following functions are one-liners
+
 /*!
  * @brief send_analyze_file_response sends a file entry after analyze
  * @param msg_queue the MQ identifier through which to send the entry
  * @param recipient is the id of the recipient (as specified by mtype)
  * @param file_entry is a pointer to the entry to send (must be copied)
- * @return the result of the send_file_entry function
- * Calls send_file_entry function
+ * @param job is the job received with the analyze command
+ * @param sequence is the sequence number received with the analyze command
+ * @return the result of the send_sequenced_entry function
+ */
+int send_analyze_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry, int job, uint32_t sequence) {
+    return send_sequenced_entry(msg_queue, recipient, file_entry, COMMAND_CODE_FILE_ANALYZED, job, sequence);
+}
+
+/*!
+ * @brief send_analyzed_entry sends an analyzed entry to the main process, from its lister or straight from an analyzer
+ * @param msg_queue the MQ identifier through which to send the entry
+ * @param recipient is the id of the recipient (as specified by mtype)
+ * @param file_entry is a pointer to the entry to send (must be copied)
+ * @param list_code is the op code of the entries of its list (MSG_TYPE_TO_MAIN_FROM_*_LISTER)
+ * @param job is the job of its list
+ * @param sequence is the sequence number received with the analyze command, i.e. the index of the entry in its list
+ * @return the result of the send_sequenced_entry function
  */
-int send_analyze_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry) {
-    return send_file_entry(msg_queue, recipient, file_entry, COMMAND_CODE_FILE_ANALYZED);
+int send_analyzed_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int list_code, int job, uint32_t sequence) {
+    return send_sequenced_entry(msg_queue, recipient, file_entry, list_code, job, sequence);
+}
+
+/*!
+ * @brief send_analyze_file_done tells a lister that a file was analyzed and its result sent to the main process
+ * @param msg_queue is the id of the MQ used to send the message
+ * @param recipient is the lister (mtype)
+ * @param job is the job received with the analyze command
+ * @param sequence is the sequence number received with the analyze command
+ * @return the result of msgsnd
+ */
+int send_analyze_file_done(int msg_queue, int recipient, int job, uint32_t sequence) {
+    files_list_entry_transmit_t message;
+    message.mtype = recipient;
+    message.op_code = COMMAND_CODE_FILE_ANALYZED;
+    message.sequence = sequence;
+    message.reply_to = msg_queue;
+    message.job = job;
+    return send_message(msg_queue, &message, offsetof(files_list_entry_transmit_t, payload) - sizeof(long));
 }
 
 /*!
@@ -93,15 +261,34 @@ int send_files_list_element(int msg_queue, int recipient, files_list_entry_t *fi
  * @brief send_list_end sends the end of list message to the main process
  * @param msg_queue is the id of the MQ used to send the message
  * @param recipient is the destination of the message
+ * @param list_code is the op code of the entries of the list (MSG_TYPE_TO_MAIN_FROM_*_LISTER)
+ * @param job is the job of the list
+ * @param entries_count is the number of entries of the list
  * @return the result of msgsnd
  */
-int send_list_end(int msg_queue, int recipient) {
-    simple_command_t message;
+int send_list_end(int msg_queue, int recipient, int list_code, int job, uint32_t entries_count) {
+    list_end_t message;
     message.mtype = recipient;
-    message.message = COMMAND_CODE_LIST_COMPLETE;
+    message.op_code = COMMAND_CODE_LIST_COMPLETE;
+    message.list_code = list_code;
+    message.job = job;
+    message.entries_count = entries_count;
 
     size_t message_size = sizeof(message) - sizeof(long);
-    return msgsnd(msg_queue, &message, message_size, 0);
+    return send_message(msg_queue, &message, message_size);
+}
+
+/*!
+ * @brief send_device_released wakes up a lister waiting for a device to be released (@see wait_for_device)
+ * @param msg_queue is the id of the MQ used to send the message
+ * @param recipient is the lister (mtype)
+ * @return the result of msgsnd
+ */
+int send_device_released(int msg_queue, int recipient) {
+    simple_command_t message;
+    message.mtype = recipient;
+    message.message = COMMAND_CODE_DEVICE_RELEASED;
+    return send_message(msg_queue, &message, sizeof(char));
 }
 
 /*!
@@ -114,7 +301,7 @@ int send_terminate_command(int msg_queue, int recipient) {
     simple_command_t terminate_command;
     terminate_command.mtype = recipient;
     terminate_command.message = COMMAND_CODE_TERMINATE;
-    return msgsnd(msg_queue, &terminate_command, sizeof(char), 0);
+    return send_message(msg_queue, &terminate_command, sizeof(char));
 }
 
 /*!
@@ -127,5 +314,26 @@ int send_terminate_confirm(int msg_queue, int recipient) {
     simple_command_t terminate_confirm;
     terminate_confirm.mtype = recipient;
     terminate_confirm.message = COMMAND_CODE_TERMINATE_OK;
-    return msgsnd(msg_queue, &terminate_confirm, sizeof(char), 0);
-}
\ No newline at end of file
+    return send_message(msg_queue, &terminate_confirm, sizeof(char));
+}
+
+/*!
+ * @brief send_stats_report sends the statistics of a child process to the main process
+ * @param msg_queue is the id of the MQ used to send the message
+ * @param recipient is the destination of the message
+ * @param role is the stats_role_t of the sending process
+ * @return the result of msgsnd
+ */
+int send_stats_report(int msg_queue, int recipient, int role) {
+    stats_report_t message;
+    message.mtype = recipient;
+    message.op_code = COMMAND_CODE_STATS_REPORT;
+    message.role = role;
+    // Counted before the copy, so that the report includes itself
+    ++process_stats.messages_sent;
+    stats_update_peak_rss();
+    memcpy(&message.stats, &process_stats, sizeof(stats_t));
+
+    size_t message_size = sizeof(message) - sizeof(long);
+    return msgsnd(msg_queue, &message, message_size, 0);
+}
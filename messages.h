@@ -2,6 +2,7 @@
 
 #include "files-list.h"
 #include "defines.h"
+#include "stats.h"
 
 #define COMMAND_CODE_TERMINATE 0x0
 #define COMMAND_CODE_TERMINATE_OK 0x10
@@ -10,6 +11,8 @@
 #define COMMAND_CODE_ANALYZE_DIR 0x02
 #define COMMAND_CODE_FILE_ENTRY 0x12
 #define COMMAND_CODE_LIST_COMPLETE 0x22
+#define COMMAND_CODE_STATS_REPORT 0x30
+#define COMMAND_CODE_DEVICE_RELEASED 0x40
 
 #define MSG_TYPE_TO_MAIN 1
 #define MSG_TYPE_TO_SOURCE_LISTER 2
@@ -22,43 +25,75 @@
 #define MSG_TYPE_TO_LISTER_FROM_DESTINATION_ANALYZERS 9
 #define MSG_TYPE_TO_MAIN_FROM_END_SRC_LISTER 10
 #define MSG_TYPE_TO_MAIN_FROM_END_DEST_LISTER 11
+#define MSG_TYPE_TO_SOURCE_HASHERS 12
+#define MSG_TYPE_TO_DESTINATION_HASHERS 13
 
 typedef struct {
     long mtype;
     char message;
 } simple_command_t;
 
+// Messages carrying an entry are sent up to the end of its path (payload must be their last member)
 typedef struct {
     long mtype;
     char op_code; // Contains the analyze file opcode
+    uint32_t sequence; // Index of the entry in the lister's list, sent back with the response
+    int job; // Job of the list (@see run_batch), sent back with the response
     files_list_entry_t payload;
 } analyze_file_command_t;
 
 typedef struct {
     long mtype;
     char op_code; // Contains the analyze file opcode
-    files_list_entry_t payload;
+    uint32_t sequence; // Index of the entry in the lister's list (analyze responses)
     int reply_to; // MQ id of the sender, to build either source or destination list
+    int job; // Job of the list (@see run_batch), 0 outside a batch
+    files_list_entry_t payload;
 } files_list_entry_transmit_t;
 
 typedef struct {
     long mtype;
     char op_code; // Contains the analyze dir opcode
+    int job; // Job of the list, given back with its entries and its end
     char target[PATH_SIZE];
 } analyze_dir_command_t;
 
+typedef struct {
+    long mtype;
+    char op_code; // Contains the list complete opcode
+    int list_code; // Op code of the entries of the list (MSG_TYPE_TO_MAIN_FROM_*_LISTER)
+    int job; // Job of the list
+    uint32_t entries_count;
+} list_end_t;
+
+typedef struct {
+    long mtype;
+    char op_code; // Contains the stats report opcode
+    int role; // stats_role_t of the sender
+    stats_t stats;
+} stats_report_t;
+
 typedef union {
     simple_command_t simple_command;
     analyze_file_command_t analyze_file_command;
     analyze_dir_command_t analyze_dir_command;
     files_list_entry_transmit_t list_entry;
+    stats_report_t stats_report;
+    list_end_t list_end;
 } any_message_t;
 
-int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir);
+size_t in_flight_message_size(files_list_entry_t *file_entry);
+int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir, int job);
+int post_analyze_dir_command(int msg_queue, int recipient, char *target_dir, int job);
 int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int cmd_code);
-int send_analyze_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry);
-int send_analyze_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry);
+int send_analyze_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry, int job, uint32_t sequence);
+int forward_analyze_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry, int job, uint32_t sequence);
+int send_analyze_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry, int job, uint32_t sequence);
+int send_analyzed_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int list_code, int job, uint32_t sequence);
+int send_analyze_file_done(int msg_queue, int recipient, int job, uint32_t sequence);
 int send_files_list_element(int msg_queue, int recipient, files_list_entry_t *file_entry);
-int send_list_end(int msg_queue, int recipient);
+int send_list_end(int msg_queue, int recipient, int list_code, int job, uint32_t entries_count);
+int send_device_released(int msg_queue, int recipient);
 int send_terminate_command(int msg_queue, int recipient);
 int send_terminate_confirm(int msg_queue, int recipient);
+int send_stats_report(int msg_queue, int recipient, int role);
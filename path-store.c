@@ -0,0 +1,241 @@
+#include "path-store.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*!
+ * @brief put_varint appends an unsigned integer to a buffer in LEB128 form (7 bits per byte)
+ * @param buffer is where to write the integer (at most 10 bytes)
+ * @param value is the integer to write
+ * @return the number of bytes written
+ */
+static size_t put_varint(uint8_t *buffer, size_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        buffer[length++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = (uint8_t) value;
+    return length;
+}
+
+/*!
+ * @brief get_varint reads an unsigned integer written by put_varint
+ * @param buffer is where to read the integer
+ * @param value is a pointer to the integer to fill
+ * @return the number of bytes read
+ */
+static size_t get_varint(const uint8_t *buffer, size_t *value) {
+    size_t length = 0;
+    size_t shift = 0;
+    *value = 0;
+    do {
+        *value |= (size_t) (buffer[length] & 0x7f) << shift;
+        shift += 7;
+    } while (buffer[length++] & 0x80);
+    return length;
+}
+
+/*!
+ * @brief init_path_store initializes an empty path store
+ * @param store is a pointer to the store to initialize
+ */
+void init_path_store(path_store_t *store) {
+    if (store == NULL) {
+        return;
+    }
+    memset(store, 0, sizeof(path_store_t));
+}
+
+/*!
+ * @brief append_path appends a path to a path store
+ * Paths must be appended in strcmp order, the shared prefix with the previous path is not stored again (but for the
+ * restart points, stored whole).
+ * @param store is a pointer to the store
+ * @param path is the path to append
+ * @return 0 in case of success, -1 else (out of memory, out of order or too long path)
+ */
+int append_path(path_store_t *store, const char *path) {
+    if (store == NULL || path == NULL) {
+        return -1;
+    }
+    size_t length = strlen(path);
+    if (length >= PATH_SIZE || (store->count > 0 && strcmp(store->last_path, path) > 0)) {
+        return -1;
+    }
+
+    size_t shared = 0;
+    bool restart = store->count % PATH_STORE_RESTART_INTERVAL == 0;
+    if (!restart) {
+        while (shared < length && shared < store->last_length && store->last_path[shared] == path[shared]) {
+            ++shared;
+        }
+    }
+
+    // 2 varints of at most 10 bytes each, then the suffix
+    size_t needed = store->data_size + 20 + length - shared;
+    if (needed > store->data_capacity) {
+        size_t capacity = store->data_capacity == 0 ? 4096 : store->data_capacity;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        uint8_t *data = realloc(store->data, capacity);
+        if (data == NULL) {
+            return -1;
+        }
+        store->data = data;
+        store->data_capacity = capacity;
+    }
+    if (restart) {
+        if (store->restarts_count == store->restarts_capacity) {
+            size_t capacity = store->restarts_capacity == 0 ? 64 : store->restarts_capacity * 2;
+            size_t *restarts = realloc(store->restarts, capacity * sizeof(size_t));
+            if (restarts == NULL) {
+                return -1;
+            }
+            store->restarts = restarts;
+            store->restarts_capacity = capacity;
+        }
+        store->restarts[store->restarts_count++] = store->data_size;
+    }
+
+    store->data_size += put_varint(store->data + store->data_size, shared);
+    store->data_size += put_varint(store->data + store->data_size, length - shared);
+    memcpy(store->data + store->data_size, path + shared, length - shared);
+    store->data_size += length - shared;
+
+    memcpy(store->last_path + shared, path + shared, length - shared + 1);
+    store->last_length = length;
+    ++store->count;
+    return 0;
+}
+
+/*!
+ * @brief free_path_store frees the memory of a path store and empties it
+ * @param store is a pointer to the store
+ */
+void free_path_store(path_store_t *store) {
+    if (store == NULL) {
+        return;
+    }
+    free(store->data);
+    free(store->restarts);
+    init_path_store(store);
+}
+
+/*!
+ * @brief start_path_cursor places a cursor before the first path of a store
+ * @param cursor is a pointer to the cursor
+ * @param store is a pointer to the store to iterate over
+ */
+void start_path_cursor(path_store_cursor_t *cursor, path_store_t *store) {
+    cursor->store = store;
+    cursor->index = (size_t) -1;
+    cursor->offset = 0;
+    cursor->shared = 0;
+    cursor->length = 0;
+    cursor->path[0] = '\0';
+}
+
+/*!
+ * @brief next_path moves a cursor to the next path of its store
+ * Only the suffix is copied: the shared prefix is already in the cursor path.
+ * @param cursor is a pointer to the cursor
+ * @return true if the cursor is on a path, false if the end of the store was reached
+ */
+bool next_path(path_store_cursor_t *cursor) {
+    if (cursor->index + 1 >= cursor->store->count) {
+        cursor->index = cursor->store->count;
+        return false;
+    }
+    const uint8_t *data = cursor->store->data;
+    size_t suffix_length;
+    cursor->offset += get_varint(data + cursor->offset, &cursor->shared);
+    cursor->offset += get_varint(data + cursor->offset, &suffix_length);
+    memcpy(cursor->path + cursor->shared, data + cursor->offset, suffix_length);
+    cursor->offset += suffix_length;
+    cursor->length = cursor->shared + suffix_length;
+    cursor->path[cursor->length] = '\0';
+    ++cursor->index;
+    return true;
+}
+
+/*!
+ * @brief seek_path moves a cursor to a path given by its index, decoding from the closest restart point
+ * @param cursor is a pointer to the cursor
+ * @param index is the index of the path
+ * @return true if the cursor is on the path, false if index is out of the store
+ */
+bool seek_path(path_store_cursor_t *cursor, size_t index) {
+    if (index >= cursor->store->count) {
+        return false;
+    }
+    size_t restart = index / PATH_STORE_RESTART_INTERVAL;
+    cursor->offset = cursor->store->restarts[restart];
+    cursor->index = restart * PATH_STORE_RESTART_INTERVAL - 1;
+    while (cursor->index != index) {
+        next_path(cursor);
+    }
+    return true;
+}
+
+/*!
+ * @brief find_path looks up a path in a store
+ * Restart points are binary searched, then the path is looked for in the block of its restart point.
+ * @param store is a pointer to the store
+ * @param path is the path to look for
+ * @return the index of the path, -1 if it isn't in the store
+ */
+long find_path(path_store_t *store, const char *path) {
+    if (store == NULL || path == NULL || store->count == 0) {
+        return -1;
+    }
+    size_t low = 0;
+    size_t high = store->restarts_count;
+    path_store_cursor_t cursor;
+    start_path_cursor(&cursor, store);
+    // Look for the last restart point whose path is lower or equal to path
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        seek_path(&cursor, middle * PATH_STORE_RESTART_INTERVAL);
+        if (strcmp(cursor.path, path) <= 0) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    seek_path(&cursor, low * PATH_STORE_RESTART_INTERVAL);
+    do {
+        int cmp = strcmp(cursor.path, path);
+        if (cmp == 0) {
+            return (long) cursor.index;
+        } else if (cmp > 0) {
+            break;
+        }
+    } while (cursor.index + 1 < (low + 1) * PATH_STORE_RESTART_INTERVAL && next_path(&cursor));
+    return -1;
+}
+
+/*!
+ * @brief compare_path_cursors compares the current paths of two cursors, like strcmp
+ * When both cursors are advanced in lockstep (as in a merge), the prefix shared by their paths is known from the
+ * previous comparison and from the shared prefix of the new paths: it is not compared again.
+ * @param lhs is a pointer to the first cursor
+ * @param rhs is a pointer to the second cursor
+ * @param common is a pointer to the length of the prefix known to be common to both paths, updated to the exact
+ * length of the common prefix. Callers must lower it to the shared length of a cursor when they advance it.
+ * @return a negative value, zero or a positive value if lhs path is lower, equal or greater than rhs path
+ */
+int compare_path_cursors(path_store_cursor_t *lhs, path_store_cursor_t *rhs, size_t *common) {
+    size_t position = *common;
+    while (position < lhs->length && position < rhs->length && lhs->path[position] == rhs->path[position]) {
+        ++position;
+    }
+    *common = position;
+    if (position == lhs->length) {
+        return position == rhs->length ? 0 : -1;
+    }
+    if (position == rhs->length) {
+        return 1;
+    }
+    return (unsigned char) lhs->path[position] - (unsigned char) rhs->path[position];
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "defines.h"
+
+#define PATH_STORE_RESTART_INTERVAL 16
+
+// Sorted paths, front-coded: each path is stored as the length of the prefix it shares with the previous path,
+// then the length and bytes of the remaining suffix. Every PATH_STORE_RESTART_INTERVAL-th path is stored whole
+// (restart point), so that a path can be decoded without decoding the whole store (@see seek_path, find_path).
+typedef struct {
+    uint8_t *data;
+    size_t data_size;
+    size_t data_capacity;
+    size_t *restarts; // Offsets in data of the restart points
+    size_t restarts_count;
+    size_t restarts_capacity;
+    size_t count;
+    char last_path[PATH_SIZE];
+    size_t last_length;
+} path_store_t;
+
+typedef struct {
+    path_store_t *store;
+    size_t index; // Index of the current path
+    size_t offset; // Offset in data of the next encoded path
+    size_t shared; // Length of the prefix the current path shares with the previous one
+    size_t length;
+    char path[PATH_SIZE];
+} path_store_cursor_t;
+
+void init_path_store(path_store_t *store);
+int append_path(path_store_t *store, const char *path);
+void free_path_store(path_store_t *store);
+void start_path_cursor(path_store_cursor_t *cursor, path_store_t *store);
+bool next_path(path_store_cursor_t *cursor);
+bool seek_path(path_store_cursor_t *cursor, size_t index);
+long find_path(path_store_t *store, const char *path);
+int compare_path_cursors(path_store_cursor_t *lhs, path_store_cursor_t *rhs, size_t *common);
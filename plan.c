@@ -0,0 +1,206 @@
+#include "plan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "defines.h"
+#include "utility.h"
+#include "files-list-io.h"
+#include "dest-index.h"
+#include "file-properties.h"
+#include "sync.h"
+#include "log.h"
+#include "dir-cache.h"
+#include "uring-copy.h"
+
+// A plan is the difference list of a synchronization, saved instead of being applied (--plan-out), and applied later
+// (--apply) without listing nor hashing the trees again: each entry is only checked with lstat against the state of
+// its source and of its destination when the plan was made. Entries that changed since are skipped.
+
+/*!
+ * @brief snapshot_destination records the state of the destination of an entry
+ * @param snapshot is a pointer to the snapshot to fill
+ * @param path is the path of the destination
+ */
+static void snapshot_destination(plan_destination_t *snapshot, char *path) {
+    struct stat sb;
+    memset(snapshot, 0, sizeof(plan_destination_t));
+    if (lstat(path, &sb) == 0) {
+        snapshot->exists = 1;
+        snapshot->mtime_sec = sb.st_mtim.tv_sec;
+        snapshot->mtime_nsec = sb.st_mtim.tv_nsec;
+        snapshot->size = sb.st_size;
+    }
+}
+
+/*!
+ * @brief write_plan writes the difference list of a synchronization to the plan file of the configuration
+ * The plan is written to a temporary file renamed once complete.
+ * @param difference is a pointer to the list of the entries to copy (rooted at the source)
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int write_plan(compact_files_list_t *difference, configuration_t *the_config) {
+    if (difference == NULL || the_config == NULL || the_config->plan_out[0] == '\0') {
+        return -1;
+    }
+    char temporary_path[PATH_SIZE];
+    if (snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", the_config->plan_out) >= (int) sizeof(temporary_path)) {
+        return -1;
+    }
+    FILE *plan = fopen(temporary_path, "wb");
+    if (plan == NULL) {
+        perror("Failed to create plan");
+        return -1;
+    }
+
+    plan_header_t header;
+    memcpy(header.magic, PLAN_MAGIC, sizeof(header.magic));
+    header.flags = the_config->uses_md5 ? PLAN_FLAG_MD5 : 0;
+    header.entries_count = 0;
+    header.source_length = strlen(the_config->source);
+    header.destination_length = strlen(the_config->destination);
+    bool failed = fwrite(&header, sizeof(header), 1, plan) != 1
+        || fwrite(the_config->source, header.source_length, 1, plan) != 1
+        || fwrite(the_config->destination, header.destination_length, 1, plan) != 1;
+
+    size_t start_of_source = strlen(the_config->source) + 1;
+    path_store_cursor_t cursor;
+    start_path_cursor(&cursor, &difference->paths);
+    files_list_entry_t entry;
+    plan_destination_t snapshot;
+    char destination_path[PATH_SIZE];
+    while (!failed && next_path(&cursor)) {
+        fill_entry_from_compact(difference, &cursor, &entry);
+        if (concat_path(destination_path, the_config->destination, cursor.path) == NULL) {
+            continue;
+        }
+        snapshot_destination(&snapshot, destination_path);
+        failed = write_files_list_record(plan, &entry, start_of_source) == -1 || fwrite(&snapshot, sizeof(snapshot), 1, plan) != 1;
+        ++header.entries_count;
+    }
+
+    if (!failed) {
+        failed = fseek(plan, 0, SEEK_SET) == -1 || fwrite(&header, sizeof(header), 1, plan) != 1;
+    }
+    if (fclose(plan) != 0 || failed) {
+        fprintf(stderr, "Failed to write plan %s\n", temporary_path);
+        remove(temporary_path);
+        return -1;
+    }
+    if (rename(temporary_path, the_config->plan_out) == -1) {
+        perror("Failed to install plan");
+        remove(temporary_path);
+        return -1;
+    }
+    LOG_INFO(LOG_CATEGORY_DIFF, "Plan %s written: %lu entries to copy\n", the_config->plan_out, header.entries_count);
+    return 0;
+}
+
+/*!
+ * @brief read_plan_root reads a root of a plan and checks it against the one of the configuration, if any
+ * @param plan is the plan, positioned on the root
+ * @param length is the length of the root
+ * @param root is the root of the configuration, replaced by the one of the plan when it is empty
+ * @param root_size is the size of the root buffer
+ * @return 0 if the roots match, -1 else
+ */
+static int read_plan_root(FILE *plan, uint16_t length, char *root, size_t root_size) {
+    char plan_root[PATH_SIZE];
+    if (length >= root_size || length >= sizeof(plan_root) || fread(plan_root, length, 1, plan) != 1) {
+        return -1;
+    }
+    plan_root[length] = '\0';
+    if (root[0] == '\0') {
+        strcpy(root, plan_root);
+        return 0;
+    }
+    if (strcmp(root, plan_root) != 0) {
+        fprintf(stderr, "The plan was made for %s, not for %s\n", plan_root, root);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief is_plan_entry_current tells if the source and the destination of an entry are as they were in the plan
+ * @param entry is a pointer to the source entry of the plan
+ * @param snapshot is a pointer to the destination state of the plan
+ * @param the_config is a pointer to the configuration
+ * @return true if the entry can be applied, false else
+ */
+static bool is_plan_entry_current(files_list_entry_t *entry, plan_destination_t *snapshot, configuration_t *the_config) {
+    struct stat sb;
+    if (lstat(entry->path_and_name, &sb) == -1 || !entry_matches_stat(entry, &sb)) {
+        return false;
+    }
+    char destination_path[PATH_SIZE];
+    if (concat_path(destination_path, the_config->destination, entry->path_and_name + strlen(the_config->source) + 1) == NULL) {
+        return false;
+    }
+    bool exists = lstat(destination_path, &sb) == 0;
+    if (exists != (snapshot->exists != 0)) {
+        return false;
+    }
+    // The content of a directory is checked with its own entries
+    return !exists || S_ISDIR(sb.st_mode)
+        || ((uint64_t) sb.st_size == snapshot->size && sb.st_mtim.tv_sec == snapshot->mtime_sec && sb.st_mtim.tv_nsec == snapshot->mtime_nsec);
+}
+
+/*!
+ * @brief apply_plan copies the entries of the plan file of the configuration, without listing the trees
+ * The roots of the synchronization are those of the plan (the directories given on the command line must match them).
+ * @param the_config is a pointer to the configuration
+ * @return 0 if all the entries were applied, -1 if the plan cannot be read or entries changed since it was made
+ */
+int apply_plan(configuration_t *the_config) {
+    FILE *plan = fopen(the_config->apply_plan, "rb");
+    if (plan == NULL) {
+        perror("Failed to open plan");
+        return -1;
+    }
+    plan_header_t header;
+    if (fread(&header, sizeof(header), 1, plan) != 1 || memcmp(header.magic, PLAN_MAGIC, sizeof(header.magic)) != 0
+        || read_plan_root(plan, header.source_length, the_config->source, sizeof(the_config->source)) == -1
+        || read_plan_root(plan, header.destination_length, the_config->destination, sizeof(the_config->destination)) == -1) {
+        fprintf(stderr, "%s is not a plan for this synchronization\n", the_config->apply_plan);
+        fclose(plan);
+        return -1;
+    }
+    if (!directory_exists(the_config->source) || !directory_exists(the_config->destination)
+        || !is_directory_writable(the_config->destination)) {
+        fprintf(stderr, "Either source or destination directory do not exist or is not writable\n");
+        fclose(plan);
+        return -1;
+    }
+
+    int result = 0;
+    uint64_t stale_count = 0;
+    files_list_entry_t entry;
+    plan_destination_t snapshot;
+    for (uint64_t i = 0; i < header.entries_count; ++i) {
+        if (read_files_list_record(plan, &entry, the_config->source) != 1 || fread(&snapshot, sizeof(snapshot), 1, plan) != 1) {
+            fprintf(stderr, "Plan %s is truncated\n", the_config->apply_plan);
+            result = -1;
+            break;
+        }
+        if (!is_plan_entry_current(&entry, &snapshot, the_config)) {
+            LOG_WARNING(LOG_CATEGORY_COPY, "%s changed since the plan was made, it is skipped\n", entry.path_and_name);
+            ++stale_count;
+            continue;
+        }
+        if (the_config->dry_run) {
+            LOG_INFO(LOG_CATEGORY_COPY, "\nWould copy %s\n", entry.path_and_name);
+        } else {
+            copy_entry_to_destination(&entry, the_config);
+        }
+    }
+    close_uring_copy();
+    close_destination_directories();
+    fclose(plan);
+    if (stale_count > 0) {
+        fprintf(stderr, "%lu entries changed since the plan was made and were skipped, a new plan is needed\n", stale_count);
+        result = -1;
+    }
+    return result;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "files-list.h"
+#include "configuration.h"
+
+#define PLAN_MAGIC "LP25PLN1"
+#define PLAN_FLAG_MD5 0x1
+
+// A plan is made of a plan_header_t, the source and destination roots (without '\0'), then entries_count entries,
+// each a files list record of the source entry (@see files-list-io.h) followed by a plan_destination_t
+typedef struct __attribute__((packed)) {
+    char magic[8];
+    uint32_t flags; // PLAN_FLAG_* values
+    uint64_t entries_count;
+    uint16_t source_length;
+    uint16_t destination_length;
+} plan_header_t;
+
+// State of the destination of an entry when the plan was made, the plan only applies to the same state
+typedef struct __attribute__((packed)) {
+    uint8_t exists;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+} plan_destination_t;
+
+int write_plan(compact_files_list_t *difference, configuration_t *the_config);
+int apply_plan(configuration_t *the_config);
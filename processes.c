@@ -7,8 +7,76 @@
 #include "file-properties.h"
 #include "sync.h"
 #include <string.h>
+#include <stddef.h>
 #include <errno.h>
 #include <signal.h>
+#include <sys/wait.h>
+#include "stats.h"
+#include "trace.h"
+#include "log.h"
+#include "qos.h"
+#include "devices.h"
+#include "inodes.h"
+#include "journal.h"
+
+/*!
+ * @brief get_lister_queue_budget computes the bytes of the MQ each lister may fill with the entries it has in flight
+ * All the processes share the queue, and a full queue blocks its senders: a lister sending an analyze command while
+ * the analyzers wait for room to send their responses to it would never be answered. The entries in flight of both
+ * listers are kept below the capacity of the queue minus the largest message, so that a blocked sender always finds
+ * room once the main process took the messages sent to it.
+ * @param msg_queue is the id of the MQ
+ * @return the budget of a lister, in bytes
+ */
+static size_t get_lister_queue_budget(int msg_queue) {
+    struct msqid_ds queue_state;
+    size_t capacity = 16384; // Default capacity of a queue (MSGMNB)
+    if (msgctl(msg_queue, IPC_STAT, &queue_state) == 0) {
+        capacity = queue_state.msg_qbytes;
+    }
+    size_t largest_message = sizeof(any_message_t) - sizeof(long);
+    return capacity > largest_message ? (capacity - largest_message) / 2 : 0;
+}
+
+/*!
+ * @brief terminate_process sends SIGTERM to a child process, if it was created
+ * @param pid is the PID of the process, -1 if its fork failed
+ */
+static void terminate_process(pid_t pid) {
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+    }
+}
+
+/*!
+ * @brief abort_processes terminates the processes created by prepare when one of them cannot be, and frees the MQ
+ * They are not asked to terminate through the MQ: some of them never received their configuration.
+ * @param p_context is a pointer to the processes context
+ * @param analyzers_count is the number of analyzers of each side whose fork was attempted
+ * @param hashers_count is the number of hashers of each side whose fork was attempted
+ */
+static void abort_processes(process_context_t *p_context, int analyzers_count, int hashers_count) {
+    terminate_process(p_context->source_lister_pid);
+    terminate_process(p_context->destination_lister_pid);
+    for (int i = 0; i < analyzers_count; ++i) {
+        terminate_process(p_context->source_analyzers_pids[i]);
+        terminate_process(p_context->destination_analyzers_pids[i]);
+    }
+    for (int i = 0; i < hashers_count; ++i) {
+        terminate_process(p_context->source_hashers_pids[i]);
+        terminate_process(p_context->destination_hashers_pids[i]);
+    }
+    while (wait(NULL) > 0);
+    free(p_context->source_analyzers_pids);
+    free(p_context->destination_analyzers_pids);
+    free(p_context->source_hashers_pids);
+    free(p_context->destination_hashers_pids);
+    p_context->source_analyzers_pids = NULL;
+    p_context->destination_analyzers_pids = NULL;
+    p_context->source_hashers_pids = NULL;
+    p_context->destination_hashers_pids = NULL;
+    msgctl(p_context->message_queue_id, IPC_RMID, NULL);
+}
 
 /*!
  * @brief prepare prepares (only when parallel is enabled) the processes used for the synchronization.
@@ -22,9 +90,38 @@ int prepare(configuration_t *the_config, process_context_t *p_context) {
 
     //Process count 
     p_context->processes_count = the_config->processes_count;
+    p_context->hashers_count = the_config->hashers_count;
+    p_context->source_analyzers_pids = NULL;
+    p_context->destination_analyzers_pids = NULL;
+    p_context->source_hashers_pids = NULL;
+    p_context->destination_hashers_pids = NULL;
+    memset(p_context->roles_stats, 0, sizeof(p_context->roles_stats));
+    if (the_config->trace[0] != '\0') {
+        init_trace(the_config->is_parallel ? 3 + 2 * (the_config->processes_count + the_config->hashers_count) : 1);
+    }
+
+    // A daemon and a journaled run cache all the digests (the journal loads those of the interrupted run)
+    if (the_config->daemon_socket[0] != '\0' || the_config->journal[0] != '\0') {
+        init_inodes_table(INODES_DAEMON_TABLE_SIZE, true);
+    } else {
+        init_inodes_table(INODES_TABLE_SIZE, false);
+    }
+    if (the_config->journal[0] != '\0' && !open_journal(the_config)) {
+        return -1;
+    }
+
+    if (the_config->is_parallel && the_config->rotational_limit > 0) {
+        init_devices_table(the_config->rotational_limit, the_config->solid_limit);
+    }
+
+    // Rate limits and priorities hold for all the processes, that share the buckets and inherit the priorities
+    init_qos(the_config);
+    if (apply_io_priority(the_config) == -1) {
+        return -1;
+    }
 
     if (!the_config->is_parallel) {
-        printf("La configuration parallèle est désactivée.\n");
+        LOG_INFO(LOG_CATEGORY_CONFIG, "La configuration parallèle est désactivée.\n");
         return 0;
     } else {
         //Create lister for both dest & src 
@@ -33,29 +130,51 @@ int prepare(configuration_t *the_config, process_context_t *p_context) {
             fprintf(stderr, "Erreur lors de la création de la clé partagée : %s\n", strerror(errno));
             return -1;
         }
-        p_context->message_queue_id = msgget(p_context->shared_key, IPC_CREAT | 0666);
+        // Each run has its own queue, so that runs on the same host (such as a remote client and its server) do not
+        // receive the messages of each other: the key is made unique with the pid
+        p_context->shared_key ^= getpid();
+        while ((p_context->message_queue_id = msgget(p_context->shared_key, IPC_CREAT | IPC_EXCL | 0666)) == -1 && errno == EEXIST) {
+            ++p_context->shared_key;
+        }
+        if (p_context->message_queue_id == -1) {
+            perror("Failed to create the message queue");
+            return -1;
+        }
+        size_t queue_budget = get_lister_queue_budget(p_context->message_queue_id);
         lister_configuration_t lister_config_dest;
         lister_configuration_t lister_config_src;
         
-        lister_config_src.analyzers_count = the_config->processes_count;
-        lister_config_src.my_receiver_id = MSG_TYPE_TO_MAIN_FROM_SOURCE_LISTER;
+        // Credits are shared by the whole pipeline: analyzers and hashers
+        lister_config_src.analyzers_count = the_config->processes_count + the_config->hashers_count;
+        lister_config_src.queue_depth = the_config->queue_depth;
+        lister_config_src.queue_budget = queue_budget;
+        lister_config_src.direct_results = the_config->direct_results;
+        lister_config_src.largest_first = the_config->largest_first;
+        lister_config_src.adaptive_pool = the_config->adaptive_pool;
+        lister_config_src.my_receiver_id = MSG_TYPE_TO_SOURCE_LISTER;
         lister_config_src.my_recipient_id = MSG_TYPE_TO_SOURCE_ANALYZERS;
         lister_config_src.mq_key = p_context->shared_key;
         
-        lister_config_dest.analyzers_count = the_config->processes_count;
-        lister_config_dest.my_receiver_id = MSG_TYPE_TO_MAIN_FROM_DESTINATION_LISTER;
+        lister_config_dest.analyzers_count = the_config->processes_count + the_config->hashers_count;
+        lister_config_dest.queue_depth = the_config->queue_depth;
+        lister_config_dest.queue_budget = queue_budget;
+        lister_config_dest.direct_results = the_config->direct_results;
+        lister_config_dest.largest_first = the_config->largest_first;
+        lister_config_dest.adaptive_pool = the_config->adaptive_pool;
+        lister_config_dest.my_receiver_id = MSG_TYPE_TO_DESTINATION_LISTER;
         lister_config_dest.my_recipient_id = MSG_TYPE_TO_DESTINATION_ANALYZERS;
         lister_config_dest.mq_key = p_context->shared_key; 
 
         //Create pointers to function lister_process_loop & analyzers_process_loop
-        process_loop_t LPL, APL;
+        process_loop_t LPL, APL, HPL;
         LPL = (void (*) (void *))lister_process_loop; 
         APL = (void (*) (void *))analyzer_process_loop;  
+        HPL = (void (*) (void *))hasher_process_loop;
 
         p_context->source_lister_pid = make_process(p_context, LPL, &lister_config_src);
         p_context->destination_lister_pid = make_process(p_context, LPL, &lister_config_dest);
         if (p_context->source_lister_pid == -1 || p_context->destination_lister_pid == -1) { // PID -1 = FAIL
-            clean_processes(the_config, p_context);
+            abort_processes(p_context, 0, 0);
             return -1;
         }
 
@@ -64,19 +183,50 @@ int prepare(configuration_t *the_config, process_context_t *p_context) {
         p_context->destination_analyzers_pids = malloc(the_config->processes_count * sizeof(int));
         for (int i = 0; i < the_config->processes_count; i++) {
             analyzer_configuration_t analyser_config_dest;
-            analyser_config_dest.my_receiver_id = MSG_TYPE_TO_LISTER_FROM_DESTINATION_ANALYZERS;
+            analyser_config_dest.my_receiver_id = MSG_TYPE_TO_DESTINATION_ANALYZERS;
             analyser_config_dest.my_recipient_id = MSG_TYPE_TO_DESTINATION_LISTER;
             analyser_config_dest.mq_key = p_context->shared_key;
+            analyser_config_dest.use_md5 = the_config->uses_md5;
+            analyser_config_dest.direct_results = the_config->direct_results;
+            analyser_config_dest.list_code = MSG_TYPE_TO_MAIN_FROM_DESTINATION_LISTER;
+            analyser_config_dest.hashers_id = the_config->hashers_count > 0 ? MSG_TYPE_TO_DESTINATION_HASHERS : 0;
             analyzer_configuration_t analyser_config_src;
-            analyser_config_src.my_receiver_id = MSG_TYPE_TO_LISTER_FROM_SOURCE_ANALYZERS;
+            analyser_config_src.my_receiver_id = MSG_TYPE_TO_SOURCE_ANALYZERS;
             analyser_config_src.my_recipient_id = MSG_TYPE_TO_SOURCE_LISTER;
-            analyser_config_src.mq_key = p_context->shared_key; 
+            analyser_config_src.mq_key = p_context->shared_key;
+            analyser_config_src.use_md5 = the_config->uses_md5;
+            analyser_config_src.direct_results = the_config->direct_results;
+            analyser_config_src.list_code = MSG_TYPE_TO_MAIN_FROM_SOURCE_LISTER;
+            analyser_config_src.hashers_id = the_config->hashers_count > 0 ? MSG_TYPE_TO_SOURCE_HASHERS : 0;
             p_context->source_analyzers_pids[i] = make_process(p_context, APL, &analyser_config_src);
             p_context->destination_analyzers_pids[i] = make_process(p_context, APL, &analyser_config_dest); 
             if (p_context->destination_analyzers_pids[i] == -1 || p_context->source_analyzers_pids[i] == -1) {
-                //Terminate both listers process
-                kill(p_context->source_lister_pid, 0);
-                kill(p_context->destination_lister_pid, 0);
+                //Terminate the processes already created
+                abort_processes(p_context, i + 1, 0);
+                return -1;
+            }
+        }
+
+        // Create the hash pools: analyzers send them the files to hash, and hashers answer in their place
+        p_context->source_hashers_pids = malloc(the_config->hashers_count * sizeof(pid_t));
+        p_context->destination_hashers_pids = malloc(the_config->hashers_count * sizeof(pid_t));
+        for (int i = 0; i < the_config->hashers_count; i++) {
+            analyzer_configuration_t hasher_config_dest;
+            hasher_config_dest.my_receiver_id = MSG_TYPE_TO_DESTINATION_HASHERS;
+            hasher_config_dest.my_recipient_id = MSG_TYPE_TO_DESTINATION_LISTER;
+            hasher_config_dest.mq_key = p_context->shared_key;
+            hasher_config_dest.use_md5 = true;
+            hasher_config_dest.direct_results = the_config->direct_results;
+            hasher_config_dest.list_code = MSG_TYPE_TO_MAIN_FROM_DESTINATION_LISTER;
+            hasher_config_dest.hashers_id = 0;
+            analyzer_configuration_t hasher_config_src = hasher_config_dest;
+            hasher_config_src.my_receiver_id = MSG_TYPE_TO_SOURCE_HASHERS;
+            hasher_config_src.my_recipient_id = MSG_TYPE_TO_SOURCE_LISTER;
+            hasher_config_src.list_code = MSG_TYPE_TO_MAIN_FROM_SOURCE_LISTER;
+            p_context->source_hashers_pids[i] = make_process(p_context, HPL, &hasher_config_src);
+            p_context->destination_hashers_pids[i] = make_process(p_context, HPL, &hasher_config_dest);
+            if (p_context->destination_hashers_pids[i] == -1 || p_context->source_hashers_pids[i] == -1) {
+                abort_processes(p_context, the_config->processes_count, i + 1);
                 return -1;
             }
         }
@@ -92,11 +242,16 @@ int prepare(configuration_t *the_config, process_context_t *p_context) {
  * @return the PID of the child process (it never returns in the child process)
  */
 int make_process(process_context_t *p_context, process_loop_t func, void *parameters) {
+    int role = func == (process_loop_t) lister_process_loop ? ROLE_LISTER
+               : func == (process_loop_t) hasher_process_loop ? ROLE_HASHER : ROLE_ANALYZER;
+    int trace_slot = reserve_trace_buffer(role);
+    flush_log(); // The child would print the messages buffered by its parent again
     pid_t pid = fork(); // Create a new process
 
     if (pid < 0) { // If fork() failed
         return -1;
     } else if (pid == 0) { // Child process
+        attach_trace_buffer(trace_slot);
         func(parameters);
         exit(0);
     } else { // Parent process
@@ -105,8 +260,401 @@ int make_process(process_context_t *p_context, process_loop_t func, void *parame
     }
 }
 
+/*!
+ * @brief init_pool_controller initializes the number of busy analyzers of a lister
+ * Adaptive pools start with all the analyzers busy, the others always keep them so.
+ * @param controller is a pointer to the controller
+ * @param config is a pointer to the lister configuration
+ */
+static void init_pool_controller(pool_controller_t *controller, lister_configuration_t *config) {
+    controller->active = config->analyzers_count;
+    controller->max = config->analyzers_count;
+    controller->direction = -1;
+    controller->period_start_ns = stats_now();
+    controller->period_files = 0;
+    controller->period_latency_ns = 0;
+    controller->period_saturated = false;
+    controller->last_throughput = 0;
+    controller->last_latency = 0;
+}
+
+/*!
+ * @brief pool_file_analyzed accounts an analyzed file and, at the end of a period, moves the number of busy analyzers
+ * One more analyzer is kept busy while it increases the throughput, and one less while it decreases it. When the
+ * throughput does not change, the files in flight (credits of the busy analyzers) take longer to be answered if the
+ * storage is saturated (Little's law): one less analyzer is kept busy when the latency rises, since more analyzers only
+ * add latency. The number does not move after a period during which the credits were not all used: the queue bytes,
+ * the devices or the reorder window limited the dispatch, not the analyzers.
+ * @param controller is a pointer to the controller
+ * @param config is a pointer to the lister configuration
+ * @param latency_ns is the time from the dispatch of the file to its response
+ */
+static void pool_file_analyzed(pool_controller_t *controller, lister_configuration_t *config, uint64_t latency_ns) {
+    ++controller->period_files;
+    controller->period_latency_ns += latency_ns;
+    if (!config->adaptive_pool || controller->period_files < POOL_PERIOD_FILES) {
+        return;
+    }
+    uint64_t now = stats_now();
+    if (now - controller->period_start_ns < POOL_PERIOD_NS) {
+        return;
+    }
+    double throughput = controller->period_files * 1e9 / (now - controller->period_start_ns);
+    double latency = (double) controller->period_latency_ns / controller->period_files;
+    if (controller->period_saturated) {
+        if (controller->last_throughput > 0) {
+            if (throughput < controller->last_throughput * (1 - POOL_THROUGHPUT_MARGIN)) {
+                controller->direction = -controller->direction;
+            } else if (throughput <= controller->last_throughput * (1 + POOL_THROUGHPUT_MARGIN)
+                       && latency > controller->last_latency * (1 + POOL_THROUGHPUT_MARGIN)) {
+                controller->direction = -1;
+            }
+        }
+        int active = controller->active + controller->direction;
+        if (active >= 1 && active <= controller->max) {
+            controller->active = active;
+        } else {
+            controller->direction = -controller->direction;
+        }
+    }
+    LOG_DEBUG(LOG_CATEGORY_IPC, "%.0f files/s, %.0f us per file, %d analyzers busy\n", throughput, latency / 1000, controller->active);
+    controller->last_throughput = throughput;
+    controller->last_latency = latency;
+    controller->period_start_ns = now;
+    controller->period_files = 0;
+    controller->period_latency_ns = 0;
+    controller->period_saturated = false;
+}
+
+/*!
+ * @brief receive_from_analyzers waits for a message to a lister: a response of its analyzers, a command of the main
+ * process or a wake-up of the other lister
+ * @param msg_q_id is the id of the MQ
+ * @param config is a pointer to the lister configuration
+ * @param message is a pointer to the message to fill
+ */
+static void receive_from_analyzers(int msg_q_id, lister_configuration_t *config, any_message_t *message) {
+    uint64_t wait_start = stats_now();
+    uint64_t trace_start = trace_clock();
+    while (msgrcv(msg_q_id, message, sizeof(any_message_t) - sizeof(long), config->my_receiver_id, 0) == -1) {
+        if (errno != EINTR) {
+            perror("Failed to receive message");
+            exit(EXIT_FAILURE);
+        }
+    }
+    stats_add_queue_wait(wait_start);
+    trace_complete(TRACE_RECEIVE, trace_start, NULL);
+}
+
+/*!
+ * @brief init_dispatch_plan indexes the entries of a list by sequence number and groups them per device
+ * Without device limits, all the entries are in one queue.
+ * @param plan is a pointer to the plan to initialize
+ * @param list is a pointer to the list of the entries to analyze
+ * @param entries_count is the number of entries of the list
+ */
+static void init_dispatch_plan(dispatch_plan_t *plan, files_list_t *list, uint32_t entries_count) {
+    plan->entries = malloc(entries_count * sizeof(files_list_entry_t *));
+    plan->queue_of = malloc(entries_count * sizeof(int));
+    plan->queues = NULL;
+    plan->queues_count = 0;
+    plan->next_queue = 0;
+    plan->count = entries_count;
+    if ((entries_count > 0 && (plan->entries == NULL || plan->queue_of == NULL))) {
+        fprintf(stderr, "Failed to allocate memory for the dispatch plan\n");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t sequence = 0;
+    for (files_list_entry_t *cursor = list->head; cursor != NULL; cursor = cursor->next, ++sequence) {
+        int slot = get_device_slot(cursor->device);
+        int queue = 0;
+        while (queue < plan->queues_count && plan->queues[queue].slot != slot) {
+            ++queue;
+        }
+        if (queue == plan->queues_count) {
+            plan->queues = realloc(plan->queues, (plan->queues_count + 1) * sizeof(device_queue_t));
+            if (plan->queues == NULL) {
+                fprintf(stderr, "Failed to allocate memory for the dispatch plan\n");
+                exit(EXIT_FAILURE);
+            }
+            plan->queues[queue] = (device_queue_t) {slot, NULL, 0, 0, 0};
+            ++plan->queues_count;
+        }
+        device_queue_t *device_queue = &plan->queues[queue];
+        if (device_queue->count == device_queue->capacity) {
+            device_queue->capacity = device_queue->capacity == 0 ? 1024 : device_queue->capacity * 2;
+            device_queue->sequences = realloc(device_queue->sequences, device_queue->capacity * sizeof(uint32_t));
+            if (device_queue->sequences == NULL) {
+                fprintf(stderr, "Failed to allocate memory for the dispatch plan\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        device_queue->sequences[device_queue->count++] = sequence;
+        plan->entries[sequence] = cursor;
+        plan->queue_of[sequence] = queue;
+    }
+}
+
+/*!
+ * @brief free_dispatch_plan frees the memory of a dispatch plan (not its entries)
+ * @param plan is a pointer to the plan
+ */
+static void free_dispatch_plan(dispatch_plan_t *plan) {
+    for (int i = 0; i < plan->queues_count; ++i) {
+        free(plan->queues[i].sequences);
+    }
+    free(plan->queues);
+    free(plan->entries);
+    free(plan->queue_of);
+}
+
+/*!
+ * @brief compare_sizes_descending orders sized sequences by decreasing size, then by list order
+ * @param a is a pointer to the first sized_sequence_t
+ * @param b is a pointer to the second sized_sequence_t
+ * @return a negative value if a must be dispatched first, a positive one else
+ */
+static int compare_sizes_descending(const void *a, const void *b) {
+    const sized_sequence_t *first = a, *second = b;
+    if (first->size != second->size) {
+        return first->size > second->size ? -1 : 1;
+    }
+    return first->sequence < second->sequence ? -1 : 1;
+}
+
+/*!
+ * @brief sort_largest_first stats the entries of a plan and sorts each device queue by decreasing size
+ * Analyzing the largest files first (longest processing time first) keeps a large file found late from hashing alone
+ * while the other analyzers are idle. Entries whose stat fails keep their list order at the end of their queue.
+ * @param plan is a pointer to the dispatch plan
+ */
+static void sort_largest_first(dispatch_plan_t *plan) {
+    uint64_t stat_start = stats_now();
+    for (int i = 0; i < plan->queues_count; ++i) {
+        device_queue_t *device_queue = &plan->queues[i];
+        sized_sequence_t *sized = malloc(device_queue->count * sizeof(sized_sequence_t));
+        if (device_queue->count > 0 && sized == NULL) {
+            fprintf(stderr, "Failed to allocate memory for the dispatch plan\n");
+            exit(EXIT_FAILURE);
+        }
+        for (uint32_t j = 0; j < device_queue->count; ++j) {
+            struct stat sb;
+            uint32_t sequence = device_queue->sequences[j];
+            sized[j].sequence = sequence;
+            sized[j].size = lstat(plan->entries[sequence]->path_and_name, &sb) == 0 && S_ISREG(sb.st_mode) ? (uint64_t) sb.st_size : 0;
+        }
+        qsort(sized, device_queue->count, sizeof(sized_sequence_t), compare_sizes_descending);
+        for (uint32_t j = 0; j < device_queue->count; ++j) {
+            device_queue->sequences[j] = sized[j].sequence;
+        }
+        free(sized);
+    }
+    stats_add_phase(PHASE_STAT, stat_start, plan->count, 0);
+}
+
+/*!
+ * @brief next_to_dispatch picks the next entry to analyze, taking the devices in turn
+ * A device is skipped while it is at its limit, while its next entry is beyond limit_sequence, or while its next entry
+ * does not fit in the bytes of the queue left to the lister.
+ * @param plan is a pointer to the dispatch plan
+ * @param limit_sequence is the first sequence number that cannot be dispatched yet
+ * @param available_bytes is the number of bytes of the queue the lister may still fill (@see in_flight_message_size)
+ * @return the sequence number of the entry, -1 if none can be dispatched now
+ */
+static int64_t next_to_dispatch(dispatch_plan_t *plan, uint32_t limit_sequence, size_t available_bytes) {
+    for (int i = 0; i < plan->queues_count; ++i) {
+        int queue = (plan->next_queue + i) % plan->queues_count;
+        device_queue_t *device_queue = &plan->queues[queue];
+        if (device_queue->next == device_queue->count || device_queue->sequences[device_queue->next] >= limit_sequence) {
+            continue;
+        }
+        if (in_flight_message_size(plan->entries[device_queue->sequences[device_queue->next]]) > available_bytes) {
+            continue;
+        }
+        if (!acquire_device(device_queue->slot)) {
+            continue;
+        }
+        plan->next_queue = (queue + 1) % plan->queues_count;
+        return device_queue->sequences[device_queue->next++];
+    }
+    return -1;
+}
+
+/*!
+ * @brief available_queue_bytes computes the bytes of the queue a lister may still fill with entries in flight
+ * A lister without entries in flight may always send one, even if its path alone exceeds the budget.
+ * @param config is a pointer to the lister configuration
+ * @param outstanding is the number of entries in flight
+ * @param in_flight_bytes is the size of the entries in flight (@see in_flight_message_size)
+ * @return the number of bytes
+ */
+static size_t available_queue_bytes(lister_configuration_t *config, int outstanding, size_t in_flight_bytes) {
+    if (outstanding == 0) {
+        return SIZE_MAX;
+    }
+    return in_flight_bytes < config->queue_budget ? config->queue_budget - in_flight_bytes : 0;
+}
+
+/*!
+ * @brief start_lister_job lists the directory of a job and plans the dispatch of its entries
+ * @param job is a pointer to the job to initialize
+ * @param config is a pointer to the lister configuration
+ * @param command is a pointer to the analyze dir command of the job
+ */
+static void start_lister_job(lister_job_t *job, lister_configuration_t *config, analyze_dir_command_t *command) {
+    job->job = command->job;
+    job->list.head = NULL;
+    job->list.tail = NULL;
+    uint64_t listing_start = stats_now();
+    make_list(&job->list, command->target);
+    job->entries_count = 0;
+    for (files_list_entry_t *cursor = job->list.head; cursor != NULL; cursor = cursor->next) {
+        ++job->entries_count;
+    }
+    stats_add_phase(PHASE_LISTING, listing_start, job->entries_count, 0);
+
+    init_dispatch_plan(&job->plan, &job->list, job->entries_count);
+    if (config->largest_first) {
+        sort_largest_first(&job->plan);
+    }
+    job->analyzed = calloc(job->entries_count + 1, sizeof(bool));
+    job->dispatch_times = malloc((job->entries_count + 1) * sizeof(uint64_t));
+    if (job->analyzed == NULL || job->dispatch_times == NULL) {
+        fprintf(stderr, "Failed to allocate memory for analyzed entries\n");
+        exit(EXIT_FAILURE);
+    }
+    job->dispatched_count = 0;
+    job->sent_sequence = 0;
+    job->outstanding = 0;
+}
+
+/*!
+ * @brief free_lister_job frees the memory of a job whose list was sent to the main process
+ * @param job is a pointer to the job
+ */
+static void free_lister_job(lister_job_t *job) {
+    free(job->analyzed);
+    free(job->dispatch_times);
+    free_dispatch_plan(&job->plan);
+    clear_files_list(&job->list);
+}
+
+/*!
+ * @brief is_lister_job_done tells if all the entries of a job reached the main process
+ * @param job is a pointer to the job
+ * @param config is a pointer to the lister configuration
+ * @return true if the end of its list can be sent, false else
+ */
+static bool is_lister_job_done(lister_job_t *job, lister_configuration_t *config) {
+    if (config->direct_results) {
+        return job->dispatched_count == job->entries_count && job->outstanding == 0;
+    }
+    return job->sent_sequence == job->entries_count;
+}
+
+/*!
+ * @brief dispatch_entries has entries of the jobs of a lister analyzed, as long as it has credits
+ * Dispatch is credit based: queue_depth files per busy analyzer (@see pool_file_analyzed) are sent ahead, so that an
+ * analyzer always finds its next file in the queue, and each response returns a credit. Credits are also bounded by the
+ * bytes the entries in flight take in the shared queue (@see get_lister_queue_budget): a lister with long paths has
+ * fewer files ahead, and at least one whatever its length. The jobs share the credits: they are taken in turn, one
+ * entry each, so that a large job does not hold back the small ones started with it. With device limits, devices are
+ * taken in turn and a device at its limit (possibly because of the other lister) is skipped.
+ * Without direct results, the lister relays the results to the main process in list order, and does not dispatch an
+ * entry LISTER_REORDER_FACTOR times the credits places after the first entry of its job not relayed yet (unless the
+ * largest files go first). With direct results, the analyzers send them to the main process, which orders them.
+ * @param msg_q_id is the id of the MQ
+ * @param config is a pointer to the lister configuration
+ * @param state is a pointer to the jobs of the lister
+ */
+static void dispatch_entries(int msg_q_id, lister_configuration_t *config, lister_state_t *state) {
+    uint32_t window = config->analyzers_count * config->queue_depth * LISTER_REORDER_FACTOR;
+    int credits = state->controller.active * config->queue_depth;
+    bool dispatched = true;
+    while (state->outstanding < credits && dispatched) {
+        dispatched = false;
+        for (int i = 0; i < state->jobs_count && !dispatched; ++i) {
+            int index = (state->next_job + i) % state->jobs_count;
+            lister_job_t *job = &state->jobs[index];
+            uint32_t limit_sequence = config->direct_results || config->largest_first ? job->entries_count : job->sent_sequence + window;
+            int64_t sequence = next_to_dispatch(&job->plan, limit_sequence,
+                                                available_queue_bytes(config, state->outstanding, state->in_flight_bytes));
+            if (sequence == -1) {
+                continue;
+            }
+            send_analyze_file_command(msg_q_id, config->my_recipient_id, job->plan.entries[sequence], job->job, sequence);
+            job->dispatch_times[sequence] = stats_now();
+            state->in_flight_bytes += in_flight_message_size(job->plan.entries[sequence]);
+            ++job->dispatched_count;
+            ++job->outstanding;
+            ++state->outstanding;
+            state->next_job = (index + 1) % state->jobs_count;
+            dispatched = true;
+        }
+    }
+    if (state->outstanding >= credits) {
+        state->controller.period_saturated = true;
+    }
+}
+
+/*!
+ * @brief file_analyzed gets the credit of an analyzed entry back, relays the entries now in order to the main process,
+ * and ends the job once its whole list reached the main process
+ * @param msg_q_id is the id of the MQ
+ * @param config is a pointer to the lister configuration
+ * @param state is a pointer to the jobs of the lister
+ * @param response is a pointer to the response of the analyzer (or hasher)
+ * @param entry_code is the op code of the entries sent to the main process
+ */
+static void file_analyzed(int msg_q_id, lister_configuration_t *config, lister_state_t *state, files_list_entry_transmit_t *response, int entry_code) {
+    int index = 0;
+    while (index < state->jobs_count && state->jobs[index].job != response->job) {
+        ++index;
+    }
+    if (index == state->jobs_count) {
+        return;
+    }
+    lister_job_t *job = &state->jobs[index];
+    uint32_t sequence = response->sequence;
+    if (sequence >= job->entries_count || job->analyzed[sequence]) {
+        return;
+    }
+    job->analyzed[sequence] = true;
+    int waiting_listers = release_device(job->plan.queues[job->plan.queue_of[sequence]].slot);
+    for (int lister_id = MSG_TYPE_TO_SOURCE_LISTER; lister_id <= MSG_TYPE_TO_DESTINATION_LISTER; ++lister_id) {
+        if (lister_id != config->my_receiver_id && (waiting_listers & (1 << lister_id)) != 0) {
+            send_device_released(msg_q_id, lister_id);
+        }
+    }
+    state->in_flight_bytes -= in_flight_message_size(job->plan.entries[sequence]);
+    --state->outstanding;
+    --job->outstanding;
+    pool_file_analyzed(&state->controller, config, stats_now() - job->dispatch_times[sequence]);
+    if (!config->direct_results) {
+        //Store its result in the list, and send the freshly analyzed entries to the main, in list order
+        memcpy(job->plan.entries[sequence], &response->payload, offsetof(files_list_entry_t, next));
+        while (job->sent_sequence < job->entries_count && job->analyzed[job->sent_sequence]) {
+            send_analyzed_entry(msg_q_id, MSG_TYPE_TO_MAIN, job->plan.entries[job->sent_sequence], entry_code, job->job, job->sent_sequence);
+            ++job->sent_sequence;
+        }
+    }
+    if (is_lister_job_done(job, config)) {
+        send_list_end(msg_q_id, MSG_TYPE_TO_MAIN, entry_code, job->job, job->entries_count);
+        free_lister_job(job);
+        state->jobs[index] = state->jobs[--state->jobs_count];
+        if (state->next_job >= state->jobs_count) {
+            state->next_job = 0;
+        }
+    }
+}
+
 /*!
  * @brief lister_process_loop is the lister process function (@see make_process)
+ * It lists the directories it is asked to, has each entry analyzed, and sends the analyzed entries to the main process
+ * in list order, as soon as all the entries before them are analyzed (or has the analyzers send them directly).
+ * Directories asked while others are being analyzed (the jobs of a batch) are analyzed at the same time.
+ * A lister whose devices are all held by the other one sleeps in msgrcv until the other lister releases one of them and
+ * wakes it up.
  * @param parameters is a pointer to its parameters, to be cast to a lister_configuration_t
  */
 void lister_process_loop(lister_configuration_t *parameters) {
@@ -114,88 +662,80 @@ void lister_process_loop(lister_configuration_t *parameters) {
     //When sent, build a list with only the path of the files 
     lister_configuration_t *config = (lister_configuration_t *)parameters;
     any_message_t message; 
-    simple_command_t message_end; 
     int msg_q_id = msgget(config->mq_key, 0666);
-    //analyze_dir_command_t test;
-    //int cpt = -1;
-    bool loop = true;
-    /*while (cpt == -1){
-        int c = msgrcv(msg_q_id, &test, sizeof(analyze_dir_command_t) - sizeof(long), config->my_receiver_id, IPC_NOWAIT);
-        printf("%s\n", test.target);
-        printf("%d\n", c);
-        cpt++;
-        
-    }*/
-    while(loop){
-        printf("Waiting for a message lister proccess loop\n");
-        fflush(stdout);
-        if(msgrcv(msg_q_id, &message.analyze_dir_command, sizeof(analyze_dir_command_t) - sizeof(long), config->my_receiver_id, 0) != -1){
-            
-            if (message.analyze_file_command.op_code == COMMAND_CODE_ANALYZE_DIR) {
-                loop = false;
-            } else if (message.simple_command.message == COMMAND_CODE_TERMINATE) {
-                loop = false;
+    // Entries are sent to main with the op code telling which list they belong to
+    int entry_code = config->my_receiver_id == MSG_TYPE_TO_SOURCE_LISTER ? MSG_TYPE_TO_MAIN_FROM_SOURCE_LISTER : MSG_TYPE_TO_MAIN_FROM_DESTINATION_LISTER;
+    lister_state_t state;
+    memset(&state, 0, sizeof(lister_state_t));
+    bool waiting_device = false;
+    // A lister serves directories until it is terminated (several of them in daemon mode)
+    while (true) {
+        if (state.jobs_count > 0) {
+            dispatch_entries(msg_q_id, config, &state);
+            if (state.outstanding == 0 && !waiting_device) {
+                // All the devices of the remaining entries are busy with the other lister's entries: register, try
+                // once more, then sleep until the other lister releases a device (@see wait_for_device)
+                wait_for_device(config->my_receiver_id);
+                waiting_device = true;
+                continue;
             }
+            waiting_device = false;
         }
-        
-    }
-    printf("Message received\n");
-    
-    if (message.analyze_file_command.op_code == COMMAND_CODE_ANALYZE_DIR) {
+        LOG_DEBUG(LOG_CATEGORY_IPC, "Waiting for a message lister proccess loop\n");
+        receive_from_analyzers(msg_q_id, config, &message);
+        if (message.simple_command.message == COMMAND_CODE_TERMINATE) {
+            break;
+        }
+        if (message.list_entry.op_code == COMMAND_CODE_FILE_ANALYZED) {
+            file_analyzed(msg_q_id, config, &state, &message.list_entry, entry_code);
+            continue;
+        }
+        if (message.analyze_dir_command.op_code != COMMAND_CODE_ANALYZE_DIR) {
+            continue;
+        }
+        LOG_DEBUG(LOG_CATEGORY_IPC, "Message received\n");
+
         //The process is asked to make a list out of this directory
-        //Build the list 
-        
-        files_list_t l; 
-        l.head = NULL; 
-        l.tail = NULL; 
-        make_list(&l, message.analyze_dir_command.target); 
-        //Send the n-th first element of the list to the n analyzers 
-        files_list_entry_t *p = l.head;
-        int sent_requests = config->analyzers_count;
-        int answer_received = 0; 
-        analyze_file_command_t response; 
-        while(p != NULL || answer_received != sent_requests){
-            //printf("aaaaaaaaaaaaaaaaaaa\n");
-            ssize_t rcv_result = msgrcv(msg_q_id, &response, sizeof(response.op_code), config->my_receiver_id, IPC_NOWAIT);
-            if (rcv_result != -1) {
-                //printf("bbbbbbbbbbbbbbbbbb\n");
-                //The lister got an answer from one of the n analyzers 
-                if(response.op_code == COMMAND_CODE_FILE_ANALYZED){
-                    //The analyzer finished its work
-                    
-                    send_files_list_element(msg_q_id, config->my_receiver_id, &response.payload);
-                    answer_received++; 
-                    sent_requests--; 
-                }
-                //If one of the analyzer is unoccupied, send it another element of the list
-                if (sent_requests != config->analyzers_count && p != NULL) {
-                    send_analyze_file_command(msg_q_id, config->my_recipient_id, p);
-                    p = p->next; 
-                    answer_received--;
-                }
-            }
-            else {
-                if (errno != ENOMSG) {
-                    perror("Failed to receive message");
-                    exit(EXIT_FAILURE);
-                } else {
-                    printf("No message of the desired type\n");
-                }
+        if (state.jobs_count == state.jobs_capacity) {
+            state.jobs_capacity = state.jobs_capacity == 0 ? 4 : state.jobs_capacity * 2;
+            state.jobs = realloc(state.jobs, state.jobs_capacity * sizeof(lister_job_t));
+            if (state.jobs == NULL) {
+                fprintf(stderr, "Failed to allocate memory for the jobs\n");
+                exit(EXIT_FAILURE);
             }
         }
-        //Send the freshly received datas to the main
-        if (config->my_receiver_id == MSG_TYPE_TO_MAIN_FROM_DESTINATION_LISTER){
-            send_list_end(msg_q_id, MSG_TYPE_TO_MAIN_FROM_END_DEST_LISTER); 
+        lister_job_t *job = &state.jobs[state.jobs_count];
+        start_lister_job(job, config, &message.analyze_dir_command);
+        if (job->entries_count == 0) {
+            send_list_end(msg_q_id, MSG_TYPE_TO_MAIN, entry_code, job->job, 0);
+            free_lister_job(job);
+            continue;
         }
-        else if (config->my_receiver_id == MSG_TYPE_TO_MAIN_FROM_SOURCE_LISTER){
-            send_list_end(msg_q_id, MSG_TYPE_TO_MAIN_FROM_END_SRC_LISTER); 
+        if (state.jobs_count == 0) {
+            init_pool_controller(&state.controller, config);
         }
-    } 
+        ++state.jobs_count;
+    }
+    free(state.jobs);
 
-    if (msgrcv(msg_q_id, &message_end, sizeof(message_end.message), config->my_receiver_id, 0) != -1) {
-        if (message_end.message == COMMAND_CODE_TERMINATE) {
-            send_terminate_confirm(msg_q_id, config->my_recipient_id);
-        }
+    send_stats_report(msg_q_id, MSG_TYPE_TO_MAIN, ROLE_LISTER);
+    send_terminate_confirm(msg_q_id, MSG_TYPE_TO_MAIN);
+}
+
+/*!
+ * @brief send_analysis_result sends an analyzed entry to its lister, or to the main process with a credit to its lister
+ * @param msg_id is the id of the MQ
+ * @param config is a pointer to the configuration of the analyzer (or hasher)
+ * @param entry is a pointer to the analyzed entry
+ * @param job is the job of its lister's list
+ * @param sequence is the index of the entry in its lister's list
+ */
+static void send_analysis_result(int msg_id, analyzer_configuration_t *config, files_list_entry_t *entry, int job, uint32_t sequence) {
+    if (config->direct_results) {
+        send_analyzed_entry(msg_id, MSG_TYPE_TO_MAIN, entry, config->list_code, job, sequence);
+        send_analyze_file_done(msg_id, config->my_recipient_id, job, sequence);
+    } else {
+        send_analyze_file_response(msg_id, config->my_recipient_id, entry, job, sequence);
     }
 }
 
@@ -207,57 +747,113 @@ void analyzer_process_loop(analyzer_configuration_t *parameters) {
     //The analyzer puts himself in a waiting state
     analyzer_configuration_t *config = (analyzer_configuration_t *)parameters;
     any_message_t message;
+    message.simple_command.message = COMMAND_CODE_ANALYZE_FILE;
     int msg_id = msgget(config->mq_key, 0666);
     do{
+        uint64_t wait_start = stats_now();
+        uint64_t trace_start = trace_clock();
         if (msgrcv(msg_id, &message, sizeof(any_message_t) - sizeof(long), config->my_receiver_id, 0) != -1) {
+            stats_add_queue_wait(wait_start);
+            trace_complete(TRACE_RECEIVE, trace_start, NULL);
             if (message.analyze_file_command.op_code==COMMAND_CODE_ANALYZE_FILE){
-                get_file_stats(&message.analyze_file_command.payload);
-                send_analyze_file_command(msg_id,config->my_recipient_id,&message.analyze_file_command.payload);
+                files_list_entry_t *entry = &message.analyze_file_command.payload;
+                trace_start = trace_clock();
+                if (config->hashers_id == 0) {
+                    get_file_stats(entry);
+                } else if (get_file_metadata(entry) == 0 && entry->entry_type == FICHIER && config->use_md5) {
+                    // The hash pool completes the analysis and answers. The forward replaces the analyze command in
+                    // the lister's budget, but the queue may be full of messages for the main process: the analyzer
+                    // hashes the file itself rather than wait for room
+                    if (forward_analyze_file_command(msg_id, config->hashers_id, entry, message.analyze_file_command.job,
+                                                     message.analyze_file_command.sequence) == 0) {
+                        trace_complete(TRACE_ANALYZE_FILE, trace_start, entry->path_and_name);
+                        continue;
+                    }
+                    compute_inode_md5(entry);
+                }
+                trace_complete(TRACE_ANALYZE_FILE, trace_start, entry->path_and_name);
+                send_analysis_result(msg_id, config, entry, message.analyze_file_command.job, message.analyze_file_command.sequence);
             }
         }
     } while (message.simple_command.message != COMMAND_CODE_TERMINATE);
+    send_stats_report(msg_id, MSG_TYPE_TO_MAIN, ROLE_ANALYZER);
+    send_terminate_confirm(msg_id, MSG_TYPE_TO_MAIN);
+}
+
+/*!
+ * @brief hasher_process_loop is the process function of the hash pool
+ * Hashers compute the MD5 sum of the files whose metadata an analyzer already got, and answer in its place.
+ * @param parameters is a pointer to its parameters, to be cast to an analyzer_configuration_t
+ */
+void hasher_process_loop(analyzer_configuration_t *parameters) {
+    analyzer_configuration_t *config = (analyzer_configuration_t *)parameters;
+    any_message_t message;
+    message.simple_command.message = COMMAND_CODE_ANALYZE_FILE;
+    int msg_id = msgget(config->mq_key, 0666);
+    do {
+        uint64_t wait_start = stats_now();
+        uint64_t trace_start = trace_clock();
+        if (msgrcv(msg_id, &message, sizeof(any_message_t) - sizeof(long), config->my_receiver_id, 0) != -1) {
+            stats_add_queue_wait(wait_start);
+            trace_complete(TRACE_RECEIVE, trace_start, NULL);
+            if (message.analyze_file_command.op_code == COMMAND_CODE_ANALYZE_FILE) {
+                files_list_entry_t *entry = &message.analyze_file_command.payload;
+                trace_start = trace_clock();
+                compute_inode_md5(entry);
+                trace_complete(TRACE_ANALYZE_FILE, trace_start, entry->path_and_name);
+                send_analysis_result(msg_id, config, entry, message.analyze_file_command.job, message.analyze_file_command.sequence);
+            }
+        }
+    } while (message.simple_command.message != COMMAND_CODE_TERMINATE);
+    send_stats_report(msg_id, MSG_TYPE_TO_MAIN, ROLE_HASHER);
     send_terminate_confirm(msg_id, MSG_TYPE_TO_MAIN);
 }
 
 /*!
  * @brief clean_processes cleans the processes by sending them a terminate command and waiting to the confirmation
+ * The statistics the processes send before their confirmation are gathered in the processes context.
  * @param the_config is a pointer to the program configuration
  * @param p_context is a pointer to the processes context
  */
 void clean_processes(configuration_t *the_config, process_context_t *p_context) {
     // Do nothing if not parallel
     if (the_config->is_parallel) {
-        int loop_dl = 1;
-        int loop_sl = 1;
-        int loop_da = 1;
-        int loop_sa = 1;
-        simple_command_t message_end;
-
-        // Send terminate
+        // Send terminate: one per lister, one per analyzer
         send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_DESTINATION_LISTER); 
         send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_SOURCE_LISTER);
-        send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_DESTINATION_ANALYZERS);
-        send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_SOURCE_ANALYZERS);
+        for (int i = 0; i < the_config->processes_count; ++i) {
+            send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_DESTINATION_ANALYZERS);
+            send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_SOURCE_ANALYZERS);
+        }
+        for (int i = 0; i < the_config->hashers_count; ++i) {
+            send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_DESTINATION_HASHERS);
+            send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_SOURCE_HASHERS);
+        }
 
         // Wait for responses
-        while (loop_dl && loop_sl && loop_sa && loop_da) { 
-            if (msgrcv(p_context->message_queue_id, &message_end, sizeof(message_end.message), MSG_TYPE_TO_DESTINATION_LISTER, 0) != -1){ 
-                loop_dl = 0;
-            }
-            if (msgrcv(p_context->message_queue_id, &message_end, sizeof(message_end.message), MSG_TYPE_TO_SOURCE_LISTER, 0) != -1){ 
-                loop_sl = 0;
-            }
-            if (msgrcv(p_context->message_queue_id, &message_end, sizeof(message_end.message), MSG_TYPE_TO_DESTINATION_ANALYZERS, 0) != -1){ 
-                loop_da = 0;
+        int pending_confirmations = 2 + 2 * (the_config->processes_count + the_config->hashers_count);
+        any_message_t message;
+        while (pending_confirmations > 0) {
+            if (msgrcv(p_context->message_queue_id, &message, sizeof(any_message_t) - sizeof(long), MSG_TYPE_TO_MAIN, 0) == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("Failed to receive terminate confirmation");
+                break;
             }
-            if (msgrcv(p_context->message_queue_id, &message_end, sizeof(message_end.message), MSG_TYPE_TO_SOURCE_ANALYZERS, 0) != -1){ 
-                loop_sa = 0;
+            if (message.stats_report.op_code == COMMAND_CODE_STATS_REPORT && message.stats_report.role < ROLES_COUNT) {
+                merge_stats(&p_context->roles_stats[message.stats_report.role], &message.stats_report.stats);
+            } else if (message.simple_command.message == COMMAND_CODE_TERMINATE_OK) {
+                --pending_confirmations;
             }
         }
+        while (wait(NULL) > 0);
 
         // Free allocated memory 
         free(p_context->source_analyzers_pids);
         free(p_context->destination_analyzers_pids);
+        free(p_context->source_hashers_pids);
+        free(p_context->destination_hashers_pids);
 
         // Free the MQ
         msgctl(p_context->message_queue_id, IPC_RMID, NULL);
@@ -5,6 +5,12 @@
 #include <sys/types.h>
 #include "files-list.h"
 #include <stdbool.h>
+#include "stats.h"
+
+#define LISTER_REORDER_FACTOR 4 // Entries a lister may have analyzed ahead of the first one not analyzed, per credit
+#define POOL_PERIOD_NS 100000000 // Minimal duration of an adaptive pool measurement period
+#define POOL_PERIOD_FILES 32 // Minimal number of files analyzed during an adaptive pool measurement period
+#define POOL_THROUGHPUT_MARGIN 0.05 // Relative throughput change considered as significant
 
 typedef struct {
     uint8_t processes_count;
@@ -13,14 +19,84 @@ typedef struct {
     pid_t destination_lister_pid;
     pid_t *source_analyzers_pids;
     pid_t *destination_analyzers_pids;
+    uint8_t hashers_count; // Processes of each hash pool
+    pid_t *source_hashers_pids;
+    pid_t *destination_hashers_pids;
     key_t shared_key;
     int message_queue_id;
+    stats_t roles_stats[ROLES_COUNT]; // Statistics reported by the processes, per role
 } process_context_t;
 
+// Number of analyzers a lister keeps busy (-n auto), adjusted by hill climbing on the measured throughput and latency
+typedef struct {
+    int active; // Analyzers kept busy
+    int max; // Analyzers spawned
+    int direction; // Last change of active (+1 or -1)
+    uint64_t period_start_ns;
+    uint64_t period_files;
+    uint64_t period_latency_ns; // Sum of the times from dispatch to response of the files of the period
+    bool period_saturated; // The credits of the busy analyzers were all used during the period
+    double last_throughput; // Files per second during the previous period, 0 before the first one
+    double last_latency; // Mean time from dispatch to response during the previous period, in ns
+} pool_controller_t;
+
+// Entries of a lister on one device, in list order
+typedef struct {
+    int slot; // Slot of the device (@see get_device_slot), -1 when it is not limited
+    uint32_t *sequences;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t next; // Index in sequences of the next entry to dispatch
+} device_queue_t;
+
+// Size of an entry to dispatch, to sort the entries of a device queue
+typedef struct {
+    uint64_t size;
+    uint32_t sequence;
+} sized_sequence_t;
+
+typedef struct {
+    files_list_entry_t **entries; // Entries by sequence number (list order)
+    int *queue_of; // Device queue of each entry, by sequence number
+    uint32_t count;
+    device_queue_t *queues;
+    int queues_count;
+    int next_queue; // Queue to look at first for the next dispatch
+} dispatch_plan_t;
+
+// List of a job a lister has analyzed (@see dispatch_job_entries), jobs share the credits of the lister
+typedef struct {
+    int job; // Job of the list (@see run_batch), 0 outside a batch
+    files_list_t list;
+    uint32_t entries_count;
+    dispatch_plan_t plan;
+    bool *analyzed; // Entries whose response was received, by sequence number
+    uint64_t *dispatch_times; // Dispatch time of each entry, by sequence number
+    uint32_t dispatched_count;
+    uint32_t sent_sequence; // First entry not relayed to the main process yet
+    int outstanding; // Entries of the job in flight
+} lister_job_t;
+
+// Jobs a lister has analyzed at the same time, and the credits they share
+typedef struct {
+    lister_job_t *jobs;
+    int jobs_count;
+    int jobs_capacity;
+    int next_job; // Job to look at first for the next dispatch
+    int outstanding; // Entries in flight, all the jobs together
+    size_t in_flight_bytes; // Size of the entries in flight (@see in_flight_message_size)
+    pool_controller_t controller;
+} lister_state_t;
+
 typedef struct {
     int my_recipient_id; // Id of analyzers' MQ topic
     int my_receiver_id; // Id of MQ topic to listen to
-    int analyzers_count; // Number of analyzers available
+    int analyzers_count; // Number of analyzers (and hashers) available
+    int queue_depth; // Files sent ahead to each analyzer
+    size_t queue_budget; // Bytes of the MQ the entries this lister has in flight may take (@see in_flight_message_size)
+    bool direct_results; // Analyzers send the results to the main process
+    bool adaptive_pool; // Adapt the number of busy analyzers to the throughput
+    bool largest_first; // Dispatch the largest files first
     key_t mq_key;
 } lister_configuration_t;
 
@@ -29,6 +105,9 @@ typedef struct {
     int my_receiver_id; // Id I must listen to
     key_t mq_key;
     bool use_md5; // Set to true when computing MD5sum for files
+    bool direct_results; // Send the results to the main process, and only a credit to my lister
+    int list_code; // Op code of the results sent to the main process
+    int hashers_id; // Id of the hash pool's MQ topic, 0 when the analyzer hashes files itself
 } analyzer_configuration_t;
 
 typedef void (*process_loop_t)(void *);
@@ -37,5 +116,6 @@ int prepare(configuration_t *the_config, process_context_t *p_context);
 int make_process(process_context_t *p_context, process_loop_t func, void *parameters);
 void lister_process_loop(lister_configuration_t *parameters);
 void analyzer_process_loop(analyzer_configuration_t *parameters);
+void hasher_process_loop(analyzer_configuration_t *parameters);
 void clean_processes(configuration_t *the_config, process_context_t *p_context);
 void request_element_details(int msg_queue, files_list_entry_t *entry, lister_configuration_t *cfg, int *current_analyzers);
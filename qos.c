@@ -0,0 +1,105 @@
+#include "qos.h"
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include "stats.h"
+
+// ioprio_set has no glibc wrapper (@see linux/ioprio.h)
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+static qos_table_t *qos_table = NULL;
+
+/*!
+ * @brief init_qos enables the rate limits of the configuration, it must be called before the processes are forked
+ * @param the_config is a pointer to the configuration
+ * @return true if a resource is limited, false else
+ */
+bool init_qos(configuration_t *the_config) {
+    double rates[QOS_BUCKETS_COUNT] = {the_config->read_rate, the_config->write_rate, the_config->files_rate};
+    if (rates[QOS_READ_BYTES] == 0 && rates[QOS_WRITE_BYTES] == 0 && rates[QOS_FILES] == 0) {
+        return false;
+    }
+    qos_table_t *table = mmap(NULL, sizeof(qos_table_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED) {
+        perror("Failed to map rate limits");
+        return false;
+    }
+    table->lock = 0;
+    uint64_t now = stats_now();
+    for (int i = 0; i < QOS_BUCKETS_COUNT; ++i) {
+        table->buckets[i].rate = rates[i];
+        table->buckets[i].burst = rates[i] * QOS_BURST_NS / 1e9 > 1 ? rates[i] * QOS_BURST_NS / 1e9 : 1;
+        table->buckets[i].tokens = table->buckets[i].burst;
+        table->buckets[i].refill_ns = now;
+    }
+    qos_table = table;
+    return true;
+}
+
+/*!
+ * @brief apply_io_priority sets the I/O class and the nice level of the configuration to the current process
+ * Children inherit both, so it is called once before the processes are forked.
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int apply_io_priority(configuration_t *the_config) {
+    if (the_config->io_class != IO_CLASS_NONE) {
+        int io_class = the_config->io_class == IO_CLASS_IDLE ? IOPRIO_CLASS_IDLE : IOPRIO_CLASS_BE;
+        int level = the_config->io_class == IO_CLASS_IDLE ? 0 : the_config->io_level;
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, (io_class << IOPRIO_CLASS_SHIFT) | level) == -1) {
+            perror("Failed to set the I/O priority");
+            return -1;
+        }
+    }
+    if (the_config->nice_level != 0 && setpriority(PRIO_PROCESS, 0, the_config->nice_level) == -1) {
+        perror("Failed to set the nice level");
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief is_throttled tells if a resource is limited
+ * @param bucket is the resource
+ * @return true if it has a rate limit, false else
+ */
+bool is_throttled(qos_bucket_t bucket) {
+    return qos_table != NULL && qos_table->buckets[bucket].rate > 0;
+}
+
+/*!
+ * @brief qos_throttle takes tokens from a bucket, and sleeps until the bucket is no more in debt
+ * The time spent sleeping is added to the throttling delay of the process statistics.
+ * @param bucket is the limited resource
+ * @param amount is the number of tokens (bytes or files) to take
+ */
+void qos_throttle(qos_bucket_t bucket, uint64_t amount) {
+    if (!is_throttled(bucket) || amount == 0) {
+        return;
+    }
+    token_bucket_t *limit = &qos_table->buckets[bucket];
+    while (__atomic_test_and_set(&qos_table->lock, __ATOMIC_ACQUIRE));
+    uint64_t now = stats_now();
+    limit->tokens += (now - limit->refill_ns) / 1e9 * limit->rate;
+    if (limit->tokens > limit->burst) {
+        limit->tokens = limit->burst;
+    }
+    limit->refill_ns = now;
+    limit->tokens -= amount;
+    double debt = -limit->tokens;
+    __atomic_clear(&qos_table->lock, __ATOMIC_RELEASE);
+    if (debt <= 0) {
+        return;
+    }
+    uint64_t wait_ns = debt / limit->rate * 1e9;
+    struct timespec delay = {wait_ns / 1000000000, wait_ns % 1000000000};
+    while (nanosleep(&delay, &delay) == -1 && errno == EINTR);
+    process_stats.throttle_wait_ns += stats_now() - now;
+}
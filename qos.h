@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "configuration.h"
+
+#define QOS_CHUNK_SIZE (1024 * 1024) // Bytes read or copied between two throttling points, at most
+#define QOS_BURST_NS 100000000 // Tokens a bucket saves while idle: 100 ms of its rate
+
+typedef enum {QOS_READ_BYTES, QOS_WRITE_BYTES, QOS_FILES, QOS_BUCKETS_COUNT} qos_bucket_t;
+
+// Rate limit of a resource: tokens are refilled at rate per second, up to burst, and may go negative, so that a
+// request larger than the burst waits for the time its tokens take to come
+typedef struct {
+    double rate; // Tokens per second, 0 when the resource is not limited
+    double burst;
+    double tokens;
+    uint64_t refill_ns; // Time of the last refill
+} token_bucket_t;
+
+// Lives in a shared mapping created before the fork, so that the limits hold for all the processes together
+typedef struct {
+    int lock; // Protects the buckets
+    token_bucket_t buckets[QOS_BUCKETS_COUNT];
+} qos_table_t;
+
+bool init_qos(configuration_t *the_config);
+int apply_io_priority(configuration_t *the_config);
+bool is_throttled(qos_bucket_t bucket);
+void qos_throttle(qos_bucket_t bucket, uint64_t amount);
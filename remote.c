@@ -0,0 +1,591 @@
+#include "remote.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <zlib.h>
+#include "defines.h"
+#include "utility.h"
+#include "files-list-io.h"
+#include "sync.h"
+#include "stats.h"
+#include "qos.h"
+#include "log.h"
+#include "dir-cache.h"
+
+// In remote mode, the destination tree is handled by a server running beside it (--serve): it lists and analyzes the
+// destination with its own processes, and writes the files the client sends. A session is made of:
+//     client: HELLO, then (while the server lists and analyzes the destination) the client analyzes the source
+//     server: ENTRIES... LIST_END
+//     client: (FILE [DATA...] FILE_END)... DONE, sent without waiting for the server
+//     server: RESULT
+// Frames are gathered in a buffer and sent by REMOTE_BUFFER_SIZE, so that entries and small files are batched.
+
+static volatile sig_atomic_t server_stopping = 0;
+static int remote_socket = -1;
+static bool remote_failed = false; // The connection broke, the next frames are dropped
+static bool remote_compress = false;
+static uint8_t output_buffer[REMOTE_BUFFER_SIZE];
+static size_t output_length = 0;
+static uint8_t frame_payload[REMOTE_CHUNK_SIZE + REMOTE_CHUNK_SIZE / 8 + 1024]; // Largest frame, a compressed chunk
+static uint8_t data_chunk[REMOTE_CHUNK_SIZE];
+
+/*!
+ * @brief stop_server is the handler of the signals that stop the server
+ * @param signal is the number of the received signal
+ */
+static void stop_server(int signal) {
+    (void) signal;
+    server_stopping = 1;
+}
+
+/*!
+ * @brief write_fully writes a whole buffer to a socket
+ * @param fd is the socket
+ * @param data is the buffer
+ * @param length is the number of bytes to write
+ * @return 0 in case of success, -1 else
+ */
+static int write_fully(int fd, const void *data, size_t length) {
+    const uint8_t *cursor = data;
+    while (length > 0) {
+        ssize_t written = write(fd, cursor, length);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        cursor += written;
+        length -= written;
+    }
+    return 0;
+}
+
+/*!
+ * @brief read_fully reads a whole buffer from a socket
+ * @param fd is the socket
+ * @param data is the buffer
+ * @param length is the number of bytes to read
+ * @return 0 in case of success, -1 else (error or end of the connection)
+ */
+static int read_fully(int fd, void *data, size_t length) {
+    uint8_t *cursor = data;
+    while (length > 0) {
+        ssize_t received = read(fd, cursor, length);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return -1;
+        }
+        cursor += received;
+        length -= received;
+    }
+    return 0;
+}
+
+/*!
+ * @brief flush_frames sends the gathered frames
+ * @param fd is the socket
+ * @return 0 in case of success, -1 else
+ */
+static int flush_frames(int fd) {
+    int result = write_fully(fd, output_buffer, output_length);
+    output_length = 0;
+    return result;
+}
+
+/*!
+ * @brief put_frame adds a frame to the gathered frames, sending them when the buffer is full
+ * @param fd is the socket
+ * @param type is the type of the frame
+ * @param payload is the payload of the frame
+ * @param length is the length of the payload
+ * @return 0 in case of success, -1 else
+ */
+static int put_frame(int fd, remote_frame_type_t type, const void *payload, size_t length) {
+    remote_frame_header_t header = {type, length};
+    if (output_length + sizeof(header) + length > REMOTE_BUFFER_SIZE && flush_frames(fd) == -1) {
+        return -1;
+    }
+    if (sizeof(header) + length > REMOTE_BUFFER_SIZE) {
+        return write_fully(fd, &header, sizeof(header)) == -1 || write_fully(fd, payload, length) == -1 ? -1 : 0;
+    }
+    memcpy(output_buffer + output_length, &header, sizeof(header));
+    memcpy(output_buffer + output_length + sizeof(header), payload, length);
+    output_length += sizeof(header) + length;
+    return 0;
+}
+
+/*!
+ * @brief read_frame reads the next frame of a socket into frame_payload
+ * @param fd is the socket
+ * @param header is a pointer to the header to fill
+ * @return 0 in case of success, -1 else (error, end of the connection or frame too large)
+ */
+static int read_frame(int fd, remote_frame_header_t *header) {
+    if (read_fully(fd, header, sizeof(remote_frame_header_t)) == -1 || header->length > sizeof(frame_payload)) {
+        return -1;
+    }
+    return read_fully(fd, frame_payload, header->length);
+}
+
+/*!
+ * @brief open_socket opens a listening or a connected socket
+ * @param address is a UNIX socket path (with a /) or host:port
+ * @param listening tells to listen to the address instead of connecting to it
+ * @return the socket, -1 in case of error
+ */
+static int open_socket(char *address, bool listening) {
+    if (strchr(address, '/') != NULL) {
+        struct sockaddr_un unix_address;
+        memset(&unix_address, 0, sizeof(unix_address));
+        unix_address.sun_family = AF_UNIX;
+        strncpy(unix_address.sun_path, address, sizeof(unix_address.sun_path) - 1);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1) {
+            return -1;
+        }
+        if (listening) {
+            unlink(unix_address.sun_path);
+        }
+        if ((listening ? bind(fd, (struct sockaddr *) &unix_address, sizeof(unix_address)) == -1 || listen(fd, REMOTE_BACKLOG) == -1
+                       : connect(fd, (struct sockaddr *) &unix_address, sizeof(unix_address)) == -1)) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    char host[256];
+    char *port = strrchr(address, ':');
+    if (port == NULL || (size_t) (port - address) >= sizeof(host)) {
+        fprintf(stderr, "Invalid address %s, host:port or a socket path expected\n", address);
+        return -1;
+    }
+    memcpy(host, address, port - address);
+    host[port - address] = '\0';
+    struct addrinfo hints, *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    if (getaddrinfo(host[0] == '\0' ? NULL : host, port + 1, &hints, &addresses) != 0) {
+        fprintf(stderr, "Unknown address %s\n", address);
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *candidate = addresses; candidate != NULL && fd == -1; candidate = candidate->ai_next) {
+        fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (fd == -1) {
+            continue;
+        }
+        int reuse = 1;
+        if (listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        }
+        if ((listening ? bind(fd, candidate->ai_addr, candidate->ai_addrlen) == -1 || listen(fd, REMOTE_BACKLOG) == -1
+                       : connect(fd, candidate->ai_addr, candidate->ai_addrlen) == -1)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+/*!
+ * @brief connect_remote connects to the server of the destination and has it start analyzing the destination
+ * @param the_config is a pointer to the configuration, with the address of the server
+ * @return 0 in case of success, -1 else
+ */
+int connect_remote(configuration_t *the_config) {
+    remote_socket = open_socket(the_config->remote, false);
+    if (remote_socket == -1) {
+        perror("Failed to connect to the server");
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN); // A server that left is reported by the writes
+    remote_failed = false;
+    remote_compress = the_config->compress;
+    output_length = 0;
+    remote_hello_t hello;
+    memcpy(hello.magic, REMOTE_MAGIC, sizeof(hello.magic));
+    hello.flags = (the_config->uses_md5 ? REMOTE_FLAG_MD5 : 0) | (remote_compress ? REMOTE_FLAG_COMPRESS : 0);
+    if (put_frame(remote_socket, FRAME_HELLO, &hello, sizeof(hello)) == -1 || flush_frames(remote_socket) == -1) {
+        perror("Failed to contact the server");
+        close(remote_socket);
+        remote_socket = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief receive_remote_list receives the destination list from the server
+ * Each received entry is appended to the compact list, the server sends them in order.
+ * @param list is a pointer to the compact list to fill, rooted at the address of the server
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int receive_remote_list(compact_files_list_t *list, configuration_t *the_config) {
+    static files_list_entry_t entry;
+    uint64_t collect_start = stats_now();
+    uint64_t received_count = 0;
+    size_t start_of_name = strlen(the_config->destination) + 1;
+    remote_frame_header_t header;
+    init_compact_files_list(list, the_config->destination);
+    while (read_frame(remote_socket, &header) == 0) {
+        if (header.type == FRAME_ENTRIES) {
+            size_t offset = 0;
+            while (offset < header.length) {
+                size_t consumed = decode_files_list_record(frame_payload + offset, header.length - offset, &entry, the_config->destination);
+                if (consumed == 0 || add_compact_entry(list, entry.path_and_name + start_of_name, &entry) == -1) {
+                    fprintf(stderr, "Invalid destination list received from the server\n");
+                    return -1;
+                }
+                offset += consumed;
+                ++received_count;
+            }
+        } else if (header.type == FRAME_LIST_END && header.length == sizeof(remote_list_end_t)) {
+            remote_list_end_t end;
+            memcpy(&end, frame_payload, sizeof(end));
+            if (the_config->uses_md5 && !(end.flags & REMOTE_FLAG_MD5)) {
+                fprintf(stderr, "The server does not compute MD5 sums\n");
+                return -1;
+            }
+            stats_add_phase(PHASE_COLLECT, collect_start, received_count, 0);
+            return end.entries_count == received_count ? 0 : -1;
+        } else if (header.type == FRAME_ERROR) {
+            fprintf(stderr, "Server error: %.*s\n", (int) header.length, (char *) frame_payload);
+            return -1;
+        } else {
+            break;
+        }
+    }
+    fprintf(stderr, "The server closed the connection\n");
+    return -1;
+}
+
+/*!
+ * @brief is_remote_open tells if the destination is on a server
+ * @return true during a remote synchronization, false else
+ */
+bool is_remote_open(void) {
+    return remote_socket != -1;
+}
+
+/*!
+ * @brief send_remote_frame adds a frame for the server, unless the connection broke
+ * @param type is the type of the frame
+ * @param payload is the payload of the frame
+ * @param length is the length of the payload
+ */
+static void send_remote_frame(remote_frame_type_t type, const void *payload, size_t length) {
+    if (!remote_failed && put_frame(remote_socket, type, payload, length) == -1) {
+        perror("Failed to send to the server");
+        remote_failed = true;
+    }
+}
+
+/*!
+ * @brief send_remote_entry sends an entry to copy to the server, the content of a file follows its record
+ * Frames are not acknowledged one by one: the server reports its errors at the end (@see close_remote).
+ * @param source_entry is a pointer to the source entry
+ * @param the_config is a pointer to the configuration
+ * @return the number of bytes of the file that were sent
+ */
+uint64_t send_remote_entry(files_list_entry_t *source_entry, configuration_t *the_config) {
+    int fd_source = -1;
+    if (source_entry->entry_type == FICHIER && (fd_source = open(source_entry->path_and_name, O_RDONLY)) == -1) {
+        perror("Failed to copy a file");
+        return 0;
+    }
+    size_t record_length = encode_files_list_record(frame_payload, sizeof(frame_payload), source_entry, strlen(the_config->source) + 1);
+    send_remote_frame(FRAME_FILE, frame_payload, record_length);
+    if (fd_source == -1) {
+        return 0;
+    }
+    qos_throttle(QOS_FILES, 1);
+    uint64_t sent_bytes = 0;
+    ssize_t read_bytes;
+    while (!remote_failed && (read_bytes = read(fd_source, data_chunk, sizeof(data_chunk))) > 0) {
+        qos_throttle(QOS_READ_BYTES, read_bytes);
+        uLongf compressed_length = sizeof(frame_payload) - sizeof(uint32_t);
+        if (remote_compress && compress2(frame_payload + sizeof(uint32_t), &compressed_length, data_chunk, read_bytes, Z_BEST_SPEED) == Z_OK
+            && compressed_length < (uLongf) read_bytes) {
+            uint32_t raw_length = read_bytes;
+            memcpy(frame_payload, &raw_length, sizeof(raw_length));
+            send_remote_frame(FRAME_DATA_Z, frame_payload, sizeof(uint32_t) + compressed_length);
+        } else {
+            send_remote_frame(FRAME_DATA, data_chunk, read_bytes);
+        }
+        sent_bytes += read_bytes;
+    }
+    close(fd_source);
+    // The server keeps the file only if it is complete
+    uint8_t complete = sent_bytes == source_entry->size;
+    send_remote_frame(FRAME_FILE_END, &complete, sizeof(complete));
+    return sent_bytes;
+}
+
+/*!
+ * @brief close_remote ends the session with the server and reports the result of its writes
+ * @return 0 if the server wrote all the entries, -1 else
+ */
+int close_remote(void) {
+    if (remote_socket == -1) {
+        return -1;
+    }
+    send_remote_frame(FRAME_DONE, NULL, 0);
+    int result = -1;
+    remote_frame_header_t header;
+    if (!remote_failed && flush_frames(remote_socket) == 0 && read_frame(remote_socket, &header) == 0) {
+        if (header.type == FRAME_RESULT && header.length == sizeof(remote_result_t)) {
+            remote_result_t remote_result;
+            memcpy(&remote_result, frame_payload, sizeof(remote_result));
+            LOG_INFO(LOG_CATEGORY_COPY, "The server wrote %lu entries, %lu failed\n", remote_result.written_count, remote_result.failed_count);
+            if (remote_result.failed_count > 0) {
+                fprintf(stderr, "The server failed to write %lu entries\n", remote_result.failed_count);
+            }
+            result = remote_result.failed_count == 0 ? 0 : -1;
+        } else if (header.type == FRAME_ERROR) {
+            fprintf(stderr, "Server error: %.*s\n", (int) header.length, (char *) frame_payload);
+        }
+    } else {
+        fprintf(stderr, "The connection to the server broke\n");
+    }
+    close(remote_socket);
+    remote_socket = -1;
+    return result;
+}
+
+/*!
+ * @brief send_error sends an error to the client of the server
+ * @param client is the socket of the client
+ * @param reason is the error message
+ */
+static void send_error(int client, char *reason) {
+    LOG_WARNING(LOG_CATEGORY_IPC, "Session error: %s\n", reason);
+    if (put_frame(client, FRAME_ERROR, reason, strlen(reason)) == 0) {
+        flush_frames(client);
+    }
+}
+
+/*!
+ * @brief send_destination_list lists and analyzes the tree of the server, and sends its entries to the client
+ * @param client is the socket of the client
+ * @param the_config is a pointer to the configuration of the server, whose source is the served tree
+ * @param p_context is a pointer to the processes context
+ * @return 0 in case of success, -1 else
+ */
+static int send_destination_list(int client, configuration_t *the_config, process_context_t *p_context) {
+    static files_list_entry_t entry;
+    compact_files_list_t list;
+    if (the_config->is_parallel) {
+        make_files_lists_parallel(&list, NULL, the_config, p_context->message_queue_id);
+    } else {
+        make_files_list(&list, the_config->source);
+    }
+    size_t start_of_name = strlen(the_config->source) + 1;
+    size_t batch_length = 0;
+    int result = 0;
+    remote_list_end_t end = {0, the_config->uses_md5 ? REMOTE_FLAG_MD5 : 0};
+    path_store_cursor_t cursor;
+    start_path_cursor(&cursor, &list.paths);
+    while (result == 0 && next_path(&cursor)) {
+        fill_entry_from_compact(&list, &cursor, &entry);
+        size_t length = encode_files_list_record(frame_payload + batch_length, REMOTE_BUFFER_SIZE / 2 - batch_length, &entry, start_of_name);
+        if (length == 0 && batch_length > 0) {
+            result = put_frame(client, FRAME_ENTRIES, frame_payload, batch_length);
+            batch_length = 0;
+            length = encode_files_list_record(frame_payload, REMOTE_BUFFER_SIZE / 2, &entry, start_of_name);
+        }
+        batch_length += length;
+        end.entries_count += length > 0;
+    }
+    if (result == 0 && batch_length > 0) {
+        result = put_frame(client, FRAME_ENTRIES, frame_payload, batch_length);
+    }
+    free_compact_files_list(&list);
+    if (result == 0 && put_frame(client, FRAME_LIST_END, &end, sizeof(end)) == 0 && flush_frames(client) == 0) {
+        return 0;
+    }
+    return -1;
+}
+
+/*!
+ * @brief is_safe_relative_path tells if a path received from a client stays in the served tree
+ * @param path is the path, relative to the root of the tree
+ * @return true if it has no .. component, false else
+ */
+static bool is_safe_relative_path(char *path) {
+    size_t length = strlen(path);
+    return path[0] != '/' && strcmp(path, "..") != 0 && strncmp(path, "../", 3) != 0 && strstr(path, "/../") == NULL
+        && !(length >= 3 && strcmp(path + length - 3, "/..") == 0);
+}
+
+/*!
+ * @brief serve_session serves a client: it sends the destination list, then writes the entries the client sends
+ * @param client is the socket of the client
+ * @param the_config is a pointer to the configuration of the server
+ * @param p_context is a pointer to the processes context
+ */
+static void serve_session(int client, configuration_t *the_config, process_context_t *p_context) {
+    output_length = 0;
+    remote_frame_header_t header;
+    remote_hello_t hello;
+    if (read_frame(client, &header) == -1 || header.type != FRAME_HELLO || header.length != sizeof(hello)) {
+        send_error(client, "invalid hello");
+        return;
+    }
+    memcpy(&hello, frame_payload, sizeof(hello));
+    if (memcmp(hello.magic, REMOTE_MAGIC, sizeof(hello.magic)) != 0) {
+        send_error(client, "unknown protocol");
+        return;
+    }
+    if ((hello.flags & REMOTE_FLAG_MD5) && !the_config->uses_md5) {
+        send_error(client, "the server does not compute MD5 sums");
+        return;
+    }
+    if (send_destination_list(client, the_config, p_context) == -1) {
+        LOG_WARNING(LOG_CATEGORY_IPC, "Failed to send the destination list\n");
+        return;
+    }
+
+    remote_result_t result = {0, 0};
+    files_list_entry_t entry;
+    size_t start_of_name = strlen(the_config->source) + 1;
+    int fd_destination = -1;
+    bool failed = false; // The current file could not be written
+    uint64_t copy_start = 0, copied_bytes = 0;
+    while (read_frame(client, &header) == 0) {
+        switch (header.type) {
+            case FRAME_FILE:
+                if (decode_files_list_record(frame_payload, header.length, &entry, the_config->source) == 0
+                    || !is_safe_relative_path(entry.path_and_name + start_of_name)) {
+                    send_error(client, "invalid entry");
+                    return;
+                }
+                copy_start = stats_now();
+                copied_bytes = 0;
+                failed = false;
+                if (entry.entry_type == DOSSIER) {
+                    if (mkdir(entry.path_and_name, entry.mode) == -1 && errno != EEXIST) {
+                        ++result.failed_count;
+                    } else {
+                        ++result.written_count;
+                    }
+                    stats_add_phase(PHASE_COPY, copy_start, 1, 0);
+                } else {
+                    detach_destination_file(AT_FDCWD, entry.path_and_name);
+                    if ((fd_destination = open(entry.path_and_name, O_WRONLY | O_CREAT | O_TRUNC, entry.mode)) == -1) {
+                        failed = true;
+                    }
+                }
+                break;
+            case FRAME_DATA:
+            case FRAME_DATA_Z: {
+                uint8_t *data = frame_payload;
+                uLongf length = header.length;
+                if (header.type == FRAME_DATA_Z) {
+                    uint32_t raw_length;
+                    memcpy(&raw_length, frame_payload, sizeof(raw_length));
+                    length = sizeof(data_chunk);
+                    if (header.length < sizeof(raw_length)
+                        || uncompress(data_chunk, &length, frame_payload + sizeof(raw_length), header.length - sizeof(raw_length)) != Z_OK
+                        || length != raw_length) {
+                        send_error(client, "invalid compressed data");
+                        return;
+                    }
+                    data = data_chunk;
+                }
+                if (fd_destination != -1 && !failed) {
+                    failed = write_fully(fd_destination, data, length) == -1;
+                }
+                copied_bytes += length;
+                break;
+            }
+            case FRAME_FILE_END:
+                if (fd_destination == -1) {
+                    // The file was not opened by this session, whatever is at its path is not a partial copy
+                    ++result.failed_count;
+                } else {
+                    close(fd_destination);
+                    fd_destination = -1;
+                    if (failed || header.length != 1 || frame_payload[0] == 0) {
+                        unlink(entry.path_and_name);
+                        ++result.failed_count;
+                    } else {
+                        ++result.written_count;
+                    }
+                }
+                stats_add_phase(PHASE_COPY, copy_start, 1, copied_bytes);
+                break;
+            case FRAME_DONE:
+                if (put_frame(client, FRAME_RESULT, &result, sizeof(result)) == 0) {
+                    flush_frames(client);
+                }
+                LOG_INFO(LOG_CATEGORY_COPY, "Session done: %lu entries written, %lu failed\n", result.written_count, result.failed_count);
+                return;
+            default:
+                send_error(client, "unexpected frame");
+                return;
+        }
+    }
+    if (fd_destination != -1) {
+        close(fd_destination);
+        unlink(entry.path_and_name);
+    }
+    LOG_WARNING(LOG_CATEGORY_IPC, "The client left before the end of the session\n");
+}
+
+/*!
+ * @brief run_server serves the tree of the configuration (its source) to remote clients until SIGTERM or SIGINT
+ * The processes must be prepared (@see prepare), they analyze the served tree for each session.
+ * @param the_config is a pointer to the configuration of the server
+ * @param p_context is a pointer to the processes context
+ * @return 0 when the server stopped, -1 in case of error
+ */
+int run_server(configuration_t *the_config, process_context_t *p_context) {
+    int server = open_socket(the_config->serve, true);
+    if (server == -1) {
+        perror("Failed to listen to the server address");
+        return -1;
+    }
+
+    // Without SA_RESTART, accept is interrupted by the stop signals
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_server;
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    signal(SIGPIPE, SIG_IGN); // A client that left must not kill the server
+
+    LOG_INFO(LOG_CATEGORY_CONFIG, "Serving %s on %s\n", the_config->source, the_config->serve);
+    while (!server_stopping) {
+        int client = accept(server, NULL, NULL);
+        if (client == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to accept a client");
+            break;
+        }
+        serve_session(client, the_config, p_context);
+        flush_log();
+        close(client);
+    }
+    close(server);
+    if (strchr(the_config->serve, '/') != NULL) {
+        unlink(the_config->serve);
+    }
+    return 0;
+}
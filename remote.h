@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "files-list.h"
+#include "configuration.h"
+#include "processes.h"
+
+#define REMOTE_MAGIC "LP25RMT1"
+#define REMOTE_BUFFER_SIZE (64 * 1024) // Frames are gathered up to this size before being sent
+#define REMOTE_CHUNK_SIZE (256 * 1024) // File data sent per frame, at most
+#define REMOTE_BACKLOG 16
+
+// Every message is a frame: a remote_frame_header_t followed by length bytes of payload
+typedef enum {
+    FRAME_HELLO = 1, // Client: REMOTE_MAGIC and remote flags
+    FRAME_ENTRIES, // Server: files list records of the destination (@see files-list-io.h)
+    FRAME_LIST_END, // Server: remote_list_end_t
+    FRAME_FILE, // Client: the files list record of an entry to write, the data of a file follows
+    FRAME_DATA, // Client: data of the current file
+    FRAME_DATA_Z, // Client: data of the current file compressed with zlib, after its uint32_t uncompressed length
+    FRAME_FILE_END, // Client: end of the data of the current file
+    FRAME_DONE, // Client: no more entries
+    FRAME_RESULT, // Server: remote_result_t
+    FRAME_ERROR // Server: the reason why the session stops
+} remote_frame_type_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint32_t length;
+} remote_frame_header_t;
+
+#define REMOTE_FLAG_MD5 0x1 // Destination entries have their MD5 sums
+#define REMOTE_FLAG_COMPRESS 0x2 // The client compresses file data
+
+typedef struct __attribute__((packed)) {
+    char magic[8];
+    uint32_t flags;
+} remote_hello_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t entries_count;
+    uint32_t flags;
+} remote_list_end_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t written_count;
+    uint64_t failed_count;
+} remote_result_t;
+
+int connect_remote(configuration_t *the_config);
+int receive_remote_list(compact_files_list_t *list, configuration_t *the_config);
+bool is_remote_open(void);
+uint64_t send_remote_entry(files_list_entry_t *source_entry, configuration_t *the_config);
+int close_remote(void);
+int run_server(configuration_t *the_config, process_context_t *p_context);
@@ -0,0 +1,177 @@
+#include "stats.h"
+#include <time.h>
+#include <string.h>
+#include <sys/resource.h>
+
+stats_t process_stats;
+
+static const char *phase_names[PHASES_COUNT] = {"listing", "stat", "hash", "collect", "diff", "copy"};
+static const char *role_names[ROLES_COUNT] = {"main", "listers", "analyzers", "hashers"};
+
+/*!
+ * @brief stats_now returns the current time of the monotonic clock
+ * @return the time in nanoseconds
+ */
+uint64_t stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*!
+ * @brief stats_add_phase accounts the work done by a phase since a given time
+ * @param phase is the phase to account
+ * @param start_ns is the time (@see stats_now) the work started
+ * @param count is the number of processed files
+ * @param bytes is the number of processed bytes
+ */
+void stats_add_phase(stats_phase_t phase, uint64_t start_ns, uint64_t count, uint64_t bytes) {
+    process_stats.phase_time_ns[phase] += stats_now() - start_ns;
+    process_stats.phase_count[phase] += count;
+    process_stats.phase_bytes[phase] += bytes;
+}
+
+/*!
+ * @brief stats_add_queue_wait accounts the time spent waiting for a message since a given time
+ * @param start_ns is the time (@see stats_now) the wait started
+ */
+void stats_add_queue_wait(uint64_t start_ns) {
+    process_stats.queue_wait_ns += stats_now() - start_ns;
+    ++process_stats.messages_received;
+}
+
+/*!
+ * @brief stats_add_hash_latency adds a hash duration to the latency histogram
+ * @param start_ns is the time (@see stats_now) the hash started
+ */
+void stats_add_hash_latency(uint64_t start_ns) {
+    uint64_t latency_us = (stats_now() - start_ns) / 1000;
+    int bucket = 0;
+    while (latency_us > 1 && bucket < HASH_LATENCY_BUCKETS - 1) {
+        latency_us >>= 1;
+        ++bucket;
+    }
+    ++process_stats.hash_latency[bucket];
+}
+
+/*!
+ * @brief stats_update_peak_rss records the maximum resident set size the current process reached so far
+ */
+void stats_update_peak_rss(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0 && (uint64_t) usage.ru_maxrss > process_stats.peak_rss_kb) {
+        process_stats.peak_rss_kb = usage.ru_maxrss;
+    }
+}
+
+/*!
+ * @brief merge_stats adds statistics to others
+ * @param into is a pointer to the statistics to update
+ * @param from is a pointer to the statistics to add
+ */
+void merge_stats(stats_t *into, stats_t *from) {
+    for (int i = 0; i < PHASES_COUNT; ++i) {
+        into->phase_time_ns[i] += from->phase_time_ns[i];
+        into->phase_count[i] += from->phase_count[i];
+        into->phase_bytes[i] += from->phase_bytes[i];
+    }
+    into->messages_sent += from->messages_sent;
+    into->messages_received += from->messages_received;
+    into->queue_wait_ns += from->queue_wait_ns;
+    into->throttle_wait_ns += from->throttle_wait_ns;
+    into->filtered_files += from->filtered_files;
+    into->pruned_directories += from->pruned_directories;
+    into->synchronized_entries += from->synchronized_entries;
+    for (int i = 0; i < HASH_LATENCY_BUCKETS; ++i) {
+        into->hash_latency[i] += from->hash_latency[i];
+    }
+    if (from->peak_rss_kb > into->peak_rss_kb) {
+        into->peak_rss_kb = from->peak_rss_kb;
+    }
+}
+
+/*!
+ * @brief display_stats prints a human readable report of the statistics of each role
+ * Times of children are summed over all the processes of a role.
+ * @param stream is the stream to print to
+ * @param roles_stats is an array of ROLES_COUNT statistics
+ */
+void display_stats(FILE *stream, stats_t *roles_stats) {
+    fprintf(stream, "\n%-10s %-8s %12s %14s %12s %12s\n", "role", "phase", "files", "bytes", "time (ms)", "MB/s");
+    for (int role = 0; role < ROLES_COUNT; ++role) {
+        stats_t *stats = &roles_stats[role];
+        for (int phase = 0; phase < PHASES_COUNT; ++phase) {
+            if (stats->phase_count[phase] == 0 && stats->phase_time_ns[phase] == 0) {
+                continue;
+            }
+            double time_ms = stats->phase_time_ns[phase] / 1e6;
+            double throughput = time_ms > 0 ? stats->phase_bytes[phase] / 1e3 / time_ms : 0;
+            fprintf(stream, "%-10s %-8s %12lu %14lu %12.3f %12.2f\n", role_names[role], phase_names[phase],
+                    stats->phase_count[phase], stats->phase_bytes[phase], time_ms, throughput);
+        }
+        if (stats->messages_sent > 0 || stats->messages_received > 0) {
+            fprintf(stream, "%-10s messages sent %lu, received %lu, queue wait %.3f ms\n", role_names[role],
+                    stats->messages_sent, stats->messages_received, stats->queue_wait_ns / 1e6);
+        }
+        if (stats->throttle_wait_ns > 0) {
+            fprintf(stream, "%-10s throttled %.3f ms\n", role_names[role], stats->throttle_wait_ns / 1e6);
+        }
+        if (stats->filtered_files > 0 || stats->pruned_directories > 0) {
+            fprintf(stream, "%-10s filters skipped %lu files, pruned %lu directories\n", role_names[role],
+                    stats->filtered_files, stats->pruned_directories);
+        }
+        if (stats->peak_rss_kb > 0) {
+            fprintf(stream, "%-10s peak RSS %lu KiB\n", role_names[role], stats->peak_rss_kb);
+        }
+    }
+    for (int role = 0; role < ROLES_COUNT; ++role) {
+        stats_t *stats = &roles_stats[role];
+        if (stats->phase_count[PHASE_HASH] == 0) {
+            continue;
+        }
+        fprintf(stream, "%-10s hash latency:", role_names[role]);
+        for (int i = 0; i < HASH_LATENCY_BUCKETS; ++i) {
+            if (stats->hash_latency[i] > 0) {
+                fprintf(stream, " <%luus:%lu", 2UL << i, stats->hash_latency[i]);
+            }
+        }
+        fprintf(stream, "\n");
+    }
+}
+
+/*!
+ * @brief write_stats_json writes the statistics of each role to a JSON file
+ * @param path is the path of the file to write
+ * @param roles_stats is an array of ROLES_COUNT statistics
+ * @return 0 in case of success, -1 else
+ */
+int write_stats_json(char *path, stats_t *roles_stats) {
+    FILE *json = fopen(path, "w");
+    if (json == NULL) {
+        perror("Failed to open stats file");
+        return -1;
+    }
+    fprintf(json, "{\n");
+    for (int role = 0; role < ROLES_COUNT; ++role) {
+        stats_t *stats = &roles_stats[role];
+        fprintf(json, "  \"%s\": {\n    \"phases\": {", role_names[role]);
+        for (int phase = 0; phase < PHASES_COUNT; ++phase) {
+            fprintf(json, "%s\n      \"%s\": {\"count\": %lu, \"bytes\": %lu, \"time_ns\": %lu}", phase == 0 ? "" : ",",
+                    phase_names[phase], stats->phase_count[phase], stats->phase_bytes[phase], stats->phase_time_ns[phase]);
+        }
+        fprintf(json, "\n    },\n    \"messages_sent\": %lu,\n    \"messages_received\": %lu,\n    \"queue_wait_ns\": %lu,\n    \"peak_rss_kb\": %lu,\n",
+                stats->messages_sent, stats->messages_received, stats->queue_wait_ns, stats->peak_rss_kb);
+        fprintf(json, "    \"throttle_wait_ns\": %lu,\n", stats->throttle_wait_ns);
+        fprintf(json, "    \"filtered_files\": %lu,\n    \"pruned_directories\": %lu,\n", stats->filtered_files, stats->pruned_directories);
+        fprintf(json, "    \"hash_latency_us_log2\": [");
+        for (int i = 0; i < HASH_LATENCY_BUCKETS; ++i) {
+            fprintf(json, "%s%lu", i == 0 ? "" : ", ", stats->hash_latency[i]);
+        }
+        fprintf(json, "]\n  }%s\n", role == ROLES_COUNT - 1 ? "" : ",");
+    }
+    fprintf(json, "}\n");
+    if (fclose(json) != 0) {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HASH_LATENCY_BUCKETS 24 // Bucket i counts hashes that took [2^i, 2^(i+1)) microseconds
+
+typedef enum {
+    PHASE_LISTING, // Directory walks (make_list)
+    PHASE_STAT, // lstat of entries (get_file_stats)
+    PHASE_HASH, // MD5 computation (compute_file_md5)
+    PHASE_COLLECT, // Reception of the lists by the main process (make_files_lists_parallel)
+    PHASE_DIFF, // Comparison of the lists (synchronize)
+    PHASE_COPY, // Copies to the destination (copy_entry_to_destination)
+    PHASES_COUNT
+} stats_phase_t;
+
+typedef enum {ROLE_MAIN, ROLE_LISTER, ROLE_ANALYZER, ROLE_HASHER, ROLES_COUNT} stats_role_t;
+
+typedef struct {
+    uint64_t phase_time_ns[PHASES_COUNT];
+    uint64_t phase_count[PHASES_COUNT]; // Files (or directories for PHASE_LISTING) processed by the phase
+    uint64_t phase_bytes[PHASES_COUNT];
+    uint64_t messages_sent;
+    uint64_t messages_received;
+    uint64_t queue_wait_ns; // Time spent blocked waiting for a message
+    uint64_t throttle_wait_ns; // Time spent sleeping to stay within the rate limits (@see qos_throttle)
+    uint64_t hash_latency[HASH_LATENCY_BUCKETS];
+    uint64_t filtered_files; // Files skipped by the filters (@see is_path_excluded)
+    uint64_t pruned_directories; // Directories skipped by the filters, with their whole content
+    uint64_t synchronized_entries; // Source entries compared to their destination (@see synchronize_lists)
+    uint64_t peak_rss_kb; // Maximum resident set size (of the biggest process once merged)
+} stats_t;
+
+// Statistics of the current process. Children send theirs to the main process when they terminate.
+extern stats_t process_stats;
+
+uint64_t stats_now(void);
+void stats_add_phase(stats_phase_t phase, uint64_t start_ns, uint64_t count, uint64_t bytes);
+void stats_add_queue_wait(uint64_t start_ns);
+void stats_add_hash_latency(uint64_t start_ns);
+void stats_update_peak_rss(void);
+void merge_stats(stats_t *into, stats_t *from);
+void display_stats(FILE *stream, stats_t *roles_stats);
+int write_stats_json(char *path, stats_t *roles_stats);
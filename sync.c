@@ -5,23 +5,184 @@
 #include "utility.h"
 #include "messages.h"
 #include "file-properties.h"
+#include "dest-index.h"
+#include "external-sort.h"
+#include "stats.h"
+#include "trace.h"
+#include "log.h"
+#include "inodes.h"
+#include "content-index.h"
+#include "journal.h"
+#include "filters.h"
+#include "qos.h"
+#include "plan.h"
+#include "remote.h"
+#include "dir-cache.h"
+#include "uring-copy.h"
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #include <unistd.h>
 #include <sys/msg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 
+/*!
+ * @brief link_entry_to_copy links a file to the copy of its inode made earlier in the synchronization
+ * The first link of an inode to be copied is only recorded, so that the next ones are linked to its copy.
+ * @param links is a pointer to the copies of the inodes with several links
+ * @param source_entry is a pointer to the source entry (a file with several links)
+ * @param the_config is a pointer to the configuration
+ * @return 0 if the entry was linked, -1 if it must be copied
+ */
+static int link_entry_to_copy(links_map_t *links, files_list_entry_t *source_entry, configuration_t *the_config) {
+    char destination_file[PATH_SIZE];
+    concat_path(destination_file, the_config->destination, source_entry->path_and_name + strlen(the_config->source) + 1);
+    char *first_copy = find_linked_copy(links, source_entry);
+    if (first_copy == NULL) {
+        if (add_linked_copy(links, source_entry, destination_file) == -1) {
+            fprintf(stderr, "Failed to allocate memory for the hard links\n");
+        }
+        return -1;
+    }
+    if (the_config->dry_run) {
+        LOG_INFO(LOG_CATEGORY_COPY, "\nWould link %s to %s\n", destination_file, first_copy);
+        return 0;
+    }
+    LOG_INFO(LOG_CATEGORY_COPY, "Linking %s to %s\n", destination_file, first_copy);
+    uint64_t copy_start = stats_now();
+    // The first copy may still be queued (--io-uring)
+    flush_uring_copies();
+    unlink(destination_file);
+    if (link(first_copy, destination_file) == -1) {
+        LOG_WARNING(LOG_CATEGORY_COPY, "Failed to link %s to %s, copying it\n", destination_file, first_copy);
+        return -1;
+    }
+    stats_add_phase(PHASE_COPY, copy_start, 1, 0);
+    return 0;
+}
+
+/*!
+ * @brief add_moved_candidate indexes a destination file without source counterpart by its content
+ * @param moved is a pointer to the content index
+ * @param destination_entries is a pointer to the compact destination list
+ * @param destination_cursor is a pointer to the cursor on the destination file
+ * @param the_config is a pointer to the configuration
+ */
+static void add_moved_candidate(content_index_t *moved, compact_files_list_t *destination_entries,
+                                path_store_cursor_t *destination_cursor, configuration_t *the_config) {
+    if (the_config->detect_renames == RENAMES_NONE) {
+        return;
+    }
+    files_list_entry_t destination_entry;
+    fill_entry_from_compact(destination_entries, destination_cursor, &destination_entry);
+    // Empty files are not worth it
+    if (destination_entry.entry_type != FICHIER || destination_entry.size == 0) {
+        return;
+    }
+    if (add_content_entry(moved, &destination_entry) == -1) {
+        fprintf(stderr, "Failed to allocate memory for the renames detection\n");
+        exit(-1);
+    }
+}
+
+/*!
+ * @brief reuse_moved_content makes a missing destination file out of a destination file with the same content
+ * The file is renamed, linked or cloned (reflink) depending on the configuration. Renamed files cannot be reused again.
+ * @param moved is a pointer to the sorted content index of the destination files without source counterpart
+ * @param source_entry is a pointer to the source file
+ * @param the_config is a pointer to the configuration
+ * @return 0 if the file was made, -1 if it must be copied
+ */
+static int reuse_moved_content(content_index_t *moved, files_list_entry_t *source_entry, configuration_t *the_config) {
+    content_entry_t *content = find_content_entry(moved, source_entry);
+    if (content == NULL) {
+        return -1;
+    }
+    char destination_file[PATH_SIZE];
+    concat_path(destination_file, the_config->destination, source_entry->path_and_name + strlen(the_config->source) + 1);
+    struct stat sb;
+    if (lstat(destination_file, &sb) == 0) {
+        // Only missing files are made, files that changed in place are copied
+        return -1;
+    }
+    static const char *operations[] = {"", "rename", "link", "clone"};
+    if (the_config->dry_run) {
+        LOG_INFO(LOG_CATEGORY_COPY, "\nWould %s %s to %s\n", operations[the_config->detect_renames], content->path, destination_file);
+        return 0;
+    }
+    LOG_INFO(LOG_CATEGORY_COPY, "Reusing %s for %s (%s)\n", content->path, destination_file, operations[the_config->detect_renames]);
+    uint64_t copy_start = stats_now();
+    int result = -1;
+    if (the_config->detect_renames == RENAMES_RENAME) {
+        content->moved = (result = rename(content->path, destination_file)) == 0;
+    } else if (the_config->detect_renames == RENAMES_LINK) {
+        result = link(content->path, destination_file);
+    } else {
+        int fd_source = open(content->path, O_RDONLY);
+        int fd_destination = open(destination_file, O_WRONLY | O_CREAT | O_EXCL, source_entry->mode);
+        if (fd_source != -1 && fd_destination != -1) {
+            result = ioctl(fd_destination, FICLONE, fd_source);
+        }
+        if (fd_source != -1) {
+            close(fd_source);
+        }
+        if (fd_destination != -1) {
+            close(fd_destination);
+            if (result == -1) {
+                unlink(destination_file);
+            }
+        }
+    }
+    if (result == -1) {
+        LOG_WARNING(LOG_CATEGORY_COPY, "Failed to %s %s to %s, copying it\n", operations[the_config->detect_renames], content->path, destination_file);
+        return -1;
+    }
+    stats_add_phase(PHASE_COPY, copy_start, 1, 0);
+    return 0;
+}
+
+/*!
+ * @brief remove_emptied_directories removes the destination directories that renames left empty
+ * The parents of each file moved away are removed bottom-up, while they are empty and have no source counterpart.
+ * @param moved is a pointer to the content index of the synchronization
+ * @param the_config is a pointer to the configuration
+ */
+static void remove_emptied_directories(content_index_t *moved, configuration_t *the_config) {
+    size_t start_of_dest = strlen(the_config->destination) + 1;
+    char directory[PATH_SIZE], source_directory[PATH_SIZE];
+    struct stat sb;
+    for (size_t i = 0; i < moved->count; ++i) {
+        if (!moved->entries[i].moved) {
+            continue;
+        }
+        strcpy(directory, moved->entries[i].path);
+        char *slash;
+        while ((slash = strrchr(directory, '/')) != NULL && (size_t) (slash - directory) >= start_of_dest) {
+            *slash = '\0';
+            if (concat_path(source_directory, the_config->source, directory + start_of_dest) == NULL
+                || lstat(source_directory, &sb) == 0 || rmdir(directory) == -1) {
+                break;
+            }
+            LOG_INFO(LOG_CATEGORY_COPY, "Removed %s, emptied by renames\n", directory);
+        }
+    }
+}
+
 /*!
  * @brief synchronize is the main function for synchronization
  * It will build the lists (source and destination), then make a third list with differences, and apply differences to the destination
  * It must adapt to the parallel or not operation of the program.
+ * With a plan to write (--plan-out), differences are saved to the plan instead of being applied.
  * @param the_config is a pointer to the configuration
  * @param p_context is a pointer to the processes context
+ * @return 0 in case of success, -1 if the plan could not be written or the streaming synchronization failed
  */
-void synchronize(configuration_t *the_config, process_context_t *p_context) {
+int synchronize(configuration_t *the_config, process_context_t *p_context) {
     if (p_context == NULL) {
         fprintf(stderr, "Invalid arguments to synchronize\n");
         exit(-1);
@@ -29,81 +190,170 @@ void synchronize(configuration_t *the_config, process_context_t *p_context) {
     if (the_config->verbose || the_config->dry_run) {
         printf("Synchronizing %s and %s\n", the_config->source, the_config->destination);
     }
-    files_list_t source = {NULL, NULL};
-     files_list_t destination = {NULL, NULL};
+    // With a memory budget, lists never live entirely in memory: they are spilled to disk and streamed through the diff
+    if (the_config->memory_budget > 0) {
+        return synchronize_streaming(the_config);
+    }
+    // A remote destination is analyzed by its server while the source is analyzed here
+    bool destination_remote = the_config->remote[0] != '\0';
+    if (destination_remote && connect_remote(the_config) == -1) {
+        return -1;
+    }
+    // The sorted lists are front-coded as their entries are received, then merged: the prefix common to the current
+    // source and destination paths is known from the previous comparison and from the prefixes shared between
+    // consecutive paths
+    compact_files_list_t source_entries, destination_entries;
+    init_compact_files_list(&destination_entries, the_config->destination);
+    // A trusted destination index replaces the destination scan
+    bool destination_indexed = false;
+    if (the_config->dest_index[0] != '\0') {
+        destination_indexed = load_destination_index(&destination_entries, the_config) == 0;
+    }
     if (!the_config->is_parallel) {
-        make_files_list(&source, the_config->source);
-        make_files_list(&destination, the_config->destination);
+        make_files_list(&source_entries, the_config->source);
+        if (!destination_indexed && !destination_remote) {
+            make_files_list(&destination_entries, the_config->destination);
+        }
     } else {
-        make_files_lists_parallel(&source, &destination, the_config, p_context->message_queue_id);
+        make_files_lists_parallel(&source_entries, destination_indexed || destination_remote ? NULL : &destination_entries,
+                                  the_config, p_context->message_queue_id);
     }
-    if (the_config->verbose || the_config->dry_run) {
-            printf("\nSource files:\n");
-            display_files_list(&source);
-            printf("\nDestination files:\n");
-            display_files_list(&destination);
-        }
-
-    files_list_t difference = {NULL, NULL};
-    files_list_entry_t *tmp = source.head;
-    files_list_entry_t *result;
-    while (tmp != NULL){
-        size_t start_of_src = strlen(the_config->source) + 1;
-        size_t start_of_dest = strlen(the_config->destination) + 1;
-        if (the_config->verbose || the_config->dry_run) {
-            printf("\nComparing %s and %s\n", tmp->path_and_name, destination.head->path_and_name);
-        }
-        result = find_entry_by_name(&destination, tmp->path_and_name, start_of_src, start_of_dest);
-        if (result == NULL){
-            if (the_config->verbose || the_config->dry_run) {
-                printf("\nDifferent, adding %s to the list of files to copy\n", tmp->path_and_name + start_of_src);
-            }
-            files_list_entry_t *tmp_copy = malloc(sizeof(files_list_entry_t));
-            if (tmp_copy == NULL) {
-                fprintf(stderr, "Failed to allocate memory for tmp_copy\n");
-                exit(-1);
+    if (destination_remote && receive_remote_list(&destination_entries, the_config) == -1) {
+        close_remote();
+        free_compact_files_list(&source_entries);
+        free_compact_files_list(&destination_entries);
+        return -1;
+    }
+    return synchronize_lists(the_config, &source_entries, &destination_entries);
+}
+
+/*!
+ * @brief synchronize_lists makes the list of differences between the lists of a synchronization, and applies it to the
+ * destination (or saves it to the plan to write)
+ * @param the_config is a pointer to the configuration, whose source and destination are those of the lists
+ * @param source_entries is a pointer to the source compact list, it is freed
+ * @param destination_entries is a pointer to the destination compact list, it is freed
+ * @return 0 in case of success, -1 if the plan could not be written
+ */
+int synchronize_lists(configuration_t *the_config, compact_files_list_t *source_entries, compact_files_list_t *destination_entries) {
+    LOG_INFO(LOG_CATEGORY_LIST, "\nSource files:\n");
+    display_compact_files_list(source_entries);
+    LOG_INFO(LOG_CATEGORY_LIST, "\nDestination files:\n");
+    display_compact_files_list(destination_entries);
+
+    compact_files_list_t difference;
+    init_compact_files_list(&difference, the_config->source);
+    content_index_t moved; // Destination files without source counterpart, that missing files may reuse
+    init_content_index(&moved);
+
+    files_list_entry_t source_entry, destination_entry;
+    path_store_cursor_t source_cursor, destination_cursor;
+    start_path_cursor(&source_cursor, &source_entries->paths);
+    start_path_cursor(&destination_cursor, &destination_entries->paths);
+    uint64_t diff_start = stats_now();
+    uint64_t trace_start = trace_clock();
+    uint64_t compared_count = 0;
+    bool has_source = next_path(&source_cursor);
+    bool has_destination = next_path(&destination_cursor);
+    size_t common = 0;
+    while (has_source) {
+        int cmp = 1;
+        if (has_destination) {
+            LOG_INFO(LOG_CATEGORY_DIFF, "\nComparing %s and %s\n", source_cursor.path, destination_cursor.path);
+            cmp = compare_path_cursors(&destination_cursor, &source_cursor, &common);
+        }
+        if (cmp < 0) {
+            add_moved_candidate(&moved, destination_entries, &destination_cursor, the_config);
+            has_destination = next_path(&destination_cursor);
+            if (destination_cursor.shared < common) {
+                common = destination_cursor.shared;
             }
-            memcpy(tmp_copy, tmp, sizeof(files_list_entry_t));
-            tmp_copy->next = NULL;
-            printf("tmp_copy : %s\n", tmp_copy->path_and_name);
-            add_entry_to_tail(&difference, tmp_copy);
+            continue;
+        }
+
+        fill_entry_from_compact(source_entries, &source_cursor, &source_entry);
+        bool is_different = true;
+        if (cmp > 0) {
+            LOG_INFO(LOG_CATEGORY_DIFF, "\nDifferent, adding %s to the list of files to copy\n", source_cursor.path);
         } else {
-            if (the_config->verbose || the_config->dry_run) {
-                printf("\nSame %s\n", result->path_and_name + start_of_dest);
+            LOG_INFO(LOG_CATEGORY_DIFF, "\nSame %s\n", destination_cursor.path);
+            fill_entry_from_compact(destination_entries, &destination_cursor, &destination_entry);
+            is_different = mismatch(&source_entry, &destination_entry, the_config->uses_md5);
+            if (is_different) {
+                LOG_INFO(LOG_CATEGORY_DIFF, "\nFiles are different, adding %s to the list of files to copy\n", source_cursor.path);
             }
-            if (mismatch(tmp, result, the_config->uses_md5)) {
-                if (the_config->verbose || the_config->dry_run) {
-                    printf("\nFiles are different, adding %s to the list of files to copy\n", tmp->path_and_name + start_of_src);
-                }
-                files_list_entry_t *tmp_copy = malloc(sizeof(files_list_entry_t));
-                if (tmp_copy == NULL) {
-                    fprintf(stderr, "Failed to allocate memory for tmp_copy\n");
-                    exit(-1);
-                }
-                memcpy(tmp_copy, tmp, sizeof(files_list_entry_t));
-                tmp_copy->next = NULL;
-                printf("tmp_copy : %s\n", tmp_copy->path_and_name);
-                add_entry_to_tail(&difference, tmp_copy);
+        }
+        if (is_different) {
+            if (add_compact_entry(&difference, source_cursor.path, &source_entry) == -1) {
+                fprintf(stderr, "Failed to allocate memory for the difference list\n");
+                exit(-1);
             }
+            LOG_DEBUG(LOG_CATEGORY_DIFF, "tmp_copy : %s\n", source_entry.path_and_name);
         }
-        tmp = tmp->next;
+
+        if (cmp == 0) {
+            has_destination = next_path(&destination_cursor);
+            if (destination_cursor.shared < common) {
+                common = destination_cursor.shared;
+            }
+        }
+        has_source = next_path(&source_cursor);
+        if (source_cursor.shared < common) {
+            common = source_cursor.shared;
+        }
+        ++compared_count;
     }
-    if (the_config->verbose || the_config->dry_run) {
-        printf("\nFiles to be copied:\n");
-        display_files_list(&difference);
+    // Destination files after the last source one have no source counterpart either
+    while (the_config->detect_renames != RENAMES_NONE && has_destination) {
+        add_moved_candidate(&moved, destination_entries, &destination_cursor, the_config);
+        has_destination = next_path(&destination_cursor);
     }
-    files_list_entry_t *tmp_dif = difference.head;
-    while (tmp_dif != NULL) {
+    sort_content_index(&moved);
+    stats_add_phase(PHASE_DIFF, diff_start, compared_count, 0);
+    process_stats.synchronized_entries += compared_count;
+    trace_complete(TRACE_DIFF, trace_start, NULL);
+    LOG_INFO(LOG_CATEGORY_LIST, "\nFiles to be copied:\n");
+    display_compact_files_list(&difference);
+    // A plan is applied later (@see apply_plan)
+    bool plan_only = the_config->plan_out[0] != '\0';
+    int result = plan_only ? write_plan(&difference, the_config) : 0;
+    path_store_cursor_t difference_cursor;
+    start_path_cursor(&difference_cursor, &difference.paths);
+    links_map_t links;
+    init_links_map(&links);
+    while (!plan_only && next_path(&difference_cursor)) {
+        fill_entry_from_compact(&difference, &difference_cursor, &source_entry);
+        if (the_config->hardlinks && source_entry.entry_type == FICHIER && source_entry.links > 1
+            && link_entry_to_copy(&links, &source_entry, the_config) == 0) {
+            continue;
+        }
+        if (the_config->detect_renames != RENAMES_NONE && source_entry.entry_type == FICHIER
+            && reuse_moved_content(&moved, &source_entry, the_config) == 0) {
+            continue;
+        }
         if (the_config->dry_run) {
-            printf("\nWould copy %s\n", tmp_dif->path_and_name);
+            LOG_INFO(LOG_CATEGORY_COPY, "\nWould copy %s\n", source_entry.path_and_name);
         } else {
-            copy_entry_to_destination(tmp_dif, the_config);
+            copy_entry_to_destination(&source_entry, the_config);
         }
-        tmp_dif = tmp_dif->next;   
-    } 
-    clear_files_list(&difference);
-    clear_files_list(&source);
-    clear_files_list(&destination);
+    }
+    close_uring_copy();
+    close_destination_directories();
+    if (the_config->detect_renames == RENAMES_RENAME) {
+        remove_emptied_directories(&moved, the_config);
+    }
+    free_links_map(&links);
+    free_content_index(&moved);
+    if (the_config->remote[0] != '\0' && close_remote() == -1) {
+        result = -1;
+    }
+    if (the_config->dest_index[0] != '\0' && !the_config->dry_run && !plan_only) {
+        save_destination_index(destination_entries, &difference, the_config);
+    }
+    free_compact_files_list(&difference);
+    free_compact_files_list(source_entries);
+    free_compact_files_list(destination_entries);
+    return result;
 }
 
 
@@ -142,113 +392,295 @@ bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5) {
     return false;
 }
 
+/*!
+ * @brief add_listed_entry appends an analyzed entry to its compact list
+ * @param list is a pointer to the compact list, the path of the entry is under its root
+ * @param entry is a pointer to the entry, it is not kept
+ */
+static void add_listed_entry(compact_files_list_t *list, files_list_entry_t *entry) {
+    size_t start_of_name = strlen(list->root) + 1;
+    if (strlen(entry->path_and_name) >= start_of_name && add_compact_entry(list, entry->path_and_name + start_of_name, entry) == -1) {
+        fprintf(stderr, "Failed to allocate memory for the compact files lists\n");
+        exit(-1);
+    }
+}
+
 /*!
  * @brief make_files_list buils a files list in no parallel mode
- * @param list is a pointer to the list that will be built
+ * Each entry of the walk is analyzed, then moved to the compact list.
+ * @param list is a pointer to the compact list that will be built
  * @param target_path is the path whose files to list
  */
-void make_files_list(files_list_t *list, char *target_path) {
+void make_files_list(compact_files_list_t *list, char *target_path) {
     // printf("Making files list for %s\n", target_path); debug
     if (list == NULL || target_path == NULL) {
         fprintf(stderr, "Invalid arguments to make_files_list\n");
         exit(-1);
     }
-    make_list(list, target_path);
+    init_compact_files_list(list, target_path);
+    files_list_t walked = {NULL, NULL};
+    uint64_t listing_start = stats_now();
+    make_list(&walked, target_path);
+    uint64_t listed_count = 0;
+    for (files_list_entry_t *cursor = walked.head; cursor != NULL; cursor = cursor->next) {
+        ++listed_count;
+    }
+    stats_add_phase(PHASE_LISTING, listing_start, listed_count, 0);
 
-    files_list_entry_t *cursor = list->head;
-    while (cursor != NULL) {
-        get_file_stats(cursor); 
-        cursor = cursor->next;
+    while (walked.head != NULL) {
+        files_list_entry_t *entry = walked.head;
+        walked.head = entry->next;
+        if (get_file_stats(entry) == 0) {
+            journal_digest(entry);
+        }
+        add_listed_entry(list, entry);
+        free(entry);
     }
 }
 
+/*!
+ * @brief add_sequenced_entry appends an entry to its list in sequence order, the entries received ahead of the next
+ * one to append are kept until it is received
+ * @param list is a pointer to the sequenced list
+ * @param entry is a pointer to the entry, it is copied if it must be kept
+ * @param sequence is the index of the entry in its list
+ */
+static void add_sequenced_entry(sequenced_list_t *list, files_list_entry_t *entry, uint32_t sequence) {
+    if (sequence < list->next || (sequence < list->capacity && list->entries[sequence] != NULL)) {
+        return;
+    }
+    if (sequence == list->next) {
+        add_listed_entry(list->list, entry);
+        ++list->next;
+        while (list->next < list->capacity && list->entries[list->next] != NULL) {
+            add_listed_entry(list->list, list->entries[list->next]);
+            free(list->entries[list->next]);
+            list->entries[list->next++] = NULL;
+        }
+        return;
+    }
+    if (sequence >= list->capacity) {
+        uint32_t capacity = list->capacity == 0 ? 1024 : list->capacity;
+        while (capacity <= sequence) {
+            capacity *= 2;
+        }
+        files_list_entry_t **entries = realloc(list->entries, capacity * sizeof(files_list_entry_t *));
+        if (entries == NULL) {
+            fprintf(stderr, "Failed to allocate memory for sequenced entries\n");
+            exit(-1);
+        }
+        memset(entries + list->capacity, 0, (capacity - list->capacity) * sizeof(files_list_entry_t *));
+        list->entries = entries;
+        list->capacity = capacity;
+    }
+    files_list_entry_t *copy = malloc(sizeof(files_list_entry_t));
+    if (copy == NULL) {
+        fprintf(stderr, "Failed to allocate memory for sequenced entries\n");
+        exit(-1);
+    }
+    memcpy(copy, entry, offsetof(files_list_entry_t, path_and_name));
+    strcpy(copy->path_and_name, entry->path_and_name);
+    list->entries[sequence] = copy;
+}
+
+/*!
+ * @brief is_sequenced_list_complete tells if all the entries of a sequenced list are appended to its compact list
+ * @param list is a pointer to the sequenced list
+ * @return true if the list is complete, false else
+ */
+static bool is_sequenced_list_complete(sequenced_list_t *list) {
+    if (list->expected < 0 || list->next < (uint64_t) list->expected) {
+        return false;
+    }
+    free(list->entries);
+    list->entries = NULL;
+    return true;
+}
+
+/*!
+ * @brief init_lists_collector prepares the collection of the lists of a synchronization, sent by the listers
+ * @param collector is a pointer to the collector to initialize
+ * @param src_list is a pointer to the source compact list, initialized with its root
+ * @param dst_list is a pointer to the destination compact list, initialized with its root, NULL when it is not listed
+ */
+void init_lists_collector(lists_collector_t *collector, compact_files_list_t *src_list, compact_files_list_t *dst_list) {
+    collector->lists[0] = (sequenced_list_t) {src_list, NULL, 0, 0, -1};
+    collector->lists[1] = (sequenced_list_t) {dst_list, NULL, 0, 0, -1};
+    // Each lister ends its list with a list complete message
+    collector->pending_lists = dst_list != NULL ? 2 : 1;
+    collector->received_count = 0;
+}
+
+/*!
+ * @brief collect_list_message appends a received entry to its list, or accounts the end of a list
+ * Analyzers that send their results directly do it in any order: entries are appended by sequence number until
+ * their list end (which tells how many entries the list has) is received and all of them are appended.
+ * @param collector is a pointer to the collector of the lists the message belongs to
+ * @param message is a pointer to the message received by the main process
+ * @param direct_results tells if the analyzers send their results directly
+ * @return true when both lists are complete, false else
+ */
+bool collect_list_message(lists_collector_t *collector, any_message_t *message, bool direct_results) {
+    switch (message->list_entry.op_code) {
+        case MSG_TYPE_TO_MAIN_FROM_SOURCE_LISTER:
+        case MSG_TYPE_TO_MAIN_FROM_DESTINATION_LISTER: {
+            LOG_DEBUG(LOG_CATEGORY_IPC, "Received %s response\n", message->list_entry.op_code == MSG_TYPE_TO_MAIN_FROM_SOURCE_LISTER ? "source" : "destination");
+            sequenced_list_t *list = &collector->lists[message->list_entry.op_code == MSG_TYPE_TO_MAIN_FROM_SOURCE_LISTER ? 0 : 1];
+            if (list->list == NULL) {
+                fprintf(stderr, "Received an entry of a list that was not requested\n");
+                exit(-1);
+            }
+            journal_digest(&message->list_entry.payload);
+            if (direct_results) {
+                add_sequenced_entry(list, &message->list_entry.payload, message->list_entry.sequence);
+                if (is_sequenced_list_complete(list)) {
+                    --collector->pending_lists;
+                }
+            } else {
+                add_listed_entry(list->list, &message->list_entry.payload);
+            }
+            ++collector->received_count;
+            break;
+        }
+
+        case COMMAND_CODE_LIST_COMPLETE:
+            LOG_DEBUG(LOG_CATEGORY_IPC, "Received list end\n");
+            if (direct_results) {
+                sequenced_list_t *list = &collector->lists[message->list_end.list_code == MSG_TYPE_TO_MAIN_FROM_SOURCE_LISTER ? 0 : 1];
+                list->expected = message->list_end.entries_count;
+                if (is_sequenced_list_complete(list)) {
+                    --collector->pending_lists;
+                }
+            } else {
+                --collector->pending_lists;
+            }
+            break;
+
+        default:
+            break;
+    }
+    return collector->pending_lists == 0;
+}
+
 /*!
  * @brief make_files_lists_parallel makes both (src and dest) files list with parallel processing
- * @param src_list is a pointer to the source list to build
- * @param dst_list is a pointer to the destination list to build
+ * Each received entry is appended to its compact list, only the entries received out of order are kept meanwhile.
+ * @param src_list is a pointer to the source compact list to build
+ * @param dst_list is a pointer to the destination compact list to build, NULL when it is not listed here (destination
+ * index or remote destination)
  * @param the_config is a pointer to the program configuration
  * @param msg_queue is the id of the MQ used for communication
  */
-void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, int msg_queue) {
-    if (src_list == NULL || dst_list == NULL || the_config == NULL) {
+void make_files_lists_parallel(compact_files_list_t *src_list, compact_files_list_t *dst_list, configuration_t *the_config, int msg_queue) {
+    if (src_list == NULL || the_config == NULL) {
         fprintf(stderr, "Invalid arguments to make_files_lists_parallel\n");
         exit(-1);
     }
-    printf("Making files lists in parallel\n");
-    //printf("Sending analyze dir commands\n");
-    send_analyze_dir_command(msg_queue, MSG_TYPE_TO_MAIN_FROM_SOURCE_LISTER, the_config->source);
-    //printf("Sent analyze dir commands\n");
-    send_analyze_dir_command(msg_queue, MSG_TYPE_TO_MAIN_FROM_DESTINATION_LISTER, the_config->destination);
-    bool source_loop = true;
-    bool destination_loop = true;
+    init_compact_files_list(src_list, the_config->source);
+    if (dst_list != NULL) {
+        init_compact_files_list(dst_list, the_config->destination);
+    }
+    LOG_DEBUG(LOG_CATEGORY_IPC, "Making files lists in parallel\n");
+    uint64_t collect_start = stats_now();
+    send_analyze_dir_command(msg_queue, MSG_TYPE_TO_SOURCE_LISTER, the_config->source, 0);
+    if (dst_list != NULL) {
+        send_analyze_dir_command(msg_queue, MSG_TYPE_TO_DESTINATION_LISTER, the_config->destination, 0);
+    }
+    lists_collector_t collector;
+    init_lists_collector(&collector, src_list, dst_list);
     any_message_t message;
-    files_list_entry_t *tmp_copy = NULL;
-    do{
-        //printf("Waiting for messages\n");
-        //fflush(stdout);
-        msgrcv(msg_queue, &message, sizeof(any_message_t) - sizeof(long), MSG_TYPE_TO_MAIN, 0);
-        switch (message.list_entry.op_code) {
-            case MSG_TYPE_TO_MAIN_FROM_SOURCE_LISTER:
-                if (the_config->verbose || the_config->dry_run) {
-                    printf("Received source response\n");
-                }
-                tmp_copy = malloc(sizeof(files_list_entry_t));
-                if (tmp_copy == NULL) {
-                    fprintf(stderr, "Failed to allocate memory for tmp_copy\n");
-                    exit(-1);
-                }
-                memcpy(tmp_copy, &message.list_entry.payload, sizeof(files_list_entry_t));
-                add_entry_to_tail(src_list, tmp_copy);
-                break;
-            
-            case MSG_TYPE_TO_MAIN_FROM_DESTINATION_LISTER:
-            if (the_config->verbose || the_config->dry_run) {
-                printf("Received destination response\n");
-            }
-            tmp_copy = malloc(sizeof(files_list_entry_t));
-            if (tmp_copy == NULL) {
-                fprintf(stderr, "Failed to allocate memory for tmp_copy\n");
-                exit(-1);
-            }
-            memcpy(tmp_copy, &message.list_entry.payload, sizeof(files_list_entry_t));
-            add_entry_to_tail(dst_list, tmp_copy);
-                break;
-            
-            case MSG_TYPE_TO_MAIN_FROM_END_SRC_LISTER:
-                if (the_config->verbose || the_config->dry_run) {
-                printf("Received source end\n");
-                }
-                source_loop = false;
-                break;
-            
-            case MSG_TYPE_TO_MAIN_FROM_END_DEST_LISTER:
-                if (the_config->verbose || the_config->dry_run) {
-                    printf("Received destination end\n");
-                }
-                destination_loop = false;
-                break;
-            
-            default:
-                break;
+    bool complete = false;
+    while (!complete) {
+        uint64_t wait_start = stats_now();
+        uint64_t trace_start = trace_clock();
+        if (msgrcv(msg_queue, &message, sizeof(any_message_t) - sizeof(long), MSG_TYPE_TO_MAIN, 0) == -1) {
+            continue;
         }
-        
-    }while (source_loop || destination_loop);
+        stats_add_queue_wait(wait_start);
+        trace_complete(TRACE_RECEIVE, trace_start, NULL);
+        complete = collect_list_message(&collector, &message, the_config->direct_results);
+    }
+    stats_add_phase(PHASE_COLLECT, collect_start, collector.received_count, 0);
+}
+
+/*!
+ * @brief send_file_content copies the content of a file from an offset to its end
+ * Throttled copies are sent by chunks, each taking its bytes from the read and write rate limits.
+ * @param fd_destination is the file descriptor of the destination, at the offset
+ * @param fd_source is the file descriptor of the source
+ * @param offset is a pointer to the offset, it is updated to the end of the copied content
+ * @param size is the size of the source
+ */
+static void send_file_content(int fd_destination, int fd_source, off_t *offset, uint64_t size) {
+    bool throttled = is_throttled(QOS_READ_BYTES) || is_throttled(QOS_WRITE_BYTES);
+    qos_throttle(QOS_FILES, 1);
+    while ((uint64_t) *offset < size) {
+        uint64_t chunk = throttled && size - *offset > QOS_CHUNK_SIZE ? QOS_CHUNK_SIZE : size - *offset;
+        qos_throttle(QOS_READ_BYTES, chunk);
+        qos_throttle(QOS_WRITE_BYTES, chunk);
+        if (sendfile(fd_destination, fd_source, offset, chunk) <= 0) {
+            break;
+        }
+    }
+}
+
+/*!
+ * @brief copy_file_journaled copies a file through a partial file renamed once complete, so that an interrupted copy
+ * never leaves a destination file that looks complete, and resumes the copy an interrupted run left
+ * @param source_entry is a pointer to the source entry
+ * @param destination_file is the path of the destination file
+ * @return the number of copied bytes
+ */
+static uint64_t copy_file_journaled(files_list_entry_t *source_entry, char *destination_file) {
+    char partial[PATH_SIZE + sizeof(JOURNAL_PARTIAL_SUFFIX)];
+    snprintf(partial, sizeof(partial), "%s%s", destination_file, JOURNAL_PARTIAL_SUFFIX);
+    off_t offset = resumable_copy_offset(source_entry, destination_file, partial);
+    if (offset > 0) {
+        LOG_INFO(LOG_CATEGORY_COPY, "Resuming the copy of %s at %ld\n", destination_file, (long) offset);
+    } else {
+        journal_copy_started(source_entry, destination_file);
+    }
+    int fd_source = open(source_entry->path_and_name, O_RDONLY);
+    int fd_destination = open(partial, O_WRONLY | O_CREAT | (offset > 0 ? 0 : O_TRUNC), source_entry->mode);
+    if (fd_source == -1 || fd_destination == -1) {
+        perror("Failed to copy a file");
+        if (fd_source != -1) {
+            close(fd_source);
+        }
+        if (fd_destination != -1) {
+            close(fd_destination);
+        }
+        return 0;
+    }
+    off_t start = offset;
+    if (lseek(fd_destination, offset, SEEK_SET) == -1) {
+        offset = start = 0;
+    }
+    send_file_content(fd_destination, fd_source, &offset, source_entry->size);
+    close(fd_source);
+    close(fd_destination);
+    if ((uint64_t) offset == source_entry->size && rename(partial, destination_file) == 0) {
+        journal_copy_done(source_entry, destination_file);
+    }
+    return offset - start;
 }
 
 /*!
  * @brief copy_entry_to_destination copies a file from the source to the destination
  * It keeps access modes and mtime (@see utimensat)
  * Pay attention to the path so that the prefixes are not repeated from the source to the destination
- * Use sendfile to copy the file, mkdir to create the directory
+ * Use sendfile to copy the file, mkdirat to create the directory, both relative to the cached destination directories
+ * (@see open_destination_parent)
  */
 void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config) {
-    if (the_config->verbose || the_config->dry_run) {
-        printf("Copying %s to %s\n", source_entry->path_and_name, the_config->destination); 
-    }
     if (source_entry == NULL || the_config == NULL) {
         fprintf(stderr, "Invalid arguments to copy_entry_to_destination\n");
         exit(-1);
     }
+    LOG_INFO(LOG_CATEGORY_COPY, "Copying %s to %s\n", source_entry->path_and_name, the_config->destination);
+    uint64_t copy_start = stats_now();
+    uint64_t copied_bytes = source_entry->entry_type == FICHIER ? source_entry->size : 0;
+    uint64_t trace_start = trace_clock();
     char source[1024];
     strcpy(source, the_config->source);
     char destination[1024];
@@ -256,62 +688,103 @@ void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t
     // printf("Source : %s\n", source); debug
     // printf("Destination : %s\n", destination); debug
 
-    if (source_entry->entry_type == DOSSIER) {
-        char path[PATH_SIZE];
-        if (the_config->verbose || the_config->dry_run)
-        printf("Creating directory %s\n", source_entry->path_and_name + strlen(the_config->source) + 1);
-        concat_path(path, destination, source_entry->path_and_name + strlen(the_config->source) + 1);
-        mkdir(path, source_entry->mode);
+    if (is_remote_open()) {
+        copied_bytes = send_remote_entry(source_entry, the_config);
+    } else if (source_entry->entry_type == DOSSIER) {
+        LOG_INFO(LOG_CATEGORY_COPY, "Creating directory %s\n", source_entry->path_and_name + strlen(the_config->source) + 1);
+        if (create_destination_directory(destination, source_entry->path_and_name + strlen(the_config->source) + 1, source_entry->mode) == -1) {
+            perror("Failed to create a directory");
+        }
     } else {
         off_t offset = 0;
-        char source_file[PATH_SIZE];
-        char destination_file[PATH_SIZE];
-        if (the_config->verbose || the_config->dry_run)
-        printf("Copying file %s\n", source_entry->path_and_name + strlen(the_config->source) + 1); 
-        concat_path(source_file, source, source_entry->path_and_name);
-        concat_path(destination_file, destination, source_entry->path_and_name + strlen(the_config->source) + 1);
+        LOG_INFO(LOG_CATEGORY_COPY, "Copying file %s\n", source_entry->path_and_name + strlen(the_config->source) + 1);
 
-        int fd_source, fd_destination;
-        fd_source = open(source_entry->path_and_name, O_RDONLY);
-        fd_destination = open(destination_file, O_WRONLY | O_CREAT | O_TRUNC, source_entry->mode);
-        sendfile(fd_destination, fd_source, &offset, source_entry->size);
-
-        close(fd_source);
-        close(fd_destination);
+        if (is_journal_open()) {
+            // The journal records the full destination paths
+            char destination_file[PATH_SIZE];
+            concat_path(destination_file, destination, source_entry->path_and_name + strlen(the_config->source) + 1);
+            copied_bytes = copy_file_journaled(source_entry, destination_file);
+        } else {
+            // The file is created in its cached directory, the destination path is not resolved again
+            char *name;
+            int fd_directory = open_destination_parent(destination, source_entry->path_and_name + strlen(the_config->source) + 1, &name);
+            // Small files are copied by batches, their errors are reported when they complete (@see queue_uring_copy)
+            if (fd_directory == -1 || !the_config->io_uring || queue_uring_copy(source_entry, fd_directory, name) == -1) {
+                int fd_source = open(source_entry->path_and_name, O_RDONLY);
+                if (fd_source != -1 && fd_directory != -1) {
+                    detach_destination_file(fd_directory, name);
+                }
+                int fd_destination = fd_directory == -1 ? -1 : openat(fd_directory, name, O_WRONLY | O_CREAT | O_TRUNC, source_entry->mode);
+                if (fd_source == -1 || fd_destination == -1) {
+                    perror("Failed to copy a file");
+                    copied_bytes = 0;
+                } else {
+                    send_file_content(fd_destination, fd_source, &offset, source_entry->size);
+                }
+                if (fd_source != -1) {
+                    close(fd_source);
+                }
+                if (fd_destination != -1) {
+                    close(fd_destination);
+                }
+            }
+        }
     }
+    stats_add_phase(PHASE_COPY, copy_start, 1, copied_bytes);
+    trace_complete(TRACE_COPY, trace_start, source_entry->path_and_name);
     return;
 }
 
 /*!
- * @brief make_list lists files in a location (it recurses in directories)
- * It doesn't get files properties, only a list of paths
- * This function is used by make_files_list and make_files_list_parallel
+ * @brief list_directory lists the entries of a directory that the filters keep (it recurses in directories)
  * @param list is a pointer to the list that will be built
- * @param target is the target dir whose content must be listed
+ * @param target is the directory whose content must be listed
+ * @param prefix_length is the length of the root of the tree in the paths (@see root_prefix_length)
  */
-void make_list(files_list_t *list, char *target) {
-    if (list == NULL || target == NULL) {
-        fprintf(stderr, "Invalid arguments to make_list\n");
-        exit(-1);
-    }
+static void list_directory(files_list_t *list, char *target, size_t prefix_length) {
     DIR *dir;
+    uint64_t trace_start = trace_clock();
     if (!(dir = open_dir(target))) {
         return;
     }
 
+    // Entries are on the device of their directory (a mount point is on the device of its parent)
+    struct stat sb;
+    dev_t device = fstat(dirfd(dir), &sb) == 0 ? sb.st_dev : 0;
     struct dirent *entry;
     while ((entry = get_next_entry(dir)) != NULL) {
         char full_path[PATH_SIZE];
         concat_path(full_path, target, entry->d_name);
+        if (is_entry_excluded(full_path, prefix_length, entry->d_name, entry->d_type == DT_DIR)) {
+            continue;
+        }
 
+        files_list_entry_t *list_entry = add_file_entry(list, full_path);
+        if (list_entry != NULL) {
+            list_entry->device = device;
+        }
         if (entry->d_type == DT_DIR) {
-            add_file_entry(list, full_path);
-            make_list(list, full_path);
-        } else {
-            add_file_entry(list, full_path);
+            list_directory(list, full_path, prefix_length);
         }
     }
     closedir(dir);
+    trace_complete(TRACE_READ_DIR, trace_start, target);
+}
+
+/*!
+ * @brief make_list lists files in a location (it recurses in directories)
+ * It doesn't get files properties, only a list of paths. Entries excluded by the filters are skipped, and excluded
+ * directories are not walked.
+ * This function is used by make_files_list and make_files_list_parallel
+ * @param list is a pointer to the list that will be built
+ * @param target is the target dir whose content must be listed
+ */
+void make_list(files_list_t *list, char *target) {
+    if (list == NULL || target == NULL) {
+        fprintf(stderr, "Invalid arguments to make_list\n");
+        exit(-1);
+    }
+    list_directory(list, target, root_prefix_length(target));
 }
 
 /*!
@@ -341,7 +814,7 @@ struct dirent *get_next_entry(DIR *dir) {
             if (entry->d_type == DT_DIR || entry->d_type == DT_REG) {
                 return entry;
             }
-            printf("No relevent entry found");
+            LOG_DEBUG(LOG_CATEGORY_LIST, "No relevent entry found\n");
         }
     }
     return NULL; // No relevant entry found
@@ -4,12 +4,32 @@
 #include "files-list.h"
 #include "configuration.h"
 #include "processes.h"
+#include "messages.h"
 #include <dirent.h>
 
-void synchronize(configuration_t *the_config, process_context_t *p_context);
-void make_files_list(files_list_t *list, char *target_path);
+// Entries of a list sent by the analyzers (--direct-results), appended in sequence order to the compact list
+typedef struct {
+    compact_files_list_t *list;
+    files_list_entry_t **entries; // Entries received ahead of the next one to append, indexed by sequence number
+    uint32_t capacity;
+    uint32_t next; // Sequence number of the next entry to append
+    int64_t expected; // Entries count of the list, -1 until its list end is received
+} sequenced_list_t;
+
+// Lists of a synchronization being received from the listers (@see collect_list_message)
+typedef struct {
+    sequenced_list_t lists[2]; // Source and destination
+    int pending_lists;
+    uint64_t received_count;
+} lists_collector_t;
+
+int synchronize(configuration_t *the_config, process_context_t *p_context);
+int synchronize_lists(configuration_t *the_config, compact_files_list_t *source_entries, compact_files_list_t *destination_entries);
+void make_files_list(compact_files_list_t *list, char *target_path);
 bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5);
-void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, int msg_queue);
+void init_lists_collector(lists_collector_t *collector, compact_files_list_t *src_list, compact_files_list_t *dst_list);
+bool collect_list_message(lists_collector_t *collector, any_message_t *message, bool direct_results);
+void make_files_lists_parallel(compact_files_list_t *src_list, compact_files_list_t *dst_list, configuration_t *the_config, int msg_queue);
 void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config);
 void make_list(files_list_t *list, char *target);
 DIR *open_dir(char *path);
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <string.h>
+#include "path-store.h"
+
+// Checks of the path store: paths read in order, at random positions (seek_path) and looked up (find_path) must be
+// the appended ones, around and across the restart points.
+
+#define PATHS_COUNT (PATH_STORE_RESTART_INTERVAL * 20 + 5) // Last block is not full
+
+/*!
+ * @brief make_path writes the path of the i-th entry of the test store (paths are sorted like i)
+ * @param path is the buffer of PATH_SIZE bytes to write to
+ * @param i is the index of the entry
+ */
+static void make_path(char *path, size_t i) {
+    snprintf(path, PATH_SIZE, "dir_%02zu/sub/file_%05zu", i / 50, i);
+}
+
+/*!
+ * @brief check prints a failed check
+ * @param condition is the result of the check
+ * @param description is what was checked
+ * @param i is the index the check is about
+ * @return 0 if the check passed, 1 else
+ */
+static int check(bool condition, char *description, size_t i) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s (%zu)\n", description, i);
+        return 1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief main runs the checks of the path store
+ * @return 0 if all the checks passed, 1 else
+ */
+int main(void) {
+    path_store_t store;
+    path_store_cursor_t cursor;
+    char path[PATH_SIZE];
+    int failures = 0;
+
+    init_path_store(&store);
+    start_path_cursor(&cursor, &store);
+    failures += check(!seek_path(&cursor, 0) && find_path(&store, "dir_00") == -1, "empty store", 0);
+    for (size_t i = 0; i < PATHS_COUNT; ++i) {
+        make_path(path, i);
+        failures += check(append_path(&store, path) == 0, "append_path", i);
+    }
+    failures += check(append_path(&store, "dir_00") == -1, "append_path rejects an out of order path", 0);
+    failures += check(store.restarts_count == (PATHS_COUNT + PATH_STORE_RESTART_INTERVAL - 1) / PATH_STORE_RESTART_INTERVAL,
+                      "one restart point per block", store.restarts_count);
+
+    // In order, restart points share no prefix
+    start_path_cursor(&cursor, &store);
+    for (size_t i = 0; i < PATHS_COUNT; ++i) {
+        make_path(path, i);
+        failures += check(next_path(&cursor) && strcmp(cursor.path, path) == 0, "next_path", i);
+        failures += check(i % PATH_STORE_RESTART_INTERVAL != 0 || cursor.shared == 0, "restart point stored whole", i);
+    }
+    failures += check(!next_path(&cursor), "next_path at the end", PATHS_COUNT);
+
+    // At random positions, backward and forward, then reading on from them
+    for (size_t step = 0; step < PATHS_COUNT; ++step) {
+        size_t i = (step * 37) % PATHS_COUNT;
+        make_path(path, i);
+        failures += check(seek_path(&cursor, i) && cursor.index == i && strcmp(cursor.path, path) == 0, "seek_path", i);
+        if (i + 1 < PATHS_COUNT) {
+            make_path(path, i + 1);
+            failures += check(next_path(&cursor) && strcmp(cursor.path, path) == 0, "next_path after seek_path", i + 1);
+        }
+    }
+    failures += check(!seek_path(&cursor, PATHS_COUNT), "seek_path out of the store", PATHS_COUNT);
+
+    // Lookups of every path, and of missing paths before, between and after them
+    for (size_t i = 0; i < PATHS_COUNT; ++i) {
+        make_path(path, i);
+        failures += check(find_path(&store, path) == (long) i, "find_path", i);
+        strcat(path, "_");
+        failures += check(find_path(&store, path) == -1, "find_path of a missing path", i);
+    }
+    failures += check(find_path(&store, "a") == -1 && find_path(&store, "dir_00") == -1, "find_path before the first path", 0);
+    failures += check(find_path(&store, "z") == -1, "find_path after the last path", PATHS_COUNT);
+
+    free_path_store(&store);
+    if (failures == 0) {
+        printf("path-store: all checks passed\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
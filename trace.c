@@ -0,0 +1,166 @@
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "stats.h"
+
+// Trace buffers live in a shared anonymous mapping created by the main process before it forks: each process
+// writes to its own buffer, and the main process merges all of them into a Chrome trace-event JSON file.
+
+static trace_buffer_t *trace_buffers = NULL;
+static int trace_buffers_count = 0;
+static int trace_buffers_reserved = 0;
+static trace_buffer_t *my_trace_buffer = NULL;
+
+static const char *trace_names[TRACE_NAMES_COUNT] = {"analyze file", "read dir", "send", "receive", "diff", "copy"};
+static const char *role_names[ROLES_COUNT] = {"main", "lister", "analyzer", "hasher"};
+
+/*!
+ * @brief init_trace maps the trace buffers of the main process and of its future children
+ * Pages of the mapping are only allocated when events are written to them.
+ * @param processes_count is the number of processes (including main) that will trace events
+ * @return true if tracing is enabled, false else
+ */
+bool init_trace(int processes_count) {
+    size_t length = (size_t) processes_count * sizeof(trace_buffer_t);
+    trace_buffer_t *buffers = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (buffers == MAP_FAILED) {
+        perror("Failed to map trace buffers");
+        return false;
+    }
+    trace_buffers = buffers;
+    trace_buffers_count = processes_count;
+    trace_buffers_reserved = 0;
+    attach_trace_buffer(reserve_trace_buffer(ROLE_MAIN));
+    return true;
+}
+
+/*!
+ * @brief reserve_trace_buffer reserves the buffer of a process about to be created (called before fork)
+ * @param role is the stats_role_t of the process
+ * @return the slot of the buffer, -1 if tracing is disabled or all buffers are reserved
+ */
+int reserve_trace_buffer(int role) {
+    if (trace_buffers == NULL || trace_buffers_reserved == trace_buffers_count) {
+        return -1;
+    }
+    int slot = trace_buffers_reserved++;
+    trace_buffers[slot].role = role;
+    trace_buffers[slot].pid = 0;
+    trace_buffers[slot].count = 0;
+    trace_buffers[slot].dropped = 0;
+    return slot;
+}
+
+/*!
+ * @brief attach_trace_buffer makes the current process write its events to a reserved buffer
+ * @param slot is the slot returned by reserve_trace_buffer, -1 to disable tracing in the current process
+ */
+void attach_trace_buffer(int slot) {
+    if (trace_buffers == NULL || slot < 0 || slot >= trace_buffers_count) {
+        my_trace_buffer = NULL;
+        return;
+    }
+    my_trace_buffer = &trace_buffers[slot];
+    my_trace_buffer->pid = getpid();
+}
+
+/*!
+ * @brief trace_clock returns the start time of an event
+ * @return the current monotonic time in nanoseconds, 0 if tracing is disabled (so that it costs nothing)
+ */
+uint64_t trace_clock(void) {
+    return my_trace_buffer != NULL ? stats_now() : 0;
+}
+
+/*!
+ * @brief trace_complete records an event that started at start_ns and ends now
+ * @param name is the name of the event
+ * @param start_ns is the start time of the event (@see trace_clock)
+ * @param detail is an optional (may be NULL) string describing the event, e.g. a path (its end is kept)
+ */
+void trace_complete(trace_name_t name, uint64_t start_ns, const char *detail) {
+    if (my_trace_buffer == NULL) {
+        return;
+    }
+    if (my_trace_buffer->count == TRACE_EVENTS_PER_PROCESS) {
+        ++my_trace_buffer->dropped;
+        return;
+    }
+    trace_event_t *event = &my_trace_buffer->events[my_trace_buffer->count];
+    event->start_ns = start_ns;
+    event->duration_ns = stats_now() - start_ns;
+    event->name = name;
+    event->detail[0] = '\0';
+    if (detail != NULL) {
+        size_t length = strlen(detail);
+        size_t skipped = length < TRACE_DETAIL_SIZE ? 0 : length - TRACE_DETAIL_SIZE + 1;
+        memcpy(event->detail, detail + skipped, length - skipped + 1);
+    }
+    ++my_trace_buffer->count;
+}
+
+/*!
+ * @brief write_json_string writes a string as a JSON string literal
+ * @param stream is the stream to write to
+ * @param string is the string to write
+ */
+static void write_json_string(FILE *stream, const char *string) {
+    fputc('"', stream);
+    for (const unsigned char *c = (const unsigned char *) string; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(stream, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(stream, "\\u%04x", *c);
+        } else {
+            fputc(*c, stream);
+        }
+    }
+    fputc('"', stream);
+}
+
+/*!
+ * @brief write_trace writes the events of all processes as a Chrome trace-event JSON file
+ * It must be called by the main process once its children exited.
+ * @param path is the path of the file to write
+ * @return 0 in case of success, -1 else
+ */
+int write_trace(char *path) {
+    if (trace_buffers == NULL) {
+        return -1;
+    }
+    FILE *json = fopen(path, "w");
+    if (json == NULL) {
+        perror("Failed to open trace file");
+        return -1;
+    }
+    fprintf(json, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    for (int slot = 0; slot < trace_buffers_reserved; ++slot) {
+        trace_buffer_t *buffer = &trace_buffers[slot];
+        if (buffer->pid == 0) {
+            continue;
+        }
+        fprintf(json, "%s{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}}",
+                first ? "" : ",\n", buffer->pid, role_names[buffer->role]);
+        first = false;
+        if (buffer->dropped > 0) {
+            fprintf(stderr, "Trace buffer of process %d is full, %lu events dropped\n", buffer->pid, buffer->dropped);
+        }
+        for (uint64_t i = 0; i < buffer->count; ++i) {
+            trace_event_t *event = &buffer->events[i];
+            fprintf(json, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d",
+                    trace_names[event->name], role_names[buffer->role], event->start_ns / 1e3, event->duration_ns / 1e3,
+                    buffer->pid, buffer->pid);
+            if (event->detail[0] != '\0') {
+                fprintf(json, ", \"args\": {\"detail\": ");
+                write_json_string(json, event->detail);
+                fputc('}', json);
+            }
+            fputc('}', json);
+        }
+    }
+    fprintf(json, "\n]}\n");
+    return fclose(json) == 0 ? 0 : -1;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define TRACE_EVENTS_PER_PROCESS (1 << 17)
+#define TRACE_DETAIL_SIZE 44
+
+typedef enum {
+    TRACE_ANALYZE_FILE,
+    TRACE_READ_DIR,
+    TRACE_SEND,
+    TRACE_RECEIVE,
+    TRACE_DIFF,
+    TRACE_COPY,
+    TRACE_NAMES_COUNT
+} trace_name_t;
+
+// A complete event (begin time and duration) of the Chrome trace-event format
+typedef struct {
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint32_t name; // trace_name_t
+    char detail[TRACE_DETAIL_SIZE];
+} trace_event_t;
+
+// Events of one process. Only its process writes to it, and the main process reads it once the process exited,
+// so no lock is needed.
+typedef struct {
+    pid_t pid;
+    int role; // stats_role_t
+    uint64_t count;
+    uint64_t dropped;
+    trace_event_t events[TRACE_EVENTS_PER_PROCESS];
+} trace_buffer_t;
+
+bool init_trace(int processes_count);
+int reserve_trace_buffer(int role);
+void attach_trace_buffer(int slot);
+uint64_t trace_clock(void);
+void trace_complete(trace_name_t name, uint64_t start_ns, const char *detail);
+int write_trace(char *path);
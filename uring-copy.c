@@ -0,0 +1,372 @@
+#include "uring-copy.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include "dir-cache.h"
+#include "qos.h"
+#include "stats.h"
+#include "log.h"
+
+// Small files are copied by chains of linked io_uring operations: the source and the destination are opened into
+// registered file slots, the content goes through a registered buffer, and both slots are closed. Chains of many files
+// are submitted together, so that the system calls of a copy are not paid one by one. io_uring has no glibc wrapper,
+// the rings are set up with the raw system calls (@see io_uring_setup(2)).
+
+// Operations of a copy chain, in their link order (the operation is in the low byte of the user data of its entry)
+typedef enum {
+    URING_OPEN_SOURCE,
+    URING_OPEN_DESTINATION,
+    URING_READ,
+    URING_WRITE,
+    URING_CLOSE_SOURCE,
+    URING_CLOSE_DESTINATION
+} uring_operation_t;
+
+#define URING_SHORT_TRANSFER -1 // Error of a copy whose source size changed since it was listed
+
+static uring_t ring;
+static bool ring_ready = false;
+static bool ring_unavailable = false;
+static uring_copy_t copies[URING_WINDOW];
+static int in_flight = 0;
+static char *buffers = NULL;
+
+/*!
+ * @brief release_ring unmaps the rings and the buffers, closing the ring also unregisters its files and buffers
+ */
+static void release_ring(void) {
+    if (ring.sqes != NULL && ring.sqes != MAP_FAILED) {
+        munmap(ring.sqes, ring.sqes_size);
+    }
+    if (ring.cq_ring != NULL && ring.cq_ring != MAP_FAILED && ring.cq_ring != ring.sq_ring) {
+        munmap(ring.cq_ring, ring.cq_ring_size);
+    }
+    if (ring.sq_ring != NULL && ring.sq_ring != MAP_FAILED) {
+        munmap(ring.sq_ring, ring.sq_ring_size);
+    }
+    if (ring.fd != -1) {
+        close(ring.fd);
+    }
+    if (buffers != NULL && buffers != MAP_FAILED) {
+        munmap(buffers, URING_WINDOW * URING_BUFFER_SIZE);
+    }
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+    buffers = NULL;
+}
+
+/*!
+ * @brief setup_ring creates the rings and registers the buffers and the file slots of the copies
+ * The kernel must assign the files of linked operations when they are issued (IORING_FEAT_LINKED_FILE), so that a
+ * read can use the slot opened by the previous operation of its chain.
+ * @return 0 in case of success, -1 else (errno is set)
+ */
+static int setup_ring(void) {
+    memset(&ring, 0, sizeof(ring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SUBMIT_ALL;
+    ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring.fd == -1) {
+        return -1;
+    }
+    if (!(params.features & IORING_FEAT_LINKED_FILE) || !(params.features & IORING_FEAT_NODROP)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.sq_ring_size = ring.cq_ring_size > ring.sq_ring_size ? ring.cq_ring_size : ring.sq_ring_size;
+    }
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED) {
+        return -1;
+    }
+    ring.cq_ring = ring.sq_ring;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        ring.cq_ring = mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if (ring.cq_ring == MAP_FAILED) {
+            return -1;
+        }
+    }
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        return -1;
+    }
+    char *sq = ring.sq_ring;
+    char *cq = ring.cq_ring;
+    ring.sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring.sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring.sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring.cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring.cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring.cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    ring.local_tail = *ring.sq_tail;
+
+    buffers = mmap(NULL, URING_WINDOW * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED) {
+        return -1;
+    }
+    struct iovec vectors[URING_WINDOW];
+    for (int i = 0; i < URING_WINDOW; ++i) {
+        vectors[i].iov_base = buffers + i * URING_BUFFER_SIZE;
+        vectors[i].iov_len = URING_BUFFER_SIZE;
+    }
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, vectors, URING_WINDOW) == -1) {
+        return -1;
+    }
+    // Empty slots, the copies open their files into them
+    int files[2 * URING_WINDOW];
+    memset(files, -1, sizeof(files));
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_FILES, files, 2 * URING_WINDOW) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief open_uring_copy sets the copy engine up on its first use
+ * @return 0 if the engine is ready, -1 if io_uring is not available (files are then copied synchronously)
+ */
+static int open_uring_copy(void) {
+    if (ring_unavailable) {
+        return -1;
+    }
+    if (setup_ring() == -1) {
+        int error = errno;
+        release_ring();
+        LOG_WARNING(LOG_CATEGORY_COPY, "io_uring is not available (%s), files are copied synchronously\n", strerror(error));
+        ring_unavailable = true;
+        return -1;
+    }
+    memset(copies, 0, sizeof(copies));
+    in_flight = 0;
+    // Queued copies open their files relative to cached directories, that must stay open until they complete
+    defer_directory_closes(true);
+    ring_ready = true;
+    return 0;
+}
+
+/*!
+ * @brief enter_ring submits the prepared entries and waits for completions
+ * @param min_complete is the number of completions to wait for, 0 to only submit
+ * @return 0 in case of success, -1 else
+ */
+static int enter_ring(unsigned min_complete) {
+    __atomic_store_n(ring.sq_tail, ring.local_tail, __ATOMIC_RELEASE);
+    do {
+        int submitted = syscall(__NR_io_uring_enter, ring.fd, ring.unsubmitted, min_complete,
+                                min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (submitted == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to submit copies");
+            return -1;
+        }
+        ring.unsubmitted -= submitted;
+        min_complete = 0;
+    } while (ring.unsubmitted > 0);
+    ring.queued_copies = 0;
+    return 0;
+}
+
+/*!
+ * @brief complete_operation counts down the operations of a copy, and reports its error once the chain completed
+ * An operation that fails cancels the next ones of its chain, only the first error of a copy is kept.
+ * @param user_data is the user data of the operation (the slot of the copy and the operation)
+ * @param result is the result of the operation
+ */
+static void complete_operation(uint64_t user_data, int result) {
+    uring_copy_t *copy = &copies[user_data >> 8];
+    uring_operation_t operation = user_data & 0xff;
+    bool is_transfer = operation == URING_READ || operation == URING_WRITE;
+    if (result < 0 || (is_transfer && (uint64_t) result != copy->size)) {
+        if (copy->error == 0 || copy->error == ECANCELED) {
+            copy->error = result < 0 ? -result : URING_SHORT_TRANSFER;
+        }
+    }
+    if (--copy->pending > 0) {
+        return;
+    }
+    if (copy->error == URING_SHORT_TRANSFER) {
+        fprintf(stderr, "Failed to copy %s: its size changed since it was listed\n", copy->source);
+    } else if (copy->error != 0) {
+        fprintf(stderr, "Failed to copy %s: %s\n", copy->source, strerror(copy->error));
+    }
+    copy->busy = false;
+    --in_flight;
+}
+
+/*!
+ * @brief reap_completions handles the completions available in the completion ring, without waiting
+ */
+static void reap_completions(void) {
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        complete_operation(cqe->user_data, cqe->res);
+        ++head;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*!
+ * @brief prepare_operation prepares the next submission entry for an operation of a copy
+ * @param slot is the slot of the copy
+ * @param operation is the operation
+ * @param opcode is the io_uring operation code
+ * @param is_linked is true if the next operation of the chain depends on this one
+ * @return a pointer to the entry, its operation specific fields remain to be set
+ */
+static struct io_uring_sqe *prepare_operation(int slot, uring_operation_t operation, uint8_t opcode, bool is_linked) {
+    unsigned index = ring.local_tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->flags = is_linked ? IOSQE_IO_LINK : 0;
+    sqe->user_data = ((uint64_t) slot << 8) | operation;
+    ring.sq_array[index] = index;
+    ++ring.local_tail;
+    ++ring.unsubmitted;
+    ++copies[slot].pending;
+    return sqe;
+}
+
+/*!
+ * @brief queue_uring_copy queues the copy of a small file, it is submitted with the next ones
+ * When the window is full, it waits for copies to complete. Errors are reported when the copy completes.
+ * @param source_entry is a pointer to the source entry (a file)
+ * @param fd_directory is the destination directory (@see open_destination_parent), it must stay open until the copies
+ * are flushed
+ * @param name is the name of the file in the destination directory
+ * @return 0 if the copy is queued, -1 if it must be made synchronously (io_uring not available, file too large, or destination linked elsewhere)
+ */
+int queue_uring_copy(files_list_entry_t *source_entry, int fd_directory, char *name) {
+    if (source_entry->size > URING_BUFFER_SIZE || strlen(source_entry->path_and_name) >= PATH_SIZE || strlen(name) > NAME_MAX) {
+        return -1;
+    }
+    // The destination is truncated by its open: a file linked elsewhere is copied synchronously, which detaches it
+    // from its other links first (@see detach_destination_file)
+    struct stat sb;
+    if (fstatat(fd_directory, name, &sb, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(sb.st_mode) && sb.st_nlink > 1) {
+        return -1;
+    }
+    if (!ring_ready && open_uring_copy() == -1) {
+        return -1;
+    }
+    // Directories evicted from the cache are closed once no queued copy uses them
+    if (count_retired_directories() >= DIR_CACHE_SIZE) {
+        flush_uring_copies();
+    }
+    while (in_flight == URING_WINDOW) {
+        if (enter_ring(1) == -1) {
+            return -1;
+        }
+        reap_completions();
+    }
+    int slot = 0;
+    while (copies[slot].busy) {
+        ++slot;
+    }
+    uring_copy_t *copy = &copies[slot];
+    copy->busy = true;
+    strcpy(copy->source, source_entry->path_and_name);
+    strcpy(copy->name, name);
+    copy->size = source_entry->size;
+    copy->pending = 0;
+    copy->error = 0;
+    ++in_flight;
+
+    qos_throttle(QOS_FILES, 1);
+    qos_throttle(QOS_READ_BYTES, copy->size);
+    qos_throttle(QOS_WRITE_BYTES, copy->size);
+
+    // The source is opened first, so that a missing source does not truncate the destination
+    unsigned source_file = 2 * slot;
+    unsigned destination_file = 2 * slot + 1;
+    bool has_content = copy->size > 0;
+    struct io_uring_sqe *sqe;
+    if (has_content) {
+        sqe = prepare_operation(slot, URING_OPEN_SOURCE, IORING_OP_OPENAT, true);
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uintptr_t) copy->source;
+        sqe->open_flags = O_RDONLY;
+        sqe->file_index = source_file + 1;
+    }
+    sqe = prepare_operation(slot, URING_OPEN_DESTINATION, IORING_OP_OPENAT, true);
+    sqe->fd = fd_directory;
+    sqe->addr = (uintptr_t) copy->name;
+    sqe->len = source_entry->mode;
+    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+    sqe->file_index = destination_file + 1;
+    if (has_content) {
+        sqe = prepare_operation(slot, URING_READ, IORING_OP_READ_FIXED, true);
+        sqe->flags |= IOSQE_FIXED_FILE;
+        sqe->fd = source_file;
+        sqe->addr = (uintptr_t) (buffers + slot * URING_BUFFER_SIZE);
+        sqe->len = copy->size;
+        sqe->buf_index = slot;
+        sqe = prepare_operation(slot, URING_WRITE, IORING_OP_WRITE_FIXED, true);
+        sqe->flags |= IOSQE_FIXED_FILE;
+        sqe->fd = destination_file;
+        sqe->addr = (uintptr_t) (buffers + slot * URING_BUFFER_SIZE);
+        sqe->len = copy->size;
+        sqe->buf_index = slot;
+        sqe = prepare_operation(slot, URING_CLOSE_SOURCE, IORING_OP_CLOSE, true);
+        sqe->file_index = source_file + 1;
+    }
+    sqe = prepare_operation(slot, URING_CLOSE_DESTINATION, IORING_OP_CLOSE, false);
+    sqe->file_index = destination_file + 1;
+
+    if (++ring.queued_copies >= URING_SUBMIT_BATCH) {
+        enter_ring(0);
+    }
+    reap_completions();
+    return 0;
+}
+
+/*!
+ * @brief flush_uring_copies submits the queued copies and waits for all the copies in flight
+ * It must be called before an operation that depends on a copy (e.g. a hard link to it).
+ */
+void flush_uring_copies(void) {
+    while (ring_ready && in_flight > 0) {
+        if (enter_ring(1) == -1) {
+            fprintf(stderr, "%d copies were lost\n", in_flight);
+            in_flight = 0;
+            memset(copies, 0, sizeof(copies));
+            break;
+        }
+        reap_completions();
+    }
+    close_retired_directories();
+}
+
+/*!
+ * @brief close_uring_copy waits for the copies in flight and releases the engine, at the end of a synchronization
+ * The time spent waiting is added to the copy phase.
+ */
+void close_uring_copy(void) {
+    if (!ring_ready) {
+        return;
+    }
+    uint64_t flush_start = stats_now();
+    flush_uring_copies();
+    stats_add_phase(PHASE_COPY, flush_start, 0, 0);
+    release_ring();
+    defer_directory_closes(false);
+    ring_ready = false;
+}
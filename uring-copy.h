@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <limits.h>
+#include <linux/io_uring.h>
+#include "defines.h"
+#include "files-list.h"
+
+#define URING_WINDOW 64 // Copies in flight, at most (each one owns a registered buffer and two registered files)
+#define URING_BUFFER_SIZE (64 * 1024) // Larger files are copied synchronously with sendfile
+#define URING_SUBMIT_BATCH 16 // Copies queued before they are submitted together
+#define URING_CHAIN_LENGTH 6 // Operations of a copy: open source, open destination, read, write, close both
+#define URING_ENTRIES 512 // Submission queue size, at least URING_WINDOW * URING_CHAIN_LENGTH
+
+// A copy in flight: a chain of linked operations whose completions are counted down
+typedef struct {
+    bool busy;
+    char source[PATH_SIZE]; // The kernel reads the paths when the chain is submitted
+    char name[NAME_MAX + 1];
+    uint64_t size;
+    int pending; // Completions not received yet
+    int error; // First error of the chain (errno value), 0 if none
+} uring_copy_t;
+
+// Submission and completion rings shared with the kernel (@see io_uring_setup(2))
+typedef struct {
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned local_tail; // Tail of the prepared entries, published when they are submitted
+    unsigned unsubmitted; // Entries prepared and not submitted yet
+    unsigned queued_copies; // Copies prepared and not submitted yet
+} uring_t;
+
+int queue_uring_copy(files_list_entry_t *source_entry, int fd_directory, char *name);
+void flush_uring_copies(void);
+void close_uring_copy(void);